@@ -10,7 +10,21 @@ fn main() {
         .layout_tests(false)
         .header("mbeval/include/mbeval.h")
         .allowlist_function("mbeval_init")
+        .allowlist_function("mbeval_init_from_snapshot")
+        .allowlist_function("mbeval_write_snapshot")
+        .allowlist_function("mbeval_set_table_placement")
+        .allowlist_function("mbeval_table_placement")
         .allowlist_function("mbeval_get_mb_info")
+        .allowlist_function("mbeval_get_mb_info_bitboards")
+        .allowlist_function("mbeval_get_mb_info_filtered")
+        .allowlist_function("mbeval_get_mb_info_mirrored")
+        .allowlist_function("mbeval_get_mb_info_batch")
+        .allowlist_function("mbeval_get_child_mb_info")
+        .allowlist_function("mbeval_is_initialized")
+        .allowlist_function("mbeval_init_unrank")
+        .allowlist_function("mbeval_unrank")
+        .allowlist_var("MAX_PIECES_MB")
+        .allowlist_var("MBEVAL_PAGES_.*")
         .rustified_enum("PawnFileType")
         .rustified_enum("BishopParity")
         .rustified_enum("Side")
@@ -20,8 +34,16 @@ fn main() {
         .write_to_file(out_dir.join("bindings.rs"))
         .unwrap();
 
-    cc::Build::new()
-        .include("mbeval/include")
-        .file("mbeval/src/mbeval.c")
-        .compile("mbeval");
+    let mut build = cc::Build::new();
+    build.include("mbeval/include").file("mbeval/src/mbeval.c");
+    if env::var_os("CARGO_FEATURE_CHECK_RANKING").is_some() {
+        build.define("MBEVAL_CHECK_RANKING", None);
+    }
+    if env::var_os("CARGO_FEATURE_SWAP_SORT").is_some() {
+        build.define("MBEVAL_SWAP_SORT", None);
+    }
+    if env::var_os("CARGO_FEATURE_SCAN_ENDING_TYPES").is_some() {
+        build.define("MBEVAL_SCAN_ENDING_TYPES", None);
+    }
+    build.compile("mbeval");
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_PIECES_MB 9
@@ -66,6 +67,7 @@ typedef struct {
     int num_parities;
     int mb_position[MAX_PIECES_MB];
     Piece mb_piece_types[MAX_PIECES_MB];
+    int squares[MAX_PIECES_MB]; // untransformed mb_position
     int piece_type_count[2][KING];
     int parity;
     PawnFileType pawn_file_type;
@@ -80,7 +82,105 @@ typedef struct {
     int kk_index;
 } MbInfo;
 
+typedef struct {
+    Piece pieces[NSQUARES];
+    Side side;
+    int ep_square;
+} MbPosition;
+
+// Computes the index tables. Calling it again, for example after changing the
+// table placement, releases the previous tables, so no other thread may be
+// using them.
 void mbeval_init(void);
 
+// Like mbeval_init, but maps the large index tables read-only from a snapshot
+// written by mbeval_write_snapshot, so that they are shared through the page
+// cache. Falls back to computing the tables if the snapshot is missing or
+// stale. Returns 1 if the snapshot was used, 0 otherwise.
+int mbeval_init_from_snapshot(const char *path);
+
+// Writes a snapshot of the index tables, replacing any existing snapshot
+// atomically, so that processes that have it mapped are unaffected. Requires
+// prior initialization. Returns 0 on success, -1 on error (with errno set).
+int mbeval_write_snapshot(const char *path);
+
+// Flags for mbeval_set_table_placement.
+#define MBEVAL_PAGES_HUGE 1       // transparent huge pages
+#define MBEVAL_PAGES_HUGETLB 2    // preallocated huge pages, else as above
+#define MBEVAL_PAGES_INTERLEAVE 4 // interleave pages across NUMA nodes
+
+// Sets how the index tables computed by subsequent initializations are placed
+// in memory, as a combination of MBEVAL_PAGES_* flags. Tables mapped from a
+// snapshot are left to the page cache. Unsupported flags are ignored.
+void mbeval_set_table_placement(int placement);
+
+// Returns the MBEVAL_PAGES_* flags that took effect for the current tables.
+int mbeval_table_placement(void);
+
+// Fills in the MbInfo of a position, returning 0 on success. info need not be
+// initialized. Of the pawn file type indices, only those relevant to
+// pawn_file_type are set (Op11 and Bp11 for Bp11, Op22 and Dp22 for Dp22).
 int mbeval_get_mb_info(const Piece pieces[NSQUARES], Side side, int ep_square,
                        MbInfo *info);
+
+// Like mbeval_get_mb_info, but takes the occupancy masks of each side (White,
+// Black) and role (pawn, knight, bishop, rook, queen, king), with bit i set for
+// a piece on square i.
+int mbeval_get_mb_info_bitboards(const uint64_t bitboards[2][6], Side side,
+                                 int ep_square, MbInfo *info);
+
+// Decides for a table variant, identified by pawn file type, bishop parities
+// and kk_index, whether its index is needed. Returns nonzero if so.
+typedef int (*MbTableFilter)(void *data, PawnFileType pawn_file_type,
+                             const BishopParity bishop_parity[2],
+                             int kk_index);
+
+// Like mbeval_get_mb_info_bitboards, but computes only the indices of the table
+// variants accepted by filter, which is called with the given data. The
+// indices of rejected variants are set to all ones.
+int mbeval_get_mb_info_filtered(const uint64_t bitboards[2][6], Side side,
+                                int ep_square, MbTableFilter filter, void *data,
+                                MbInfo *info);
+
+// Like mbeval_get_mb_info_filtered, but also computes the MbInfo of the
+// position with the colours swapped and the board mirrored vertically, sharing
+// the piece list extraction. filter, if not NULL, is called with data for the
+// position and with mirrored_data for the mirrored position. Stores the MbInfo
+// and return value of the position at index 0, and of the mirrored position at
+// index 1.
+void mbeval_get_mb_info_mirrored(const uint64_t bitboards[2][6], Side side,
+                                 int ep_square, MbTableFilter filter,
+                                 void *data, void *mirrored_data,
+                                 MbInfo infos[2], int results[2]);
+
+// Computes the MbInfo of the position after moving the piece on from to to,
+// given the MbInfo of the parent position, which must have been computed
+// successfully. promotion is the role promoted to, or NO_PIECE. side and
+// ep_square describe the child position, as for mbeval_get_mb_info. Quiet
+// moves reuse the ending types of the parent and only recompute indices.
+int mbeval_get_child_mb_info(const MbInfo *parent, int from, int to,
+                             Piece promotion, Side side, int ep_square,
+                             MbInfo *info);
+
+// Returns 1 once the tables are initialized.
+int mbeval_is_initialized(void);
+
+// Like mbeval_get_mb_info for each of n positions, storing the return values
+// in results. Ending type resolution is shared between positions with the same
+// material.
+void mbeval_get_mb_info_batch(const MbPosition *positions, size_t n,
+                              MbInfo *infos, int *results);
+
+// Builds the tables used by mbeval_unrank, which takes about a second.
+// Requires prior initialization.
+void mbeval_init_unrank(void);
+
+// Reconstructs the canonical position with the given index in a table, which
+// is identified as in MbInfo by the material count, pawn_file_type,
+// bishop_parity (None for pawn file types other than Free) and kk_index.
+// Stores the pieces, and the en passant square or 0, and returns 0. Returns 1
+// if no position has this index, and a negative value if there is no such
+// table. Requires prior mbeval_init_unrank.
+int mbeval_unrank(const int count[2][KING], PawnFileType pawn_file_type,
+                  const BishopParity bishop_parity[2], int kk_index,
+                  ZIndex index, Piece pieces[NSQUARES], int *ep_square);
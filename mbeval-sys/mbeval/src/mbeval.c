@@ -1,14 +1,32 @@
 /* Based on mbeval.cpp 7.9 */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "mbeval.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_TRANSFORMS
+#include <immintrin.h>
+#endif
 
 #if (NROWS == 8) && (NCOLS == 8)
 #define Row(sq) ((sq) >> 3)
@@ -232,8 +250,47 @@
         }                                                                      \
     }
 
+// Orders a >= b without branching, so that sorting networks built from it
+// compile to conditional moves and do not depend on the order of the input.
+
+#define ORDER(a, b)                                                            \
+    {                                                                          \
+        int hi = (a) > (b) ? (a) : (b);                                        \
+        int lo = (a) > (b) ? (b) : (a);                                        \
+        a = hi;                                                                \
+        b = lo;                                                                \
+    }
+
 #define KK_TABLE_LIMIT 256
 
+/*
+ * Indices of 2, 3 or 4 identical pieces (including the bishop parity variants)
+ * are computed arithmetically by default. Define MBEVAL_TABLE_RANKING to look
+ * them up in precomputed tables instead, or MBEVAL_CHECK_RANKING to compute
+ * them arithmetically and assert that they match the tables. The check-ranking
+ * feature of the crate defines the latter, and its tests enable it.
+ */
+
+#if defined(MBEVAL_TABLE_RANKING) || defined(MBEVAL_CHECK_RANKING)
+#define RANK_TABLES
+#endif
+
+#if defined(MBEVAL_TABLE_RANKING)
+#define RANK(arithmetic, table) (table)
+#elif defined(MBEVAL_CHECK_RANKING)
+#define RANK(arithmetic, table) CheckRank(arithmetic, table)
+#else
+#define RANK(arithmetic, table) (arithmetic)
+#endif
+
+/*
+ * The ranking helpers are forced inline, so that every index function in
+ * IndexTable compiles to a single straight-line ranker with constant strides.
+ * The call through index_from_pos is then the only call left per index.
+ */
+
+#define RANKER static inline __attribute__((always_inline))
+
 /*
  * We make the bottom-right corner "white"
  */
@@ -503,12 +560,88 @@ typedef struct {
 static int ParityTable[NSQUARES];
 static int WhiteSquare[NSQUARES / 2], BlackSquare[NSQUARES / 2];
 
+// ParityCount[p][sq] is the number of squares below sq with parity p. The
+// N*Base tables count the ranked tuples whose lowest square is below sq, and
+// N3OddPairs[p][sq] the pairs in N3 odd tuples with a lowest square of parity p
+// and a middle square below sq.
+
+static int ParityCount[2][NSQUARES + 1];
+static int N2EvenBase[NSQUARES], N2OddBase[NSQUARES];
+static int N3EvenBase[NSQUARES], N3OddBase[NSQUARES];
+static int N3OddPairs[2][NSQUARES + 1];
+
 // For 5 or more identical pieces, always compute index rather than creating
-// lookup table
+// lookup table. The squares are sorted in decreasing order by optimal sorting
+// networks (9, 12 and 16 comparators), which unlike a branchy insertion sort
+// cost the same for any order of the pieces. Define MBEVAL_SWAP_SORT to use
+// the original branchy sort instead, so that the two can be benchmarked
+// against each other; the swap-sort feature of the crate defines it.
 
 static ZIndex k5_tab[NSQUARES + 1];
+static ZIndex k6_tab[NSQUARES + 1];
+static ZIndex k7_tab[NSQUARES + 1];
+
+#ifndef MBEVAL_SWAP_SORT
+
+RANKER ZIndex N5_Index(int a, int b, int c, int d, int e) {
+    ORDER(a, b);
+    ORDER(d, e);
+    ORDER(c, e);
+    ORDER(c, d);
+    ORDER(a, d);
+    ORDER(a, c);
+    ORDER(b, e);
+    ORDER(b, d);
+    ORDER(b, c);
+
+    return k5_tab[a] + b * (b - 1) * (b - 2) * (b - 3) / 24 +
+           c * (c - 1) * (c - 2) / 6 + d * (d - 1) / 2 + e;
+}
+
+RANKER ZIndex N6_Index(int a, int b, int c, int d, int e, int f) {
+    ORDER(b, c);
+    ORDER(e, f);
+    ORDER(a, c);
+    ORDER(d, f);
+    ORDER(a, b);
+    ORDER(d, e);
+    ORDER(c, f);
+    ORDER(a, d);
+    ORDER(b, e);
+    ORDER(c, e);
+    ORDER(b, d);
+    ORDER(c, d);
+
+    return k6_tab[a] + k5_tab[b] + c * (c - 1) * (c - 2) * (c - 3) / 24 +
+           d * (d - 1) * (d - 2) / 6 + e * (e - 1) / 2 + f;
+}
+
+RANKER ZIndex N7_Index(int a, int b, int c, int d, int e, int f, int g) {
+    ORDER(b, c);
+    ORDER(d, e);
+    ORDER(f, g);
+    ORDER(a, c);
+    ORDER(d, f);
+    ORDER(e, g);
+    ORDER(a, b);
+    ORDER(e, f);
+    ORDER(c, g);
+    ORDER(a, e);
+    ORDER(b, f);
+    ORDER(a, d);
+    ORDER(c, f);
+    ORDER(b, d);
+    ORDER(c, e);
+    ORDER(c, d);
+
+    return k7_tab[a] + k6_tab[b] + k5_tab[c] +
+           d * (d - 1) * (d - 2) * (d - 3) / 24 + e * (e - 1) * (e - 2) / 6 +
+           f * (f - 1) / 2 + g;
+}
+
+#else
 
-static ZIndex N5_Index(int a, int b, int c, int d, int e) {
+RANKER ZIndex N5_Index(int a, int b, int c, int d, int e) {
     // Sort a >= b >= c >= d >= e
 
     if (a < b)
@@ -551,9 +684,7 @@ static ZIndex N5_Index(int a, int b, int c, int d, int e) {
            c * (c - 1) * (c - 2) / 6 + d * (d - 1) / 2 + e;
 }
 
-static ZIndex k6_tab[NSQUARES + 1];
-
-static ZIndex N6_Index(int a, int b, int c, int d, int e, int f) {
+RANKER ZIndex N6_Index(int a, int b, int c, int d, int e, int f) {
     if (b > a)
         SWAP(a, b);
     if (c > a)
@@ -568,9 +699,7 @@ static ZIndex N6_Index(int a, int b, int c, int d, int e, int f) {
     return k6_tab[a] + N5_Index(b, c, d, e, f);
 }
 
-static ZIndex k7_tab[NSQUARES + 1];
-
-static ZIndex N7_Index(int a, int b, int c, int d, int e, int f, int g) {
+RANKER ZIndex N7_Index(int a, int b, int c, int d, int e, int f, int g) {
     if (b > a)
         SWAP(a, b);
     if (c > a)
@@ -587,59 +716,213 @@ static ZIndex N7_Index(int a, int b, int c, int d, int e, int f, int g) {
     return k7_tab[a] + N6_Index(b, c, d, e, f, g);
 }
 
-static int *k2_tab = NULL, *k3_tab = NULL, *k4_tab = NULL;
+#endif
+
+/*
+ * Compact replacement for the dense NSQUARES^4 rank tables, which are almost
+ * entirely filled with -1. A lookup first sorts interchangeable arguments into
+ * canonical order and then splits them into a row (three squares) and a column
+ * (the remaining square). The canonical entries of a row are enumerated in
+ * consecutive order, so each row only needs a mask of valid columns and the
+ * rank of its first valid column. That is 16 bytes per row, a single cache
+ * line per lookup, and 4 MB per table instead of 64 MB.
+ */
+
+typedef struct {
+    uint64_t columns;
+    int base;
+} RankRow;
+
+#define RANK_ROWS (NSQUARES * NSQUARES * NSQUARES)
+#define RankRowIndex(a, b, c) ((a) | ((b) << 6) | ((c) << 12))
+
+static void RankRowSet(RankRow *rows, int row, int col, int index) {
+    RankRow *r = &rows[row];
+    if (r->columns == 0)
+        r->base = index;
+    r->columns |= ONE << col;
+    assert(r->base + __builtin_popcountll(r->columns & ((ONE << col) - 1)) ==
+           index);
+}
+
+RANKER int RankRowLookup(const RankRow *rows, int row, int col) {
+    const RankRow *r = &rows[row];
+    uint64_t bit = ONE << col;
+    if (!(r->columns & bit))
+        return -1;
+    return r->base + __builtin_popcountll(r->columns & (bit - 1));
+}
+
+#ifdef RANK_TABLES
+static int *k2_tab = NULL, *k3_tab = NULL;
+static RankRow *k4_rows = NULL;
 static int *k2_even_tab = NULL;
 static int *k2_odd_tab = NULL;
 static int *k3_even_tab = NULL;
 static int *k3_odd_tab = NULL;
+#endif
 
 static int *k2_opposing_tab = NULL;
 static int *k2_1_opposing_tab = NULL;
 static int *k1_2_opposing_tab = NULL;
 static int *k4_opposing_tab = NULL;
-static int *k2_2_opposing_tab = NULL;
-static int *k3_1_opposing_tab = NULL;
-static int *k1_3_opposing_tab = NULL;
+static RankRow *k2_2_opposing_rows = NULL;
+static RankRow *k3_1_opposing_rows = NULL;
+static RankRow *k1_3_opposing_rows = NULL;
+
+#ifdef RANK_TABLES
+RANKER int N4_Table_Index(int a, int b, int c, int d) {
+    // a < b < c < d
+    SORT(a, b);
+    SORT(c, d);
+    SORT(a, c);
+    SORT(b, d);
+    SORT(b, c);
+    return RankRowLookup(k4_rows, RankRowIndex(a, b, c), d);
+}
+#endif
+
+#ifdef MBEVAL_CHECK_RANKING
+RANKER int CheckRank(int rank, int expected) {
+    assert(rank == expected);
+    return rank;
+}
+#endif
+
+#define C2(n) ((n) * ((n) - 1) / 2)
+#define C3(n) ((n) * ((n) - 1) * ((n) - 2) / 6)
+#define C4(n) ((n) * ((n) - 1) * ((n) - 2) * ((n) - 3) / 24)
+
+#ifndef MBEVAL_TABLE_RANKING
+/*
+ * Lexicographic rank of a < b < c < d among all combinations of distinct
+ * squares, as enumerated by the tables: the number of combinations that come
+ * after it is the colexicographic rank of the mirrored squares.
+ */
+
+RANKER int N2_Rank(int a, int b) {
+    SORT(a, b);
+    return N2 - 1 - C2(NSQUARES - 1 - a) - (NSQUARES - 1 - b);
+}
+
+RANKER int N3_Rank(int a, int b, int c) {
+    SORT(a, b);
+    SORT(b, c);
+    SORT(a, b);
+    return N3 - 1 - C3(NSQUARES - 1 - a) - C2(NSQUARES - 1 - b) -
+           (NSQUARES - 1 - c);
+}
+
+RANKER int N4_Rank(int a, int b, int c, int d) {
+    SORT(a, b);
+    SORT(c, d);
+    SORT(a, c);
+    SORT(b, d);
+    SORT(b, c);
+    return N4 - 1 - C4(NSQUARES - 1 - a) - C3(NSQUARES - 1 - b) -
+           C2(NSQUARES - 1 - c) - (NSQUARES - 1 - d);
+}
 
-static int N2_Index(int a, int b) { return (k2_tab[(a) | ((b) << 6)]); }
-static int N3_Index(int a, int b, int c) {
-    return (k3_tab[(a) | ((b) << 6) | ((c) << 12)]);
+RANKER int N2_Even_Rank(int a, int b) {
+    SORT(a, b);
+    int p = ParityTable[a];
+    if (ParityTable[b] != p)
+        return -1;
+    return N2EvenBase[a] + ParityCount[p][b] - ParityCount[p][a + 1];
+}
+
+RANKER int N2_Odd_Rank(int a, int b) {
+    SORT(a, b);
+    int q = !ParityTable[a];
+    if (ParityTable[b] != q)
+        return -1;
+    return N2OddBase[a] + ParityCount[q][b] - ParityCount[q][a + 1];
+}
+
+RANKER int N3_Even_Rank(int a, int b, int c) {
+    SORT(a, b);
+    SORT(b, c);
+    SORT(a, b);
+    int p = ParityTable[a];
+    if (ParityTable[b] != p || ParityTable[c] != p)
+        return -1;
+    // rank of (b, c) among pairs of the m squares of parity p above a
+    int m = ParityCount[p][NSQUARES] - ParityCount[p][a + 1];
+    int j = ParityCount[p][b] - ParityCount[p][a + 1];
+    int k = ParityCount[p][c] - ParityCount[p][a + 1];
+    return N3EvenBase[a] + C2(m) - C2(m - j) + k - j - 1;
+}
+
+RANKER int N3_Odd_Rank(int a, int b, int c) {
+    SORT(a, b);
+    SORT(b, c);
+    SORT(a, b);
+    int p = ParityTable[a];
+    if (ParityTable[b] == p && ParityTable[c] == p)
+        return -1;
+    int rank = N3OddBase[a] + N3OddPairs[p][b] - N3OddPairs[p][a + 1];
+    if (ParityTable[b] == p)
+        return rank + ParityCount[!p][c] - ParityCount[!p][b + 1];
+    return rank + c - b - 1;
 }
-static int N4_Index(int a, int b, int c, int d) {
-    return (k4_tab[(a) | ((b) << 6) | ((c) << 12) | ((d) << 18)]);
+#endif
+
+RANKER int N2_Index(int a, int b) {
+    return RANK(N2_Rank(a, b), k2_tab[(a) | ((b) << 6)]);
+}
+RANKER int N3_Index(int a, int b, int c) {
+    return RANK(N3_Rank(a, b, c), k3_tab[(a) | ((b) << 6) | ((c) << 12)]);
+}
+RANKER int N4_Index(int a, int b, int c, int d) {
+    return RANK(N4_Rank(a, b, c, d), N4_Table_Index(a, b, c, d));
 }
-static int N2_Odd_Index(int a, int b) { return (k2_odd_tab[(a) | ((b) << 6)]); }
-static int N2_Even_Index(int a, int b) {
-    return (k2_even_tab[(a) | ((b) << 6)]);
+RANKER int N2_Odd_Index(int a, int b) {
+    return RANK(N2_Odd_Rank(a, b), k2_odd_tab[(a) | ((b) << 6)]);
 }
-static int N3_Odd_Index(int a, int b, int c) {
-    return (k3_odd_tab[(a) | ((b) << 6) | ((c) << 12)]);
+RANKER int N2_Even_Index(int a, int b) {
+    return RANK(N2_Even_Rank(a, b), k2_even_tab[(a) | ((b) << 6)]);
 }
-static int N3_Even_Index(int a, int b, int c) {
-    return (k3_even_tab[(a) | ((b) << 6) | ((c) << 12)]);
+RANKER int N3_Odd_Index(int a, int b, int c) {
+    return RANK(N3_Odd_Rank(a, b, c),
+                k3_odd_tab[(a) | ((b) << 6) | ((c) << 12)]);
 }
-static int N2_Opposing_Index(int a, int b) {
+RANKER int N3_Even_Index(int a, int b, int c) {
+    return RANK(N3_Even_Rank(a, b, c),
+                k3_even_tab[(a) | ((b) << 6) | ((c) << 12)]);
+}
+RANKER int N2_Opposing_Index(int a, int b) {
     return (k2_opposing_tab[(a) | ((b) << 6)]);
 }
-static int N4_Opposing_Index(int a, int b, int c, int d) {
+RANKER int N4_Opposing_Index(int a, int b, int c, int d) {
     return (
         k4_opposing_tab[((a) >> 3) | ((b) & 070) | ((c) << 6) | ((d) << 12)]);
 }
 
-static int N2_1_Opposing_Index(int a, int b, int c) {
+RANKER int N2_1_Opposing_Index(int a, int b, int c) {
     return (k2_1_opposing_tab[(a) | ((b) << 6) | ((c) << 12)]);
 }
-static int N1_2_Opposing_Index(int a, int b, int c) {
+RANKER int N1_2_Opposing_Index(int a, int b, int c) {
     return (k1_2_opposing_tab[(a) | ((b) << 6) | ((c) << 12)]);
 }
-static int N3_1_Opposing_Index(int a, int b, int c, int d) {
-    return (k3_1_opposing_tab[(a) | ((b) << 6) | ((c) << 12) | ((d) << 18)]);
+RANKER int N3_1_Opposing_Index(int a, int b, int c, int d) {
+    // d < c < b for the white pawns
+    SORT(d, c);
+    SORT(c, b);
+    SORT(d, c);
+    return RankRowLookup(k3_1_opposing_rows, RankRowIndex(b, c, d), a);
 }
-static int N1_3_Opposing_Index(int a, int b, int c, int d) {
-    return (k1_3_opposing_tab[(a) | ((b) << 6) | ((c) << 12) | ((d) << 18)]);
+RANKER int N1_3_Opposing_Index(int a, int b, int c, int d) {
+    // c < b < a for the black pawns
+    SORT(c, b);
+    SORT(b, a);
+    SORT(c, b);
+    return RankRowLookup(k1_3_opposing_rows, RankRowIndex(a, b, c), d);
 }
-static int N2_2_Opposing_Index(int a, int b, int c, int d) {
-    return (k2_2_opposing_tab[(a) | ((b) << 6) | ((c) << 12) | ((d) << 18)]);
+RANKER int N2_2_Opposing_Index(int a, int b, int c, int d) {
+    // b < a for the black pawns, d < c for the white pawns
+    SORT(b, a);
+    SORT(d, c);
+    return RankRowLookup(k2_2_opposing_rows, RankRowIndex(b, c, d), a);
 }
 
 static int Identity[NSQUARES];
@@ -737,6 +1020,7 @@ static int KK_Index_Table_NoPawns[NSQUARES][NSQUARES];
 static int WhiteSquares[NUM_WHITE_SQUARES], BlackSquares[NUM_BLACK_SQUARES];
 static bool IsWhiteSquare[NSQUARES];
 
+#ifdef RANK_TABLES
 static void InitN2Tables(int *tab) {
     int index = 0, score;
 
@@ -881,6 +1165,8 @@ static void InitN3OddTables(int *tab) {
     assert(index == N3_ODD_PARITY);
 }
 
+#endif
+
 static void InitN2OpposingTables(int *tab) {
     int index = 0;
 
@@ -1101,13 +1387,9 @@ static void InitN1_2_OpposingTables(int *tab) {
     assert(index == N1_2_OPPOSING);
 }
 
-static void InitN2_2_OpposingTables(int *tab) {
+static void InitN2_2_OpposingTables(RankRow *rows) {
     int index = 0, board[NSQUARES];
 
-    for (int i = 0; i < NSQUARES * NSQUARES * NSQUARES * NSQUARES; i++) {
-        tab[i] = -1;
-    }
-
     memset(board, 0, sizeof(board));
 
     for (int wp1 = 0; wp1 < NSQUARES - NCOLS; wp1++) {
@@ -1244,18 +1526,7 @@ static void InitN2_2_OpposingTables(int *tab) {
                         board[bp2_physical] = 0;
                         continue;
                     }
-                    tab[bp2 +
-                        NSQUARES * (bp1 + NSQUARES * (wp2 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (bp2 + NSQUARES * (wp2 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp2 +
-                        NSQUARES * (bp1 + NSQUARES * (wp1 + NSQUARES * wp2))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (bp2 + NSQUARES * (wp1 + NSQUARES * wp2))] =
-                        index;
+                    RankRowSet(rows, RankRowIndex(bp1, wp2, wp1), bp2, index);
                     index++;
                     board[bp2_physical] = 0;
                 }
@@ -1269,13 +1540,9 @@ static void InitN2_2_OpposingTables(int *tab) {
     assert(index == N2_2_OPPOSING);
 }
 
-static void InitN3_1_OpposingTables(int *tab) {
+static void InitN3_1_OpposingTables(RankRow *rows) {
     int index = 0, board[NSQUARES];
 
-    for (int i = 0; i < NSQUARES * NSQUARES * NSQUARES * NSQUARES; i++) {
-        tab[i] = -1;
-    }
-
     memset(board, 0, sizeof(board));
 
     for (int wp1 = 0; wp1 < NSQUARES - NCOLS; wp1++) {
@@ -1390,24 +1657,7 @@ static void InitN3_1_OpposingTables(int *tab) {
                         board[bp1_physical] = 0;
                         continue;
                     }
-                    tab[bp1 +
-                        NSQUARES * (wp3 + NSQUARES * (wp2 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (wp2 + NSQUARES * (wp3 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (wp3 + NSQUARES * (wp1 + NSQUARES * wp2))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (wp1 + NSQUARES * (wp3 + NSQUARES * wp2))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (wp2 + NSQUARES * (wp1 + NSQUARES * wp3))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (wp1 + NSQUARES * (wp2 + NSQUARES * wp3))] =
-                        index;
+                    RankRowSet(rows, RankRowIndex(wp3, wp2, wp1), bp1, index);
                     index++;
                     board[bp1_physical] = 0;
                 }
@@ -1421,13 +1671,9 @@ static void InitN3_1_OpposingTables(int *tab) {
     assert(index == N3_1_OPPOSING);
 }
 
-static void InitN1_3_OpposingTables(int *tab) {
+static void InitN1_3_OpposingTables(RankRow *rows) {
     int index = 0, board[NSQUARES];
 
-    for (int i = 0; i < NSQUARES * NSQUARES * NSQUARES * NSQUARES; i++) {
-        tab[i] = -1;
-    }
-
     memset(board, 0, sizeof(board));
 
     for (int bp1 = 0; bp1 < NSQUARES - NCOLS; bp1++) {
@@ -1542,24 +1788,7 @@ static void InitN1_3_OpposingTables(int *tab) {
                         board[wp1_physical] = 0;
                         continue;
                     }
-                    tab[bp3 +
-                        NSQUARES * (bp2 + NSQUARES * (bp1 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp3 +
-                        NSQUARES * (bp1 + NSQUARES * (bp2 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (bp3 + NSQUARES * (bp2 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp1 +
-                        NSQUARES * (bp2 + NSQUARES * (bp3 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp2 +
-                        NSQUARES * (bp3 + NSQUARES * (bp1 + NSQUARES * wp1))] =
-                        index;
-                    tab[bp2 +
-                        NSQUARES * (bp1 + NSQUARES * (bp3 + NSQUARES * wp1))] =
-                        index;
+                    RankRowSet(rows, RankRowIndex(bp3, bp2, bp1), wp1, index);
                     index++;
                     board[wp1_physical] = 0;
                 }
@@ -1637,7 +1866,7 @@ static int IsValidDP22(int w1, int w2, int b1, int b2) {
     return NON_ADJACENT;
 }
 
-static ZIndex IndexDP22(const int *);
+RANKER ZIndex IndexDP22(const int *);
 
 static void InitN4OpposingTables(int *tab) {
     for (int w1 = 0; w1 < NSQUARES; w1++) {
@@ -1740,6 +1969,7 @@ static void InitN4OpposingTables(int *tab) {
     }
 }
 
+#ifdef RANK_TABLES
 static void InitN3Tables(int *tab) {
     int index = 0, score;
 
@@ -1766,94 +1996,14 @@ static void InitN3Tables(int *tab) {
     assert(index == N3);
 }
 
-static void InitN4Tables(int *tab) {
-    int index = 0, score;
+static void InitN4Tables(RankRow *rows) {
+    int index = 0;
 
     for (int p1 = 0; p1 < NSQUARES; p1++) {
-        for (int p2 = p1; p2 < NSQUARES; p2++) {
-            for (int p3 = p2; p3 < NSQUARES; p3++) {
-                for (int p4 = p3; p4 < NSQUARES; p4++) {
-                    if (p1 == p2 || p1 == p3 || p1 == p4 || p2 == p3 ||
-                        p2 == p4 || p3 == p4) {
-                        score = -1;
-                    } else {
-                        score = index++;
-                    }
-                    tab[p1 +
-                        NSQUARES * (p2 + NSQUARES * (p3 + p4 * NSQUARES))] =
-                        score;
-                    tab[p1 +
-                        NSQUARES * (p2 + NSQUARES * (p4 + p3 * NSQUARES))] =
-                        score;
-                    tab[p1 +
-                        NSQUARES * (p3 + NSQUARES * (p2 + p4 * NSQUARES))] =
-                        score;
-                    tab[p1 +
-                        NSQUARES * (p3 + NSQUARES * (p4 + p2 * NSQUARES))] =
-                        score;
-                    tab[p1 +
-                        NSQUARES * (p4 + NSQUARES * (p3 + p2 * NSQUARES))] =
-                        score;
-                    tab[p1 +
-                        NSQUARES * (p4 + NSQUARES * (p2 + p3 * NSQUARES))] =
-                        score;
-
-                    tab[p2 +
-                        NSQUARES * (p1 + NSQUARES * (p3 + p4 * NSQUARES))] =
-                        score;
-                    tab[p2 +
-                        NSQUARES * (p1 + NSQUARES * (p4 + p3 * NSQUARES))] =
-                        score;
-                    tab[p2 +
-                        NSQUARES * (p3 + NSQUARES * (p4 + p1 * NSQUARES))] =
-                        score;
-                    tab[p2 +
-                        NSQUARES * (p3 + NSQUARES * (p1 + p4 * NSQUARES))] =
-                        score;
-                    tab[p2 +
-                        NSQUARES * (p4 + NSQUARES * (p1 + p3 * NSQUARES))] =
-                        score;
-                    tab[p2 +
-                        NSQUARES * (p4 + NSQUARES * (p3 + p1 * NSQUARES))] =
-                        score;
-
-                    tab[p3 +
-                        NSQUARES * (p2 + NSQUARES * (p1 + p4 * NSQUARES))] =
-                        score;
-                    tab[p3 +
-                        NSQUARES * (p2 + NSQUARES * (p4 + p1 * NSQUARES))] =
-                        score;
-                    tab[p3 +
-                        NSQUARES * (p1 + NSQUARES * (p4 + p2 * NSQUARES))] =
-                        score;
-                    tab[p3 +
-                        NSQUARES * (p1 + NSQUARES * (p2 + p4 * NSQUARES))] =
-                        score;
-                    tab[p3 +
-                        NSQUARES * (p4 + NSQUARES * (p2 + p1 * NSQUARES))] =
-                        score;
-                    tab[p3 +
-                        NSQUARES * (p4 + NSQUARES * (p1 + p2 * NSQUARES))] =
-                        score;
-
-                    tab[p4 +
-                        NSQUARES * (p2 + NSQUARES * (p3 + p1 * NSQUARES))] =
-                        score;
-                    tab[p4 +
-                        NSQUARES * (p2 + NSQUARES * (p1 + p3 * NSQUARES))] =
-                        score;
-                    tab[p4 +
-                        NSQUARES * (p1 + NSQUARES * (p2 + p3 * NSQUARES))] =
-                        score;
-                    tab[p4 +
-                        NSQUARES * (p1 + NSQUARES * (p3 + p2 * NSQUARES))] =
-                        score;
-                    tab[p4 +
-                        NSQUARES * (p3 + NSQUARES * (p1 + p2 * NSQUARES))] =
-                        score;
-                    tab[p4 +
-                        NSQUARES * (p3 + NSQUARES * (p2 + p1 * NSQUARES))] =
-                        score;
+        for (int p2 = p1 + 1; p2 < NSQUARES; p2++) {
+            for (int p3 = p2 + 1; p3 < NSQUARES; p3++) {
+                for (int p4 = p3 + 1; p4 < NSQUARES; p4++) {
+                    RankRowSet(rows, RankRowIndex(p1, p2, p3), p4, index++);
                 }
             }
         }
@@ -1862,6 +2012,8 @@ static void InitN4Tables(int *tab) {
     assert(index == N4);
 }
 
+#endif
+
 static void InitN5Tables(void) {
     for (unsigned int i = 0; i <= NSQUARES; i++)
         k5_tab[i] = i * (i - 1) * (i - 2) * (i - 3) * (i - 4) / 120;
@@ -1884,59 +2036,207 @@ static void InitN7Tables(void) {
     }
 }
 
-static void InitPermutationTables(void) {
-    k2_opposing_tab = (int *)MyMalloc(NSQUARES * NSQUARES * sizeof(int));
-    InitN2OpposingTables(k2_opposing_tab);
+/*
+ * All permutation tables live in a single arena, either allocated and computed
+ * at startup, or mapped read-only from a snapshot file written by a previous
+ * run. Sections are cache line aligned. Returns the size of the arena, and
+ * points the tables into it unless base is NULL.
+ */
+static unsigned char *PermutationTables = NULL;
+
+static size_t PermutationTablesLayout(unsigned char *base) {
+    size_t offset = 0;
+
+#define PLACE(table, type, count)                                              \
+    do {                                                                       \
+        if (base != NULL)                                                      \
+            table = (type *)(base + offset);                                   \
+        offset += ((count) * sizeof(type) + 63) & ~(size_t)63;                 \
+    } while (0)
+
+    PLACE(k2_opposing_tab, int, NSQUARES * NSQUARES);
+    PLACE(k2_1_opposing_tab, int, NSQUARES * NSQUARES * NSQUARES);
+    PLACE(k1_2_opposing_tab, int, NSQUARES * NSQUARES * NSQUARES);
+    PLACE(k2_2_opposing_rows, RankRow, RANK_ROWS);
+    PLACE(k3_1_opposing_rows, RankRow, RANK_ROWS);
+    PLACE(k1_3_opposing_rows, RankRow, RANK_ROWS);
+    PLACE(k4_opposing_tab, int, NSQUARES * NSQUARES * NROWS * NROWS);
+#ifdef RANK_TABLES
+    PLACE(k4_rows, RankRow, RANK_ROWS);
+    PLACE(k3_tab, int, NSQUARES * NSQUARES * NSQUARES);
+    PLACE(k3_even_tab, int, NSQUARES * NSQUARES * NSQUARES);
+    PLACE(k3_odd_tab, int, NSQUARES * NSQUARES * NSQUARES);
+    PLACE(k2_tab, int, NSQUARES * NSQUARES);
+    PLACE(k2_even_tab, int, NSQUARES * NSQUARES);
+    PLACE(k2_odd_tab, int, NSQUARES * NSQUARES);
+#endif
 
-    k2_1_opposing_tab =
-        (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * sizeof(int));
-    InitN2_1_OpposingTables(k2_1_opposing_tab);
+#undef PLACE
 
-    k1_2_opposing_tab =
-        (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * sizeof(int));
-    InitN1_2_OpposingTables(k1_2_opposing_tab);
+    return offset;
+}
 
-    k2_2_opposing_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES *
-                                        NSQUARES * sizeof(int));
-    InitN2_2_OpposingTables(k2_2_opposing_tab);
+/*
+ * The arena is read at random on every probe, so it can be backed by huge
+ * pages to save TLB misses, and its pages can be interleaved across NUMA nodes
+ * so that threads on every node see the same average latency, rather than all
+ * tables living on the node of the thread that happened to initialize them.
+ * The policy must be applied before the pages are first touched.
+ */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
 
-    k3_1_opposing_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES *
-                                        NSQUARES * sizeof(int));
-    InitN3_1_OpposingTables(k3_1_opposing_tab);
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
 
-    k1_3_opposing_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES *
-                                        NSQUARES * sizeof(int));
-    InitN1_3_OpposingTables(k1_3_opposing_tab);
+static int TablePlacement = 0;
+static int AppliedTablePlacement = 0;
 
-    k4_opposing_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES *
-                                      NSQUARES * sizeof(int));
-    InitN4OpposingTables(k4_opposing_tab);
+/*
+ * The mapping that holds the arena, or NULL if the arena was allocated with
+ * malloc, so that reinitializing can release the previous tables.
+ */
+static void *PermutationTablesMap = NULL;
+static size_t PermutationTablesMapSize = 0;
 
-    InitN5Tables();
-    InitN6Tables();
-    InitN7Tables();
+static void FreePermutationTables(void) {
+    if (PermutationTablesMap != NULL)
+        munmap(PermutationTablesMap, PermutationTablesMapSize);
+    else
+        free(PermutationTables);
+    PermutationTables = NULL;
+    PermutationTablesMap = NULL;
+    PermutationTablesMapSize = 0;
+}
+
+static void *AllocTables(size_t size) {
+    AppliedTablePlacement = 0;
+#ifdef __linux__
+    if (TablePlacement == 0)
+        return MyMalloc(size);
+
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    unsigned char *base = MAP_FAILED;
+    if (TablePlacement & MBEVAL_PAGES_HUGETLB) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED)
+            AppliedTablePlacement |= MBEVAL_PAGES_HUGETLB;
+    }
+    if (base == MAP_FAILED) {
+        // over-allocate to align the arena to a huge page, then trim
+        unsigned char *map =
+            mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            return MyMalloc(size);
+        base = (unsigned char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) &
+                                 ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        size_t head = base - map;
+        if (head > 0)
+            munmap(map, head);
+        munmap(base + size, HUGE_PAGE_SIZE - head);
+        if ((TablePlacement & (MBEVAL_PAGES_HUGE | MBEVAL_PAGES_HUGETLB)) &&
+            madvise(base, size, MADV_HUGEPAGE) == 0)
+            AppliedTablePlacement |= MBEVAL_PAGES_HUGE;
+    }
+    if (TablePlacement & MBEVAL_PAGES_INTERLEAVE) {
+        // the kernel restricts the mask to the nodes with memory
+        unsigned long nodes = ~0UL;
+        if (syscall(SYS_mbind, base, size, MPOL_INTERLEAVE, &nodes,
+                    sizeof(nodes) * 8, 0) == 0)
+            AppliedTablePlacement |= MBEVAL_PAGES_INTERLEAVE;
+    }
+    PermutationTablesMap = base;
+    PermutationTablesMapSize = size;
+    return base;
+#else
+    return MyMalloc(size);
+#endif
+}
 
-    k4_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * NSQUARES *
-                             sizeof(int));
-    InitN4Tables(k4_tab);
+void mbeval_set_table_placement(int placement) { TablePlacement = placement; }
 
-    k3_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * sizeof(int));
-    InitN3Tables(k3_tab);
+int mbeval_table_placement(void) { return AppliedTablePlacement; }
 
-    k3_even_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * sizeof(int));
-    InitN3EvenTables(k3_even_tab);
+static void InitPermutationTables(void) {
+    FreePermutationTables();
+    size_t size = PermutationTablesLayout(NULL);
+    unsigned char *base = (unsigned char *)AllocTables(size);
+    memset(base, 0, size);
+    PermutationTablesLayout(base);
+    PermutationTables = base;
 
-    k3_odd_tab = (int *)MyMalloc(NSQUARES * NSQUARES * NSQUARES * sizeof(int));
-    InitN3OddTables(k3_odd_tab);
+    InitN2OpposingTables(k2_opposing_tab);
+    InitN2_1_OpposingTables(k2_1_opposing_tab);
+    InitN1_2_OpposingTables(k1_2_opposing_tab);
+    InitN2_2_OpposingTables(k2_2_opposing_rows);
+    InitN3_1_OpposingTables(k3_1_opposing_rows);
+    InitN1_3_OpposingTables(k1_3_opposing_rows);
+    InitN4OpposingTables(k4_opposing_tab);
 
-    k2_tab = (int *)MyMalloc(NSQUARES * NSQUARES * sizeof(int));
+#ifdef RANK_TABLES
+    InitN4Tables(k4_rows);
+    InitN3Tables(k3_tab);
+    InitN3EvenTables(k3_even_tab);
+    InitN3OddTables(k3_odd_tab);
     InitN2Tables(k2_tab);
-
-    k2_even_tab = (int *)MyMalloc(NSQUARES * NSQUARES * sizeof(int));
     InitN2EvenTables(k2_even_tab);
-
-    k2_odd_tab = (int *)MyMalloc(NSQUARES * NSQUARES * sizeof(int));
     InitN2OddTables(k2_odd_tab);
+#endif
+}
+
+/*
+ * Snapshot file: a header padded to SNAPSHOT_DATA_OFFSET bytes, followed by
+ * the permutation table arena. Bump SNAPSHOT_VERSION whenever the contents or
+ * layout of the tables change, so that stale snapshots are rejected.
+ */
+
+#define SNAPSHOT_MAGIC "MBEVSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_DATA_OFFSET 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nsquares;
+    uint64_t size;
+} SnapshotHeader;
+
+_Static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_DATA_OFFSET,
+               "snapshot header too large");
+
+static bool MapPermutationTables(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    size_t size = PermutationTablesLayout(NULL);
+    SnapshotHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (uint64_t)st.st_size != SNAPSHOT_DATA_OFFSET + size ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.nsquares != NSQUARES ||
+        header.size != size) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, SNAPSHOT_DATA_OFFSET + size, PROT_READ, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    FreePermutationTables();
+    PermutationTablesMap = map;
+    PermutationTablesMapSize = SNAPSHOT_DATA_OFFSET + size;
+    PermutationTables = (unsigned char *)map + SNAPSHOT_DATA_OFFSET;
+    PermutationTablesLayout(PermutationTables);
+    AppliedTablePlacement = 0;
+    return true;
 }
 
 static ZIndex Index1(const int *pos) { return pos[2]; }
@@ -2007,7 +2307,7 @@ static ZIndex Index21(const int *pos) {
     return pos[4] + NSQUARES * N2_Index(pos[3], pos[2]);
 }
 
-static ZIndex IndexOP21(const int *pos) {
+RANKER ZIndex IndexOP21(const int *pos) {
     int index = N2_1_Opposing_Index(pos[4], pos[3], pos[2]);
 
     if (index == -1)
@@ -2020,7 +2320,7 @@ static ZIndex Index12(const int *pos) {
     return pos[2] + NSQUARES * N2_Index(pos[4], pos[3]);
 }
 
-static ZIndex IndexOP12(const int *pos) {
+RANKER ZIndex IndexOP12(const int *pos) {
     int index = N1_2_Opposing_Index(pos[4], pos[3], pos[2]);
 
     if (index == -1)
@@ -2131,7 +2431,7 @@ static ZIndex Index22(const int *pos) {
     return N2_Index(pos[5], pos[4]) + N2_Offset * N2_Index(pos[3], pos[2]);
 }
 
-static ZIndex IndexOP22(const int *pos) {
+RANKER ZIndex IndexOP22(const int *pos) {
     int index = N2_2_Opposing_Index(pos[5], pos[4], pos[3], pos[2]);
 
     if (index == -1)
@@ -2140,7 +2440,7 @@ static ZIndex IndexOP22(const int *pos) {
     return (ZIndex)index;
 }
 
-static ZIndex IndexDP22(const int *pos) {
+RANKER ZIndex IndexDP22(const int *pos) {
     int index = -1;
     int w1_col = Column(pos[2]);
     int w2_col = Column(pos[3]);
@@ -2212,7 +2512,7 @@ static ZIndex Index31(const int *pos) {
     return pos[5] + NSQUARES * N3_Index(pos[4], pos[3], pos[2]);
 }
 
-static ZIndex IndexOP31(const int *pos) {
+RANKER ZIndex IndexOP31(const int *pos) {
     int index = N3_1_Opposing_Index(pos[5], pos[4], pos[3], pos[2]);
 
     if (index == -1)
@@ -2225,7 +2525,7 @@ static ZIndex Index13(const int *pos) {
     return pos[2] + NSQUARES * N3_Index(pos[5], pos[4], pos[3]);
 }
 
-static ZIndex IndexOP13(const int *pos) {
+RANKER ZIndex IndexOP13(const int *pos) {
     int index = N1_3_Opposing_Index(pos[5], pos[4], pos[3], pos[2]);
 
     if (index == -1)
@@ -2295,7 +2595,7 @@ static ZIndex Index14(const int *pos) {
     return pos[2] + NSQUARES * N4_Index(pos[6], pos[5], pos[4], pos[3]);
 }
 
-static ZIndex Index5(const int *pos) {
+RANKER ZIndex Index5(const int *pos) {
     return (N5 - 1) - N5_Index((NSQUARES - 1) - pos[2], (NSQUARES - 1) - pos[3],
                                (NSQUARES - 1) - pos[4], (NSQUARES - 1) - pos[5],
                                (NSQUARES - 1) - pos[6]);
@@ -2309,7 +2609,7 @@ static ZIndex Index15(const int *pos) {
     return pos[2] + NSQUARES * Index5(pos + 1);
 }
 
-static ZIndex Index6(const int *pos) {
+RANKER ZIndex Index6(const int *pos) {
     return (N6 - 1) - N6_Index((NSQUARES - 1) - pos[2], (NSQUARES - 1) - pos[3],
                                (NSQUARES - 1) - pos[4], (NSQUARES - 1) - pos[5],
                                (NSQUARES - 1) - pos[6],
@@ -3686,6 +3986,78 @@ static const IndexType IndexTable[] = {{111111, Free, 0, Index111111},
 
 #define NumIndexTypes (sizeof(IndexTable) / sizeof(IndexTable[0]))
 
+/*
+ * Open addressing hash table mapping (etype, op_type, sub_type) to the first
+ * matching entry of IndexTable, so that GetEndingType does not have to scan
+ * the whole table. Slots hold eindex + 1, or 0 if empty. Define
+ * MBEVAL_SCAN_ENDING_TYPES to scan the table instead, so that the two can be
+ * benchmarked against each other; the scan-ending-types feature of the crate
+ * defines it.
+ */
+
+#ifndef MBEVAL_SCAN_ENDING_TYPES
+
+#define ENDING_TYPE_HASH_BITS 10
+#define ENDING_TYPE_HASH_SIZE (1 << ENDING_TYPE_HASH_BITS)
+
+static int16_t EndingTypeHash[ENDING_TYPE_HASH_SIZE];
+
+static unsigned int EndingTypeSlot(int etype, int op_type, int sub_type) {
+    uint64_t key = ((uint64_t)etype << 32) | ((uint32_t)sub_type << 5) |
+                   (uint32_t)op_type;
+    return (key * 0x9e3779b97f4a7c15ull) >> (64 - ENDING_TYPE_HASH_BITS);
+}
+
+static void InitEndingTypeHash(void) {
+    assert(2 * NumIndexTypes <= ENDING_TYPE_HASH_SIZE);
+
+    memset(EndingTypeHash, 0, sizeof(EndingTypeHash));
+
+    for (size_t i = 0; i < NumIndexTypes; i++) {
+        const IndexType *eptr = &IndexTable[i];
+        unsigned int slot =
+            EndingTypeSlot(eptr->etype, eptr->op_type, eptr->sub_type);
+        while (EndingTypeHash[slot] != 0) {
+            const IndexType *other = &IndexTable[EndingTypeHash[slot] - 1];
+            if (other->etype == eptr->etype &&
+                other->op_type == eptr->op_type &&
+                other->sub_type == eptr->sub_type)
+                break; // keep the first entry, like a linear scan
+            slot = (slot + 1) & (ENDING_TYPE_HASH_SIZE - 1);
+        }
+        if (EndingTypeHash[slot] == 0)
+            EndingTypeHash[slot] = i + 1;
+    }
+}
+
+static int FindEndingType(int etype, int op_type, int sub_type) {
+    unsigned int slot = EndingTypeSlot(etype, op_type, sub_type);
+    while (EndingTypeHash[slot] != 0) {
+        int eindex = EndingTypeHash[slot] - 1;
+        if (IndexTable[eindex].etype == etype &&
+            IndexTable[eindex].op_type == op_type &&
+            IndexTable[eindex].sub_type == sub_type)
+            return eindex;
+        slot = (slot + 1) & (ENDING_TYPE_HASH_SIZE - 1);
+    }
+    return -1;
+}
+
+#else
+
+static void InitEndingTypeHash(void) {}
+
+static int FindEndingType(int etype, int op_type, int sub_type) {
+    for (size_t i = 0; i < NumIndexTypes; i++) {
+        if (IndexTable[i].etype == etype && IndexTable[i].op_type == op_type &&
+            IndexTable[i].sub_type == sub_type)
+            return i;
+    }
+    return -1;
+}
+
+#endif
+
 static int SetBoard(BOARD *Board, const Piece board[NSQUARES], Side side,
                     int ep_square) {
     memcpy(Board->board, board, sizeof(Board->board));
@@ -3721,6 +4093,43 @@ static int SetBoard(BOARD *Board, const Piece board[NSQUARES], Side side,
     return Board->num_pieces;
 }
 
+// Like SetBoard, but from per-colour, per-role occupancy masks. Only the
+// entries of piece_locations that are in use are written, and the square array
+// is left uninitialized, since it is not needed past this point.
+
+static int SetBoardFromBitboards(BOARD *Board, const uint64_t bitboards[2][6],
+                                 Side side, int ep_square) {
+    static const Piece roles[6] = {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING};
+
+    Board->side = side;
+    Board->ep_square = ep_square;
+    Board->num_pieces = 0;
+    memset(Board->piece_type_count, 0, sizeof(Board->piece_type_count));
+
+    for (int color = White; color <= Black; color++) {
+        assert(__builtin_popcountll(bitboards[color][5]) == 1);
+        int kpos = __builtin_ctzll(bitboards[color][5]);
+        if (color == White)
+            Board->wkpos = kpos;
+        else
+            Board->bkpos = kpos;
+        Board->num_pieces++;
+
+        for (int r = 0; r < 5; r++) {
+            int *pos = Board->piece_locations[color][roles[r]];
+            int n = 0;
+            for (uint64_t bb = bitboards[color][r]; bb != 0; bb &= bb - 1) {
+                assert(n < MAX_IDENT_PIECES);
+                pos[n++] = __builtin_ctzll(bb);
+            }
+            Board->piece_type_count[color][roles[r]] = n;
+            Board->num_pieces += n;
+        }
+    }
+
+    return Board->num_pieces;
+}
+
 static int GetEndingType(const int count[2][KING], Piece *piece_types,
                          BishopParity bishop_parity[2],
                          PawnFileType pawn_file_type) {
@@ -3873,8 +4282,6 @@ static int GetEndingType(const int count[2][KING], Piece *piece_types,
             }
         }
 
-        eindex = -1;
-
         int pawn_file_type_effective = pawn_file_type;
         if (pawn_file_type == Op41 || pawn_file_type == Op14 ||
             pawn_file_type == Op32 || pawn_file_type == Op23 ||
@@ -3882,13 +4289,9 @@ static int GetEndingType(const int count[2][KING], Piece *piece_types,
             pawn_file_type == Op24)
             pawn_file_type_effective = Free;
 
-        for (size_t i = 0; i < NumIndexTypes; i++) {
-            if (IndexTable[i].etype == etype &&
-                IndexTable[i].op_type == pawn_file_type_effective) {
-                eindex = i;
-                break;
-            }
-        }
+        // pawn file variants have no sub types
+
+        eindex = FindEndingType(etype, pawn_file_type_effective, 0);
     } else {
         npieces = 2;
 
@@ -4002,16 +4405,7 @@ static int GetEndingType(const int count[2][KING], Piece *piece_types,
 
         sub_type = 100 * sub_type + sub_type_black;
 
-        eindex = -1;
-
-        for (size_t i = 0; i < NumIndexTypes; i++) {
-            if (IndexTable[i].etype == etype &&
-                IndexTable[i].sub_type == sub_type &&
-                IndexTable[i].op_type == Free) {
-                eindex = i;
-                break;
-            }
-        }
+        eindex = FindEndingType(etype, Free, sub_type);
     }
 
     if (piece_types != NULL) {
@@ -4358,82 +4752,127 @@ static void InitParity(void) {
         else
             BlackSquare[sq / 2] = sq;
     }
+
+    for (sq = 0; sq < NSQUARES; sq++) {
+        for (int p = 0; p < 2; p++)
+            ParityCount[p][sq + 1] =
+                ParityCount[p][sq] + (ParityTable[sq] == p);
+    }
+
+    int n2_even = 0, n2_odd = 0, n3_even = 0, n3_odd = 0;
+    int n3_odd_pairs[2] = {0, 0};
+    for (sq = 0; sq < NSQUARES; sq++) {
+        int p = ParityTable[sq];
+        int above = NSQUARES - 1 - sq;
+        int same = ParityCount[p][NSQUARES] - ParityCount[p][sq + 1];
+        N2EvenBase[sq] = n2_even;
+        N2OddBase[sq] = n2_odd;
+        N3EvenBase[sq] = n3_even;
+        N3OddBase[sq] = n3_odd;
+        n2_even += same;
+        n2_odd += above - same;
+        n3_even += C2(same);
+        n3_odd += C2(above) - C2(same);
+
+        for (int q = 0; q < 2; q++) {
+            N3OddPairs[q][sq] = n3_odd_pairs[q];
+            n3_odd_pairs[q] += p == q ? above - same : above;
+        }
+    }
+    for (int q = 0; q < 2; q++)
+        N3OddPairs[q][NSQUARES] = n3_odd_pairs[q];
+
+    assert(n2_even == N2_EVEN_PARITY && n2_odd == N2_ODD_PARITY);
+    assert(n3_even == N3_EVEN_PARITY && n3_odd == N3_ODD_PARITY);
 }
 
-static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
-                         PawnFileType *pawn_file_type) {
-    int loc = 0, color, type, i;
-    int bishops_on_white_squares[2] = {0, 0};
-    int bishops_on_black_squares[2] = {0, 0};
+/*
+ * The opposing pawn tables of up to four pawns accept exactly those pawn
+ * structures where some white pawn has a black pawn ahead of it on its file,
+ * and where the pawn that may be captured en passant, if any, has an empty
+ * square behind it and on its origin square and an enemy pawn beside it. So
+ * rather than probing the tables, the structure is classified from bitboards
+ * of the physical pawn squares, and the tables are only touched when an index
+ * is actually needed.
+ */
 
-    mb_position[loc++] = Board->wkpos;
-    mb_position[loc++] = Board->bkpos;
+static bool HasOpposingPawns(const int *mb_position, int num_white,
+                             int num_black) {
+    uint64_t white = 0, black = 0, ep_pawn = 0;
 
-    for (color = White; color <= Black; color++) {
-        const int *pos = Board->piece_locations[color][PAWN];
-        for (int i = 0; i < Board->piece_type_count[color][PAWN]; i++) {
-            mb_position[loc] = pos[i];
-            if (Board->ep_square > 0) {
-                if (color == White &&
-                    SquareMake(Row(pos[i]) - 1, Column(pos[i])) ==
-                        Board->ep_square)
-                    mb_position[loc] = SquareMake(0, Column(pos[i]));
-                if (color == Black &&
-                    SquareMake(Row(pos[i]) + 1, Column(pos[i])) ==
-                        Board->ep_square)
-                    mb_position[loc] = SquareMake(NROWS - 1, Column(pos[i]));
-            }
-            loc++;
+    for (int i = 2; i < 2 + num_white; i++) {
+        int sq = mb_position[i];
+        if (Row(sq) == 0) {
+            sq += 3 * NCOLS;
+            ep_pawn = ONE << sq;
+        }
+        white |= ONE << sq;
+    }
+    for (int i = 2 + num_white; i < 2 + num_white + num_black; i++) {
+        int sq = mb_position[i];
+        if (Row(sq) == NROWS - 1) {
+            if (ep_pawn)
+                return false;
+            sq -= 3 * NCOLS;
+            ep_pawn = ONE << sq;
         }
+        black |= ONE << sq;
+    }
+
+    uint64_t pawns = white | black;
+    if (__builtin_popcountll(pawns) != num_white + num_black)
+        return false;
+
+    if (ep_pawn) {
+        bool white_ep = (white & ep_pawn) != 0;
+        uint64_t behind = white_ep ? ep_pawn >> NCOLS | ep_pawn >> 2 * NCOLS
+                                   : ep_pawn << NCOLS | ep_pawn << 2 * NCOLS;
+        uint64_t beside = 0;
+        int ep_col = Column(__builtin_ctzll(ep_pawn));
+        if (ep_col > 0)
+            beside |= ep_pawn >> 1;
+        if (ep_col < NCOLS - 1)
+            beside |= ep_pawn << 1;
+        if ((pawns & behind) || !(beside & (white_ep ? black : white)))
+            return false;
     }
 
-    *pawn_file_type = Free;
+    uint64_t ahead = white << NCOLS;
+    for (int shift = NCOLS; shift < NSQUARES; shift *= 2)
+        ahead |= ahead << shift;
+    return (ahead & black) != 0;
+}
+
+static PawnFileType GetPawnFileType(const int *mb_position,
+                                    const int count[2][KING]) {
+    PawnFileType pawn_file_type = Free;
 
-    if (Board->piece_type_count[White][PAWN] == 1 &&
-        Board->piece_type_count[Black][PAWN] == 1) {
+    if (count[White][PAWN] == 1 && count[Black][PAWN] == 1) {
         if (Column(mb_position[2]) == Column(mb_position[3])) {
             if (mb_position[3] == mb_position[2] + NCOLS)
-                *pawn_file_type = Bp11;
+                pawn_file_type = Bp11;
             else if (mb_position[3] > mb_position[2])
-                *pawn_file_type = Op11;
-        }
-    } else if (Board->piece_type_count[White][PAWN] == 2 &&
-               Board->piece_type_count[Black][PAWN] == 1) {
-        int op21 =
-            N2_1_Opposing_Index(mb_position[4], mb_position[3], mb_position[2]);
-        if (op21 != -1)
-            *pawn_file_type = Op21;
-    } else if (Board->piece_type_count[White][PAWN] == 1 &&
-               Board->piece_type_count[Black][PAWN] == 2) {
-        int op12 =
-            N1_2_Opposing_Index(mb_position[4], mb_position[3], mb_position[2]);
-        if (op12 != -1)
-            *pawn_file_type = Op12;
-    } else if (Board->piece_type_count[White][PAWN] == 2 &&
-               Board->piece_type_count[Black][PAWN] == 2) {
-        ZIndex dp22 = IndexDP22(mb_position);
-        if (dp22 != ALL_ONES)
-            *pawn_file_type = Dp22;
-        else {
-            int op22 = N2_2_Opposing_Index(mb_position[5], mb_position[4],
-                                           mb_position[3], mb_position[2]);
-            if (op22 != -1)
-                *pawn_file_type = Op22;
+                pawn_file_type = Op11;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 3 &&
-               Board->piece_type_count[Black][PAWN] == 1) {
-        int op31 = N3_1_Opposing_Index(mb_position[5], mb_position[4],
-                                       mb_position[3], mb_position[2]);
-        if (op31 != -1)
-            *pawn_file_type = Op31;
-    } else if (Board->piece_type_count[White][PAWN] == 1 &&
-               Board->piece_type_count[Black][PAWN] == 3) {
-        int op13 = N1_3_Opposing_Index(mb_position[5], mb_position[4],
-                                       mb_position[3], mb_position[2]);
-        if (op13 != -1)
-            *pawn_file_type = Op13;
-    } else if (Board->piece_type_count[White][PAWN] == 4 &&
-               Board->piece_type_count[Black][PAWN] == 1) {
+    } else if (count[White][PAWN] == 2 && count[Black][PAWN] == 1) {
+        if (HasOpposingPawns(mb_position, 2, 1))
+            pawn_file_type = Op21;
+    } else if (count[White][PAWN] == 1 && count[Black][PAWN] == 2) {
+        if (HasOpposingPawns(mb_position, 1, 2))
+            pawn_file_type = Op12;
+    } else if (count[White][PAWN] == 2 && count[Black][PAWN] == 2) {
+        if (IsValidDP22(mb_position[2], mb_position[3], mb_position[4],
+                        mb_position[5]) != NO_DP22)
+            pawn_file_type = Dp22;
+        else if (HasOpposingPawns(mb_position, 2, 2))
+            pawn_file_type = Op22;
+    } else if (count[White][PAWN] == 3 && count[Black][PAWN] == 1) {
+        if (HasOpposingPawns(mb_position, 3, 1))
+            pawn_file_type = Op31;
+    } else if (count[White][PAWN] == 1 && count[Black][PAWN] == 3) {
+        if (HasOpposingPawns(mb_position, 1, 3))
+            pawn_file_type = Op13;
+    } else if (count[White][PAWN] == 4 && count[Black][PAWN] == 1) {
         if ((Column(mb_position[6]) == Column(mb_position[2]) &&
              mb_position[2] < mb_position[6]) ||
             (Column(mb_position[6]) == Column(mb_position[3]) &&
@@ -4442,10 +4881,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[4] < mb_position[6]) ||
             (Column(mb_position[6]) == Column(mb_position[5]) &&
              mb_position[5] < mb_position[6])) {
-            *pawn_file_type = Op41;
+            pawn_file_type = Op41;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 1 &&
-               Board->piece_type_count[Black][PAWN] == 4) {
+    } else if (count[White][PAWN] == 1 && count[Black][PAWN] == 4) {
         if ((Column(mb_position[2]) == Column(mb_position[3]) &&
              mb_position[2] < mb_position[3]) ||
             (Column(mb_position[2]) == Column(mb_position[4]) &&
@@ -4454,10 +4892,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[2] < mb_position[5]) ||
             (Column(mb_position[2]) == Column(mb_position[6]) &&
              mb_position[2] < mb_position[6])) {
-            *pawn_file_type = Op14;
+            pawn_file_type = Op14;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 3 &&
-               Board->piece_type_count[Black][PAWN] == 2) {
+    } else if (count[White][PAWN] == 3 && count[Black][PAWN] == 2) {
         if ((Column(mb_position[5]) == Column(mb_position[2]) &&
              mb_position[2] < mb_position[5]) ||
             (Column(mb_position[5]) == Column(mb_position[3]) &&
@@ -4470,10 +4907,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[3] < mb_position[6]) ||
             (Column(mb_position[6]) == Column(mb_position[4]) &&
              mb_position[4] < mb_position[6])) {
-            *pawn_file_type = Op32;
+            pawn_file_type = Op32;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 2 &&
-               Board->piece_type_count[Black][PAWN] == 3) {
+    } else if (count[White][PAWN] == 2 && count[Black][PAWN] == 3) {
         if ((Column(mb_position[2]) == Column(mb_position[4]) &&
              mb_position[2] < mb_position[4]) ||
             (Column(mb_position[2]) == Column(mb_position[5]) &&
@@ -4486,10 +4922,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[3] < mb_position[5]) ||
             (Column(mb_position[3]) == Column(mb_position[6]) &&
              mb_position[3] < mb_position[6])) {
-            *pawn_file_type = Op23;
+            pawn_file_type = Op23;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 3 &&
-               Board->piece_type_count[Black][PAWN] == 3) {
+    } else if (count[White][PAWN] == 3 && count[Black][PAWN] == 3) {
         if ((Column(mb_position[5]) == Column(mb_position[2]) &&
              mb_position[2] < mb_position[5]) ||
             (Column(mb_position[5]) == Column(mb_position[3]) &&
@@ -4508,10 +4943,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[3] < mb_position[7]) ||
             (Column(mb_position[7]) == Column(mb_position[4]) &&
              mb_position[4] < mb_position[7])) {
-            *pawn_file_type = Op33;
+            pawn_file_type = Op33;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 4 &&
-               Board->piece_type_count[Black][PAWN] == 2) {
+    } else if (count[White][PAWN] == 4 && count[Black][PAWN] == 2) {
         if ((Column(mb_position[6]) == Column(mb_position[2]) &&
              mb_position[2] < mb_position[6]) ||
             (Column(mb_position[6]) == Column(mb_position[3]) &&
@@ -4528,10 +4962,9 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[4] < mb_position[7]) ||
             (Column(mb_position[7]) == Column(mb_position[5]) &&
              mb_position[5] < mb_position[7])) {
-            *pawn_file_type = Op42;
+            pawn_file_type = Op42;
         }
-    } else if (Board->piece_type_count[White][PAWN] == 2 &&
-               Board->piece_type_count[Black][PAWN] == 4) {
+    } else if (count[White][PAWN] == 2 && count[Black][PAWN] == 4) {
         if ((Column(mb_position[4]) == Column(mb_position[2]) &&
              mb_position[2] < mb_position[4]) ||
             (Column(mb_position[4]) == Column(mb_position[3]) &&
@@ -4548,30 +4981,67 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
              mb_position[2] < mb_position[7]) ||
             (Column(mb_position[7]) == Column(mb_position[3]) &&
              mb_position[3] < mb_position[7])) {
-            *pawn_file_type = Op24;
-        }
-    }
-    for (color = White; color <= Black; color++) {
-        for (type = KING - 1; type >= KNIGHT; type--) {
-            const int *pos = Board->piece_locations[color][type];
-            for (i = 0; i < Board->piece_type_count[color][type]; i++) {
-                mb_position[loc] = pos[i];
-                if (type == BISHOP) {
-                    if (IsWhiteSquare[pos[i]]) {
-                        bishops_on_white_squares[color]++;
-                    }
-                }
-                loc++;
-            }
+            pawn_file_type = Op24;
         }
-        bishops_on_black_squares[color] =
-            Board->piece_type_count[color][BISHOP] -
-            bishops_on_white_squares[color];
     }
 
-    // for Board with even number of squares can switch "white" and "black"
-#if ((NROWS % 2) == 0) || ((NCOLS % 2) == 0)
-    if ((bishops_on_black_squares[White] > bishops_on_white_squares[White]) ||
+    return pawn_file_type;
+}
+
+static int GetMBPosition(const BOARD *Board, int *mb_position, int *squares,
+                         int *parity, PawnFileType *pawn_file_type) {
+    int loc = 0, color, type, i;
+    int bishops_on_white_squares[2] = {0, 0};
+    int bishops_on_black_squares[2] = {0, 0};
+
+    squares[loc] = Board->wkpos;
+    mb_position[loc++] = Board->wkpos;
+    squares[loc] = Board->bkpos;
+    mb_position[loc++] = Board->bkpos;
+
+    for (color = White; color <= Black; color++) {
+        const int *pos = Board->piece_locations[color][PAWN];
+        for (int i = 0; i < Board->piece_type_count[color][PAWN]; i++) {
+            squares[loc] = pos[i];
+            mb_position[loc] = pos[i];
+            if (Board->ep_square > 0) {
+                if (color == White &&
+                    SquareMake(Row(pos[i]) - 1, Column(pos[i])) ==
+                        Board->ep_square)
+                    mb_position[loc] = SquareMake(0, Column(pos[i]));
+                if (color == Black &&
+                    SquareMake(Row(pos[i]) + 1, Column(pos[i])) ==
+                        Board->ep_square)
+                    mb_position[loc] = SquareMake(NROWS - 1, Column(pos[i]));
+            }
+            loc++;
+        }
+    }
+
+    *pawn_file_type = GetPawnFileType(mb_position, Board->piece_type_count);
+
+    for (color = White; color <= Black; color++) {
+        for (type = KING - 1; type >= KNIGHT; type--) {
+            const int *pos = Board->piece_locations[color][type];
+            for (i = 0; i < Board->piece_type_count[color][type]; i++) {
+                squares[loc] = pos[i];
+                mb_position[loc] = pos[i];
+                if (type == BISHOP) {
+                    if (IsWhiteSquare[pos[i]]) {
+                        bishops_on_white_squares[color]++;
+                    }
+                }
+                loc++;
+            }
+        }
+        bishops_on_black_squares[color] =
+            Board->piece_type_count[color][BISHOP] -
+            bishops_on_white_squares[color];
+    }
+
+    // for Board with even number of squares can switch "white" and "black"
+#if ((NROWS % 2) == 0) || ((NCOLS % 2) == 0)
+    if ((bishops_on_black_squares[White] > bishops_on_white_squares[White]) ||
         ((bishops_on_black_squares[White] == bishops_on_white_squares[White]) &&
          (bishops_on_black_squares[Black] > bishops_on_white_squares[Black]))) {
         SWAP(bishops_on_white_squares[White], bishops_on_black_squares[White]);
@@ -4588,303 +5058,323 @@ static int GetMBPosition(const BOARD *Board, int *mb_position, int *parity,
     return loc;
 }
 
-static ZIndex GetMBIndex(int *mb_pos, int npieces, bool pawns_present,
-                         const IndexType *eptr, int *kindex, ZIndex *offset) {
-    if (eptr == NULL) {
-        *kindex = -1;
-        *offset = ALL_ONES;
-        return ALL_ONES;
-    }
+/*
+ * The placement of a position under its canonical symmetry, shared by the
+ * index computations of all ending types that apply to it. If the kings sit on
+ * a symmetry axis, the reflected placement is equally canonical, and the index
+ * is the smaller of the two.
+ */
 
-    int wk = mb_pos[0];
-    int bk = mb_pos[1];
+// MAX_PIECES_MB, padded to a multiple of 8 for vector stores
+#define CANONICAL_SQUARES ((MAX_PIECES_MB + 7) / 8 * 8)
 
-    int sym = IDENTITY;
+typedef struct {
+    int pos[CANONICAL_SQUARES];
+    int flipped_pos[CANONICAL_SQUARES];
+    bool flipped;
+    int kk_index;
+} CanonicalPosition;
 
-    if (pawns_present)
-        sym = KK_Transform(wk, bk);
-    else
-        sym = KK_Transform_NoPawns(wk, bk);
+/*
+ * TransformSquares applies symmetry sym to npieces squares, storing the result
+ * in pos, and if flip >= 0, also applies the reflection flip on top of it,
+ * storing the result in flipped_pos. Both outputs must have room for
+ * CANONICAL_SQUARES entries.
+ *
+ * On x86, InitTransformSquares selects a version that gathers eight squares at
+ * a time if the CPU supports AVX2.
+ */
 
-    int *transform = Transforms[sym];
+typedef void TransformSquaresFunc(const int *squares, int npieces, int sym,
+                                  int flip, int *pos, int *flipped_pos);
 
+static void TransformSquaresScalar(const int *squares, int npieces, int sym,
+                                   int flip, int *pos, int *flipped_pos) {
+    const int *transform = Transforms[sym];
     for (int i = 0; i < npieces; i++) {
-        mb_pos[i] = transform[mb_pos[i]];
+        pos[i] = transform[squares[i]];
     }
 
-    wk = mb_pos[0];
-    bk = mb_pos[1];
-
-    *offset = (eptr->index_from_pos)(mb_pos);
-
-    bool flipped = false;
-
-    if (pawns_present)
-        GetFlipFunction(wk, bk, &flipped, &transform);
-    else
-        GetFlipFunctionNoPawns(wk, bk, &flipped, &transform);
-
-    if (flipped) {
-        int tmp_pos[MAX_PIECES];
+    if (flip >= 0) {
+        transform = Transforms[flip];
         for (int i = 0; i < npieces; i++) {
-            tmp_pos[i] = transform[mb_pos[i]];
+            flipped_pos[i] = transform[pos[i]];
         }
-        ZIndex offset_t = (eptr->index_from_pos)(tmp_pos);
-        if (offset_t < *offset) {
-            *offset = offset_t;
-            memcpy(mb_pos, tmp_pos, npieces * sizeof(tmp_pos[0]));
+    }
+}
+
+#ifdef SIMD_TRANSFORMS
+__attribute__((target("avx2"))) static void
+TransformSquaresAVX2(const int *squares, int npieces, int sym, int flip,
+                     int *pos, int *flipped_pos) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int i = 0; i < npieces; i += 8) {
+        // lanes beyond npieces load square 0, which is safe to look up
+        __m256i mask =
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(npieces - i), lanes);
+        __m256i sq = _mm256_maskload_epi32(&squares[i], mask);
+        __m256i trans = _mm256_i32gather_epi32(Transforms[sym], sq, 4);
+        _mm256_storeu_si256((__m256i *)&pos[i], trans);
+
+        if (flip >= 0) {
+            __m256i flipped =
+                _mm256_i32gather_epi32(Transforms[flip], trans, 4);
+            _mm256_storeu_si256((__m256i *)&flipped_pos[i], flipped);
         }
     }
+}
+#endif
 
-    if (pawns_present)
-        *kindex = KK_Index(wk, bk);
-    else
-        *kindex = KK_Index_NoPawns(wk, bk);
+static TransformSquaresFunc *TransformSquares = TransformSquaresScalar;
 
-    return 0;
+static void InitTransformSquares(void) {
+#ifdef SIMD_TRANSFORMS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        TransformSquares = TransformSquaresAVX2;
+#endif
 }
 
-static int GetMBInfo(const BOARD *Board, MbInfo *mb_info) {
-    mb_info->num_parities = 0;
-    mb_info->pawn_file_type = Free;
-
-    if (Board->num_pieces > MAX_PIECES_MB) {
-        return TOO_MANY_PIECES;
+static int SymmetryIndex(const int *transform) {
+    for (int sym = 0; sym < NSYMMETRIES; sym++) {
+        if (Transforms[sym] == transform)
+            return sym;
     }
+    assert(false);
+    return IDENTITY;
+}
 
-    memcpy(mb_info->piece_type_count, Board->piece_type_count,
-           sizeof(Board->piece_type_count));
+static void Canonicalize(const int *mb_pos, int npieces, bool pawns_present,
+                         CanonicalPosition *canonical) {
+    int wk = mb_pos[0];
+    int bk = mb_pos[1];
 
-    BishopParity bishop_parity[2] = {None, None};
+    int sym = IDENTITY;
 
-    mb_info->num_pieces = Board->num_pieces;
+    if (pawns_present)
+        sym = KK_Transform(wk, bk);
+    else
+        sym = KK_Transform_NoPawns(wk, bk);
 
-    GetMBPosition(Board, mb_info->mb_position, &mb_info->parity,
-                  &mb_info->pawn_file_type);
+    wk = Transforms[sym][wk];
+    bk = Transforms[sym][bk];
 
-    memset(mb_info->mb_piece_types, 0, sizeof(mb_info->mb_piece_types));
+    int *flip_transform = Identity;
 
-    int eindex = GetEndingType(Board->piece_type_count, mb_info->mb_piece_types,
-                               bishop_parity, Free);
+    if (pawns_present)
+        GetFlipFunction(wk, bk, &canonical->flipped, &flip_transform);
+    else
+        GetFlipFunctionNoPawns(wk, bk, &canonical->flipped, &flip_transform);
 
-    int kk_index_blocked = -1;
-    if (eindex >= 0) {
-        memcpy(mb_info->parity_index[0].bishop_parity, bishop_parity,
-               sizeof(bishop_parity));
-        mb_info->parity_index[0].eptr = &IndexTable[eindex];
-        mb_info->num_parities++;
-        // check whether we can also probe blocked/opposing pawn data
+    int flip = canonical->flipped ? SymmetryIndex(flip_transform) : -1;
+    TransformSquares(mb_pos, npieces, sym, flip, canonical->pos,
+                     canonical->flipped_pos);
 
-        if (mb_info->pawn_file_type == Op11 ||
-            mb_info->pawn_file_type == Bp11) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op11);
-            if (eindex >= 0) {
-                mb_info->eptr_op_11 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_11, &kk_index_blocked,
-                           &mb_info->index_op_11);
-            } else {
-                mb_info->eptr_op_11 = NULL;
-                mb_info->index_op_11 = ALL_ONES;
-            }
-        }
+    if (pawns_present)
+        canonical->kk_index = KK_Index(wk, bk);
+    else
+        canonical->kk_index = KK_Index_NoPawns(wk, bk);
+}
 
-        if (mb_info->pawn_file_type == Bp11) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Bp11);
-            if (eindex >= 0) {
-                mb_info->eptr_bp_11 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_bp_11, &kk_index_blocked,
-                           &mb_info->index_bp_11);
-            } else {
-                mb_info->eptr_bp_11 = NULL;
-                mb_info->index_bp_11 = ALL_ONES;
-            }
-        }
+static ZIndex GetMBIndex(const CanonicalPosition *canonical,
+                         const IndexType *eptr) {
+    assert(eptr != NULL);
 
-        if (mb_info->pawn_file_type == Op21) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op21);
-            if (eindex >= 0) {
-                mb_info->eptr_op_21 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_21, &kk_index_blocked,
-                           &mb_info->index_op_21);
-            } else {
-                mb_info->eptr_op_21 = NULL;
-                mb_info->index_op_21 = ALL_ONES;
-            }
-        }
+    ZIndex offset = (eptr->index_from_pos)(canonical->pos);
 
-        if (mb_info->pawn_file_type == Op12) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op12);
-            if (eindex >= 0) {
-                mb_info->eptr_op_12 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_12, &kk_index_blocked,
-                           &mb_info->index_op_12);
-            } else {
-                mb_info->eptr_op_12 = NULL;
-                mb_info->index_op_12 = ALL_ONES;
-            }
-        }
+    if (canonical->flipped) {
+        ZIndex offset_t = (eptr->index_from_pos)(canonical->flipped_pos);
+        if (offset_t < offset)
+            offset = offset_t;
+    }
 
-        if (mb_info->pawn_file_type == Op22 ||
-            mb_info->pawn_file_type == Dp22) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op22);
-            if (eindex >= 0) {
-                mb_info->eptr_op_22 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_22, &kk_index_blocked,
-                           &mb_info->index_op_22);
-            } else {
-                mb_info->eptr_op_22 = NULL;
-                mb_info->index_op_22 = ALL_ONES;
-            }
-        }
+    return offset;
+}
 
-        if (mb_info->pawn_file_type == Dp22) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Dp22);
-            if (eindex >= 0) {
-                mb_info->eptr_dp_22 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_dp_22, &kk_index_blocked,
-                           &mb_info->index_dp_22);
-            } else {
-                mb_info->eptr_dp_22 = NULL;
-                mb_info->index_dp_22 = ALL_ONES;
-            }
-        }
+/*
+ * Small direct-mapped memo of GetEndingType results. Positions in a batch
+ * mostly share their material, so the linear scans of IndexTable only need to
+ * be done once per material signature, bishop parity and pawn file type.
+ */
 
-        if (mb_info->pawn_file_type == Op31) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op31);
-            if (eindex >= 0) {
-                mb_info->eptr_op_31 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_31, &kk_index_blocked,
-                           &mb_info->index_op_31);
-            } else {
-                mb_info->eptr_op_31 = NULL;
-                mb_info->index_op_31 = ALL_ONES;
-            }
-        }
+#define ENDING_TYPE_MEMO_SIZE 64
 
-        if (mb_info->pawn_file_type == Op13) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op13);
-            if (eindex >= 0) {
-                mb_info->eptr_op_13 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_13, &kk_index_blocked,
-                           &mb_info->index_op_13);
-            } else {
-                mb_info->eptr_op_13 = NULL;
-                mb_info->index_op_13 = ALL_ONES;
-            }
-        }
+typedef struct {
+    uint64_t key; // 0 if empty
+    int eindex;
+    Piece piece_types[MAX_PIECES_MB];
+} EndingTypeMemoEntry;
 
-        if (mb_info->pawn_file_type == Op41) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op41);
-            if (eindex >= 0) {
-                mb_info->eptr_op_41 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_41, &kk_index_blocked,
-                           &mb_info->index_op_41);
-            } else {
-                mb_info->eptr_op_41 = NULL;
-                mb_info->index_op_41 = ALL_ONES;
-            }
+typedef struct {
+    EndingTypeMemoEntry entries[ENDING_TYPE_MEMO_SIZE];
+} EndingTypeMemo;
+
+static uint64_t EndingTypeKey(const int count[2][KING],
+                              const BishopParity bishop_parity[2],
+                              PawnFileType pawn_file_type) {
+    static const int pieces[] = {PAWN, KNIGHT, BISHOP, ROOK, QUEEN};
+    uint64_t key = 1;
+    for (int color = White; color <= Black; color++) {
+        for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+            assert(count[color][pieces[i]] < 16);
+            key = (key << 4) | count[color][pieces[i]];
         }
+        key = (key << 2) | bishop_parity[color];
+    }
+    return (key << 5) | pawn_file_type;
+}
+
+static int GetEndingTypeMemo(EndingTypeMemo *memo, const int count[2][KING],
+                             Piece *piece_types, BishopParity bishop_parity[2],
+                             PawnFileType pawn_file_type) {
+    if (memo == NULL)
+        return GetEndingType(count, piece_types, bishop_parity,
+                             pawn_file_type);
+
+    uint64_t key = EndingTypeKey(count, bishop_parity, pawn_file_type);
+    EndingTypeMemoEntry *entry =
+        &memo->entries[(key * 0x9E3779B97F4A7C15ULL) >> 58];
+    if (entry->key != key) {
+        entry->key = key;
+        memset(entry->piece_types, 0, sizeof(entry->piece_types));
+        entry->eindex = GetEndingType(count, entry->piece_types,
+                                      bishop_parity, pawn_file_type);
+    }
+    if (piece_types != NULL)
+        memcpy(piece_types, entry->piece_types, sizeof(entry->piece_types));
+    return entry->eindex;
+}
+
+// Table variants with blocked or opposing pawns that can be probed in addition
+// to the free one, in the order their indices are computed.
+
+static int GetPawnFileVariants(PawnFileType pawn_file_type,
+                               PawnFileType variants[2]) {
+    switch (pawn_file_type) {
+    case Free:
+        return 0;
+    case Bp11:
+        variants[0] = Op11;
+        variants[1] = Bp11;
+        return 2;
+    case Dp22:
+        variants[0] = Op22;
+        variants[1] = Dp22;
+        return 2;
+    default:
+        variants[0] = pawn_file_type;
+        return 1;
+    }
+}
 
-        if (mb_info->pawn_file_type == Op14) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op14);
-            if (eindex >= 0) {
-                mb_info->eptr_op_14 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_14, &kk_index_blocked,
-                           &mb_info->index_op_14);
-            } else {
-                mb_info->eptr_op_14 = NULL;
-                mb_info->index_op_14 = ALL_ONES;
-            }
-        }
+static const IndexType **PawnFileEptr(MbInfo *mb_info,
+                                      PawnFileType pawn_file_type) {
+    switch (pawn_file_type) {
+    case Bp11:
+        return &mb_info->eptr_bp_11;
+    case Op11:
+        return &mb_info->eptr_op_11;
+    case Op21:
+        return &mb_info->eptr_op_21;
+    case Op12:
+        return &mb_info->eptr_op_12;
+    case Op22:
+        return &mb_info->eptr_op_22;
+    case Dp22:
+        return &mb_info->eptr_dp_22;
+    case Op31:
+        return &mb_info->eptr_op_31;
+    case Op13:
+        return &mb_info->eptr_op_13;
+    case Op41:
+        return &mb_info->eptr_op_41;
+    case Op14:
+        return &mb_info->eptr_op_14;
+    case Op32:
+        return &mb_info->eptr_op_32;
+    case Op23:
+        return &mb_info->eptr_op_23;
+    case Op33:
+        return &mb_info->eptr_op_33;
+    case Op42:
+        return &mb_info->eptr_op_42;
+    case Op24:
+        return &mb_info->eptr_op_24;
+    default:
+        assert(false);
+        return NULL;
+    }
+}
 
-        if (mb_info->pawn_file_type == Op32) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op32);
-            if (eindex >= 0) {
-                mb_info->eptr_op_32 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_32, &kk_index_blocked,
-                           &mb_info->index_op_32);
-            } else {
-                mb_info->eptr_op_32 = NULL;
-                mb_info->index_op_32 = ALL_ONES;
-            }
-        }
+static ZIndex *PawnFileIndex(MbInfo *mb_info, PawnFileType pawn_file_type) {
+    switch (pawn_file_type) {
+    case Bp11:
+        return &mb_info->index_bp_11;
+    case Op11:
+        return &mb_info->index_op_11;
+    case Op21:
+        return &mb_info->index_op_21;
+    case Op12:
+        return &mb_info->index_op_12;
+    case Op22:
+        return &mb_info->index_op_22;
+    case Dp22:
+        return &mb_info->index_dp_22;
+    case Op31:
+        return &mb_info->index_op_31;
+    case Op13:
+        return &mb_info->index_op_13;
+    case Op41:
+        return &mb_info->index_op_41;
+    case Op14:
+        return &mb_info->index_op_14;
+    case Op32:
+        return &mb_info->index_op_32;
+    case Op23:
+        return &mb_info->index_op_23;
+    case Op33:
+        return &mb_info->index_op_33;
+    case Op42:
+        return &mb_info->index_op_42;
+    case Op24:
+        return &mb_info->index_op_24;
+    default:
+        assert(false);
+        return NULL;
+    }
+}
 
-        if (mb_info->pawn_file_type == Op23) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op23);
-            if (eindex >= 0) {
-                mb_info->eptr_op_23 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_23, &kk_index_blocked,
-                           &mb_info->index_op_23);
-            } else {
-                mb_info->eptr_op_23 = NULL;
-                mb_info->index_op_23 = ALL_ONES;
-            }
-        }
+// Selects the ending types that apply to the material, pawn file type and
+// bishop parities of mb_info, without computing any index.
 
-        if (mb_info->pawn_file_type == Op33) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op33);
-            if (eindex >= 0) {
-                mb_info->eptr_op_33 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_33, &kk_index_blocked,
-                           &mb_info->index_op_33);
-            } else {
-                mb_info->eptr_op_33 = NULL;
-                mb_info->index_op_33 = ALL_ONES;
-            }
-        }
+static int ResolveEndingTypes(MbInfo *mb_info, EndingTypeMemo *memo) {
+    const int(*count)[KING] = mb_info->piece_type_count;
+    BishopParity bishop_parity[2] = {None, None};
 
-        if (mb_info->pawn_file_type == Op42) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op42);
-            if (eindex >= 0) {
-                mb_info->eptr_op_42 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_42, &kk_index_blocked,
-                           &mb_info->index_op_42);
-            } else {
-                mb_info->eptr_op_42 = NULL;
-                mb_info->index_op_42 = ALL_ONES;
-            }
-        }
+    PawnFileType variants[2];
+    int num_variants = GetPawnFileVariants(mb_info->pawn_file_type, variants);
+    for (int i = 0; i < num_variants; i++) {
+        *PawnFileEptr(mb_info, variants[i]) = NULL;
+        *PawnFileIndex(mb_info, variants[i]) = ALL_ONES;
+    }
 
-        if (mb_info->pawn_file_type == Op24) {
-            eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity,
-                                   Op24);
-            if (eindex >= 0) {
-                mb_info->eptr_op_24 = &IndexTable[eindex];
-                GetMBIndex(mb_info->mb_position, mb_info->num_pieces, true,
-                           mb_info->eptr_op_24, &kk_index_blocked,
-                           &mb_info->index_op_24);
-            } else {
-                mb_info->eptr_op_24 = NULL;
-                mb_info->index_op_24 = ALL_ONES;
-            }
+    int eindex = GetEndingTypeMemo(memo, count, mb_info->mb_piece_types,
+                                   bishop_parity, Free);
+
+    if (eindex >= 0) {
+        memcpy(mb_info->parity_index[0].bishop_parity, bishop_parity,
+               sizeof(bishop_parity));
+        mb_info->parity_index[0].eptr = &IndexTable[eindex];
+        mb_info->num_parities++;
+
+        // check whether we can also probe blocked/opposing pawn data
+
+        for (int i = 0; i < num_variants; i++) {
+            eindex = GetEndingTypeMemo(memo, count, NULL, bishop_parity,
+                                       variants[i]);
+            if (eindex >= 0)
+                *PawnFileEptr(mb_info, variants[i]) = &IndexTable[eindex];
         }
     }
 
@@ -4930,17 +5420,13 @@ static int GetMBInfo(const BOARD *Board, MbInfo *mb_info) {
 
     // if there are no parities, no need to check further
 
-    if (bishop_parity[White] == None && bishop_parity[Black] == None) {
-        if (mb_info->num_parities == 0)
-            return ETYPE_NOT_MAPPED;
-        GetMBIndex(mb_info->mb_position, mb_info->num_pieces, pawns_present,
-                   mb_info->parity_index[0].eptr, &mb_info->kk_index,
-                   &mb_info->parity_index[0].index);
-    }
+    if (bishop_parity[White] == None && bishop_parity[Black] == None &&
+        mb_info->num_parities == 0)
+        return ETYPE_NOT_MAPPED;
 
     // now gather index for specific bishop parity
 
-    eindex = GetEndingType(Board->piece_type_count, NULL, bishop_parity, Free);
+    eindex = GetEndingTypeMemo(memo, count, NULL, bishop_parity, Free);
 
     if (eindex >= 0) {
         memcpy(mb_info->parity_index[mb_info->num_parities].bishop_parity,
@@ -4957,8 +5443,7 @@ static int GetMBInfo(const BOARD *Board, MbInfo *mb_info) {
         sub_bishop_parity[White] = bishop_parity[White];
         sub_bishop_parity[Black] = None;
 
-        eindex = GetEndingType(Board->piece_type_count, NULL, sub_bishop_parity,
-                               Free);
+        eindex = GetEndingTypeMemo(memo, count, NULL, sub_bishop_parity, Free);
 
         if (eindex >= 0) {
             memcpy(mb_info->parity_index[mb_info->num_parities].bishop_parity,
@@ -4971,8 +5456,7 @@ static int GetMBInfo(const BOARD *Board, MbInfo *mb_info) {
         sub_bishop_parity[White] = None;
         sub_bishop_parity[Black] = bishop_parity[Black];
 
-        eindex = GetEndingType(Board->piece_type_count, NULL, sub_bishop_parity,
-                               Free);
+        eindex = GetEndingTypeMemo(memo, count, NULL, sub_bishop_parity, Free);
 
         if (eindex >= 0) {
             memcpy(mb_info->parity_index[mb_info->num_parities].bishop_parity,
@@ -4987,25 +5471,162 @@ static int GetMBInfo(const BOARD *Board, MbInfo *mb_info) {
         return ETYPE_NOT_MAPPED;
     }
 
-    GetMBIndex(mb_info->mb_position, mb_info->num_pieces, pawns_present,
-               mb_info->parity_index[0].eptr, &mb_info->kk_index,
-               &mb_info->parity_index[0].index);
+    return 0;
+}
+
+// Computes the indices of the ending types selected by ResolveEndingTypes,
+// all from a single canonical placement, which is stored in mb_position. If
+// filter is not NULL, only the indices of table variants it accepts are
+// computed, and the others are set to ALL_ONES.
 
-    for (int i = 1; i < mb_info->num_parities; i++) {
-        int kk_index;
-        GetMBIndex(mb_info->mb_position, mb_info->num_pieces, pawns_present,
-                   mb_info->parity_index[i].eptr, &kk_index,
-                   &mb_info->parity_index[i].index);
-        assert(kk_index == mb_info->kk_index);
+static void ComputeMBIndices(MbInfo *mb_info, MbTableFilter filter,
+                             void *data) {
+    bool pawns_present = mb_info->piece_type_count[White][PAWN] ||
+                         mb_info->piece_type_count[Black][PAWN];
+
+    CanonicalPosition canonical;
+    Canonicalize(mb_info->mb_position, mb_info->num_pieces, pawns_present,
+                 &canonical);
+    memcpy(mb_info->mb_position, canonical.pos,
+           mb_info->num_pieces * sizeof(canonical.pos[0]));
+    mb_info->kk_index = canonical.kk_index;
+
+    // pawn file variants only exist if pawns are present, so they share the
+    // canonical placement
+
+    PawnFileType variants[2];
+    int num_variants = GetPawnFileVariants(mb_info->pawn_file_type, variants);
+    for (int i = 0; i < num_variants; i++) {
+        const IndexType *eptr = *PawnFileEptr(mb_info, variants[i]);
+        ZIndex *index = PawnFileIndex(mb_info, variants[i]);
+        if (eptr == NULL)
+            continue;
+        if (filter != NULL) {
+            static const BishopParity no_parity[2] = {None, None};
+            if (!filter(data, variants[i], no_parity, mb_info->kk_index)) {
+                *index = ALL_ONES;
+                continue;
+            }
+        }
+        *index = GetMBIndex(&canonical, eptr);
     }
 
+    for (int i = 0; i < mb_info->num_parities; i++) {
+        ParityIndex *parity_index = &mb_info->parity_index[i];
+        if (filter != NULL && !filter(data, Free, parity_index->bishop_parity,
+                                      mb_info->kk_index)) {
+            parity_index->index = ALL_ONES;
+            continue;
+        }
+        parity_index->index = GetMBIndex(&canonical, parity_index->eptr);
+    }
+}
+
+// Fills in all fields of mb_info that are meaningful for the position, so
+// callers need not clear it beforehand. Of the pawn file type indices, only
+// those of the variants of pawn_file_type are set.
+
+static int GetMBInfo(const BOARD *Board, MbInfo *mb_info, EndingTypeMemo *memo,
+                     MbTableFilter filter, void *data) {
+    mb_info->num_parities = 0;
+    mb_info->pawn_file_type = Free;
+
+    if (Board->num_pieces > MAX_PIECES_MB) {
+        return TOO_MANY_PIECES;
+    }
+
+    memcpy(mb_info->piece_type_count, Board->piece_type_count,
+           sizeof(Board->piece_type_count));
+
+    mb_info->num_pieces = Board->num_pieces;
+
+    GetMBPosition(Board, mb_info->mb_position, mb_info->squares,
+                  &mb_info->parity, &mb_info->pawn_file_type);
+
+    memset(mb_info->mb_piece_types, 0, sizeof(mb_info->mb_piece_types));
+
+    int result = ResolveEndingTypes(mb_info, memo);
+    if (result != 0)
+        return result;
+
+    ComputeMBIndices(mb_info, filter, data);
     return 0;
 }
 
-void mbeval_init(void) {
+static void InitSmallTables(void) {
+    InitEndingTypeHash();
     InitTransforms();
+    InitTransformSquares();
     InitParity();
+    InitN5Tables();
+    InitN6Tables();
+    InitN7Tables();
+}
+
+static bool Initialized = false;
+
+void mbeval_init(void) {
+    InitSmallTables();
     InitPermutationTables();
+    Initialized = true;
+}
+
+int mbeval_init_from_snapshot(const char *path) {
+    assert(path != NULL);
+
+    InitSmallTables();
+    bool mapped = MapPermutationTables(path);
+    if (!mapped)
+        InitPermutationTables();
+    Initialized = true;
+    return mapped;
+}
+
+int mbeval_is_initialized(void) { return Initialized; }
+
+int mbeval_write_snapshot(const char *path) {
+    assert(path != NULL);
+    assert(PermutationTables != NULL);
+
+    size_t size = PermutationTablesLayout(NULL);
+    unsigned char padding[SNAPSHOT_DATA_OFFSET] = {0};
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.nsquares = NSQUARES;
+    header.size = size;
+
+    // Servers may have the snapshot mapped, so never write to it in place.
+    // Write a temporary file in the same directory and rename it over the
+    // snapshot, which leaves existing mappings on the old file intact.
+    size_t tmp_size = strlen(path) + 32;
+    char *tmp = malloc(tmp_size);
+    if (tmp == NULL)
+        return -1;
+    snprintf(tmp, tmp_size, "%s.tmp.%ld", path, (long)getpid());
+
+    FILE *file = fopen(tmp, "wb");
+    if (file == NULL) {
+        free(tmp);
+        return -1;
+    }
+    bool ok =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(padding, SNAPSHOT_DATA_OFFSET - sizeof(header), 1, file) == 1 &&
+        fwrite(PermutationTables, size, 1, file) == 1 && fflush(file) == 0 &&
+        fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+        ok = false;
+    if (ok && rename(tmp, path) != 0)
+        ok = false;
+    if (!ok) {
+        int saved_errno = errno;
+        unlink(tmp);
+        errno = saved_errno;
+    }
+    free(tmp);
+    return ok ? 0 : -1;
 }
 
 int mbeval_get_mb_info(const Piece pieces[NSQUARES], Side side, int ep_square,
@@ -5016,6 +5637,868 @@ int mbeval_get_mb_info(const Piece pieces[NSQUARES], Side side, int ep_square,
     BOARD board;
     SetBoard(&board, pieces, side, ep_square);
 
-    memset(info, 0, sizeof(MbInfo));
-    return GetMBInfo(&board, info);
+    return GetMBInfo(&board, info, NULL, NULL, NULL);
+}
+
+static int GetChildMBInfoFromBoard(const MbInfo *parent, int from, int to,
+                                   Piece promotion, Side side, int ep_square,
+                                   MbInfo *info) {
+    Piece pieces[NSQUARES];
+    memset(pieces, 0, sizeof(pieces));
+    for (int i = 0; i < parent->num_pieces; i++)
+        pieces[parent->squares[i]] = parent->mb_piece_types[i];
+
+    Piece piece = pieces[from];
+    bool pawn = piece == PAWN || piece == -PAWN;
+    if (pawn && Column(from) != Column(to) && pieces[to] == NO_PIECE)
+        pieces[SquareMake(Row(from), Column(to))] = NO_PIECE; // en passant
+    pieces[from] = NO_PIECE;
+    if (promotion != NO_PIECE)
+        pieces[to] = piece > 0 ? promotion : -promotion;
+    else
+        pieces[to] = piece;
+
+    return mbeval_get_mb_info(pieces, side, ep_square, info);
+}
+
+int mbeval_get_child_mb_info(const MbInfo *parent, int from, int to,
+                             Piece promotion, Side side, int ep_square,
+                             MbInfo *info) {
+    assert(parent != NULL);
+    assert(info != NULL);
+    assert(parent->num_parities > 0);
+
+    int n = parent->num_pieces;
+    int moved = -1;
+    for (int i = 0; i < n; i++) {
+        if (parent->squares[i] == to)
+            return GetChildMBInfoFromBoard(parent, from, to, promotion, side,
+                                           ep_square, info); // capture
+        if (parent->squares[i] == from)
+            moved = i;
+    }
+    assert(moved >= 0);
+
+    Piece piece = parent->mb_piece_types[moved];
+    bool pawn = piece == PAWN || piece == -PAWN;
+    bool bishop = piece == BISHOP || piece == -BISHOP;
+    if (promotion != NO_PIECE || ep_square > 0 ||
+        (pawn && Column(from) != Column(to)) ||
+        (bishop && IsWhiteSquare[from] != IsWhiteSquare[to]))
+        return GetChildMBInfoFromBoard(parent, from, to, promotion, side,
+                                       ep_square, info);
+
+    // A quiet move keeps the material and the square colours of bishops, so
+    // unless the pawn file type changes, the ending types of the parent apply.
+    // Keep identical pieces in ascending order, like SetBoard.
+
+    memcpy(info, parent, sizeof(MbInfo));
+    int *squares = info->squares;
+    squares[moved] = to;
+    while (moved > 0 && info->mb_piece_types[moved - 1] == piece &&
+           squares[moved - 1] > squares[moved]) {
+        SWAP(squares[moved - 1], squares[moved]);
+        moved--;
+    }
+    while (moved < n - 1 && info->mb_piece_types[moved + 1] == piece &&
+           squares[moved + 1] < squares[moved]) {
+        SWAP(squares[moved + 1], squares[moved]);
+        moved++;
+    }
+    memcpy(info->mb_position, squares, n * sizeof(squares[0]));
+
+    if (info->piece_type_count[White][PAWN] ||
+        info->piece_type_count[Black][PAWN]) {
+        info->pawn_file_type =
+            GetPawnFileType(info->mb_position, info->piece_type_count);
+        if (info->pawn_file_type != parent->pawn_file_type)
+            return GetChildMBInfoFromBoard(parent, from, to, promotion, side,
+                                           ep_square, info);
+    }
+
+    ComputeMBIndices(info, NULL, NULL);
+    return 0;
+}
+
+int mbeval_get_mb_info_bitboards(const uint64_t bitboards[2][6], Side side,
+                                 int ep_square, MbInfo *info) {
+    assert(bitboards != NULL);
+    assert(info != NULL);
+
+    BOARD board;
+    SetBoardFromBitboards(&board, bitboards, side, ep_square);
+
+    return GetMBInfo(&board, info, NULL, NULL, NULL);
+}
+
+int mbeval_get_mb_info_filtered(const uint64_t bitboards[2][6], Side side,
+                                int ep_square, MbTableFilter filter, void *data,
+                                MbInfo *info) {
+    assert(bitboards != NULL);
+    assert(filter != NULL);
+    assert(info != NULL);
+
+    BOARD board;
+    SetBoardFromBitboards(&board, bitboards, side, ep_square);
+
+    return GetMBInfo(&board, info, NULL, filter, data);
+}
+
+// Mirrors the board vertically and swaps the colours of all pieces and the
+// side to move. Piece locations are kept in ascending order, like SetBoard.
+
+#define MirrorSquare(sq) SquareMake(NROWS - 1 - Row(sq), Column(sq))
+
+static void MirrorBoard(const BOARD *Board, BOARD *Mirrored) {
+    Mirrored->side = Board->side == White ? Black : White;
+    Mirrored->ep_square = Board->ep_square > 0 ? MirrorSquare(Board->ep_square)
+                                               : Board->ep_square;
+    Mirrored->num_pieces = Board->num_pieces;
+    Mirrored->wkpos = MirrorSquare(Board->bkpos);
+    Mirrored->bkpos = MirrorSquare(Board->wkpos);
+
+    for (int color = White; color <= Black; color++) {
+        int other = color == White ? Black : White;
+        for (int p = PAWN; p < KING; p++) {
+            int n = Board->piece_type_count[other][p];
+            const int *from = Board->piece_locations[other][p];
+            int *to = Mirrored->piece_locations[color][p];
+            Mirrored->piece_type_count[color][p] = n;
+            for (int i = 0; i < n; i++) {
+                int sq = MirrorSquare(from[i]), j = i;
+                for (; j > 0 && to[j - 1] > sq; j--)
+                    to[j] = to[j - 1];
+                to[j] = sq;
+            }
+        }
+    }
+}
+
+void mbeval_get_mb_info_mirrored(const uint64_t bitboards[2][6], Side side,
+                                 int ep_square, MbTableFilter filter,
+                                 void *data, void *mirrored_data,
+                                 MbInfo infos[2], int results[2]) {
+    assert(bitboards != NULL);
+    assert(infos != NULL);
+    assert(results != NULL);
+
+    BOARD board, mirrored;
+    SetBoardFromBitboards(&board, bitboards, side, ep_square);
+    MirrorBoard(&board, &mirrored);
+
+    results[0] = GetMBInfo(&board, &infos[0], NULL, filter, data);
+    results[1] = GetMBInfo(&mirrored, &infos[1], NULL, filter, mirrored_data);
+}
+
+void mbeval_get_mb_info_batch(const MbPosition *positions, size_t n,
+                              MbInfo *infos, int *results) {
+    assert(positions != NULL || n == 0);
+    assert(infos != NULL || n == 0);
+    assert(results != NULL || n == 0);
+
+    EndingTypeMemo memo;
+    memset(&memo, 0, sizeof(memo));
+
+    for (size_t i = 0; i < n; i++) {
+        BOARD board;
+        SetBoard(&board, positions[i].pieces, positions[i].side,
+                 positions[i].ep_square);
+
+        results[i] = GetMBInfo(&board, &infos[i], &memo, NULL, NULL);
+    }
+}
+
+/*
+ * Unranking inverts the index functions of IndexTable. Each of them computes
+ * a mixed radix number whose digits rank a single piece or a group of pieces.
+ * IndexLayouts lists the digits of each entry, least significant first, by the
+ * ranker and the first mb_position it covers. The most significant digit takes
+ * the rest of the index. Groups ranked through tables with holes, by parity
+ * or by opposing pawns, are inverted with tables built by enumerating their
+ * forward rankers in mbeval_init_unrank.
+ */
+
+typedef enum {
+    UNRANK_END = 0,
+    UNRANK_SQUARE,
+    UNRANK_N2,
+    UNRANK_N3,
+    UNRANK_N4,
+    UNRANK_N5,
+    UNRANK_N6,
+    UNRANK_N7,
+    UNRANK_BP, // white pawn blocked by a black pawn
+    UNRANK_N2_EVEN,
+    UNRANK_N2_ODD,
+    UNRANK_N3_EVEN,
+    UNRANK_N3_ODD,
+    UNRANK_OP11,
+    UNRANK_OP21,
+    UNRANK_OP12,
+    UNRANK_OP22,
+    UNRANK_DP22,
+    UNRANK_OP31,
+    UNRANK_OP13,
+    NUM_UNRANK_TYPES
+} UnrankType;
+
+typedef struct {
+    uint8_t type, first;
+} UnrankStep;
+
+typedef struct {
+    ZIndex (*index_from_pos)(const int *pos);
+    UnrankStep steps[MAX_PIECES_MB - 1];
+} IndexLayout;
+
+#define STEP(type, first) {UNRANK_##type, first}
+
+static const IndexLayout IndexLayouts[] = {
+    {Index111111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4),
+      STEP(SQUARE, 3), STEP(SQUARE, 2)}},
+    {IndexBP111111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4),
+      STEP(BP, 2)}},
+    {IndexOP111111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4),
+      STEP(OP11, 2)}},
+    {Index21111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4),
+      STEP(N2, 2)}},
+    {IndexOP21111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(OP21, 2)}},
+    {Index12111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 2),
+      STEP(N2, 3)}},
+    {IndexOP12111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(OP12, 2)}},
+    {Index11211,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N2, 4)}},
+    {IndexBP11211,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2, 4), STEP(BP, 2)}},
+    {IndexOP11211,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2, 4), STEP(OP11, 2)}},
+    {Index11121,
+     {STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N2, 5)}},
+    {IndexBP11121,
+     {STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(N2, 5), STEP(BP, 2)}},
+    {IndexOP11121,
+     {STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(N2, 5), STEP(OP11, 2)}},
+    {Index11112,
+     {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N2, 6)}},
+    {IndexBP11112,
+     {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 6), STEP(BP, 2)}},
+    {IndexOP11112,
+     {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 6), STEP(OP11, 2)}},
+    {Index2211, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP2211, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(DP22, 2)}},
+    {IndexOP2211, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(OP22, 2)}},
+    {Index2211_1100,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2_ODD, 2), STEP(N2, 4)}},
+    {Index2211_1000,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2_EVEN, 2), STEP(N2, 4)}},
+    {Index2121, {STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(N2, 5), STEP(N2, 2)}},
+    {IndexOP2121, {STEP(SQUARE, 7), STEP(N2, 5), STEP(OP21, 2)}},
+    {Index1221, {STEP(SQUARE, 7), STEP(SQUARE, 2), STEP(N2, 5), STEP(N2, 3)}},
+    {IndexOP1221, {STEP(SQUARE, 7), STEP(N2, 5), STEP(OP12, 2)}},
+    {Index2112, {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 6), STEP(N2, 2)}},
+    {IndexOP2112, {STEP(SQUARE, 5), STEP(N2, 6), STEP(OP21, 2)}},
+    {Index1212, {STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 6), STEP(N2, 3)}},
+    {IndexOP1212, {STEP(SQUARE, 5), STEP(N2, 6), STEP(OP12, 2)}},
+    {Index1122, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 6), STEP(N2, 4)}},
+    {IndexBP1122, {STEP(N2, 6), STEP(N2, 4), STEP(BP, 2)}},
+    {IndexOP1122, {STEP(N2, 6), STEP(N2, 4), STEP(OP11, 2)}},
+    {Index222, {STEP(N2, 6), STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP222, {STEP(N2, 6), STEP(DP22, 2)}},
+    {IndexOP222, {STEP(N2, 6), STEP(OP22, 2)}},
+    {Index3111,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(N3, 2)}},
+    {IndexOP3111, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(OP31, 2)}},
+    {Index1311,
+     {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 2), STEP(N3, 3)}},
+    {IndexOP1311, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(OP13, 2)}},
+    {Index1131,
+     {STEP(SQUARE, 7), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N3, 4)}},
+    {IndexBP1131, {STEP(SQUARE, 7), STEP(N3, 4), STEP(BP, 2)}},
+    {IndexOP1131, {STEP(SQUARE, 7), STEP(N3, 4), STEP(OP11, 2)}},
+    {Index1113,
+     {STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N3, 5)}},
+    {IndexBP1113, {STEP(SQUARE, 4), STEP(N3, 5), STEP(BP, 2)}},
+    {IndexOP1113, {STEP(SQUARE, 4), STEP(N3, 5), STEP(OP11, 2)}},
+    {Index123, {STEP(SQUARE, 2), STEP(N2, 3), STEP(N3, 5)}},
+    {IndexOP123, {STEP(N3, 5), STEP(OP12, 2)}},
+    {Index213, {STEP(SQUARE, 4), STEP(N2, 2), STEP(N3, 5)}},
+    {IndexOP213, {STEP(N3, 5), STEP(OP21, 2)}},
+    {Index132, {STEP(SQUARE, 2), STEP(N2, 6), STEP(N3, 3)}},
+    {IndexOP132, {STEP(N2, 6), STEP(OP13, 2)}},
+    {Index231, {STEP(SQUARE, 7), STEP(N2, 2), STEP(N3, 4)}},
+    {Index312, {STEP(SQUARE, 5), STEP(N2, 6), STEP(N3, 2)}},
+    {IndexOP312, {STEP(N2, 6), STEP(OP31, 2)}},
+    {Index321, {STEP(SQUARE, 7), STEP(N2, 5), STEP(N3, 2)}},
+    {Index33, {STEP(N3, 5), STEP(N3, 2)}},
+    {Index411, {STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N4, 2)}},
+    {Index141, {STEP(SQUARE, 7), STEP(SQUARE, 2), STEP(N4, 3)}},
+    {Index114, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N4, 4)}},
+    {IndexBP114, {STEP(N4, 4), STEP(BP, 2)}},
+    {IndexOP114, {STEP(N4, 4), STEP(OP11, 2)}},
+    {Index42, {STEP(N2, 6), STEP(N4, 2)}},
+    {Index24, {STEP(N2, 2), STEP(N4, 4)}},
+    {Index1111111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5),
+      STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2)}},
+    {Index211111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5),
+      STEP(SQUARE, 4), STEP(N2, 2)}},
+    {Index121111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5),
+      STEP(SQUARE, 2), STEP(N2, 3)}},
+    {Index112111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 3),
+      STEP(SQUARE, 2), STEP(N2, 4)}},
+    {Index111211,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(SQUARE, 3),
+      STEP(SQUARE, 2), STEP(N2, 5)}},
+    {Index111121,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3),
+      STEP(SQUARE, 2), STEP(N2, 6)}},
+    {Index111112,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3),
+      STEP(SQUARE, 2), STEP(N2, 7)}},
+    {Index22111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N2, 4),
+      STEP(N2, 2)}},
+    {IndexDP22111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(DP22, 2)}},
+    {Index21211,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 4), STEP(N2, 5),
+      STEP(N2, 2)}},
+    {Index21121,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 6),
+      STEP(N2, 2)}},
+    {Index21112,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 7),
+      STEP(N2, 2)}},
+    {Index12211,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 2), STEP(N2, 5),
+      STEP(N2, 3)}},
+    {Index12121,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 6),
+      STEP(N2, 3)}},
+    {Index12112,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 7),
+      STEP(N2, 3)}},
+    {Index11221,
+     {STEP(SQUARE, 8), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 6),
+      STEP(N2, 4)}},
+    {Index11212,
+     {STEP(SQUARE, 6), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 7),
+      STEP(N2, 4)}},
+    {Index11122,
+     {STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 7),
+      STEP(N2, 5)}},
+    {Index2221, {STEP(SQUARE, 8), STEP(N2, 6), STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP2221, {STEP(SQUARE, 8), STEP(N2, 6), STEP(DP22, 2)}},
+    {Index2221_1131,
+     {STEP(SQUARE, 8), STEP(N2_ODD, 6), STEP(N2_ODD, 2), STEP(N2, 4)}},
+    {Index2221_1130,
+     {STEP(SQUARE, 8), STEP(N2_EVEN, 6), STEP(N2_ODD, 2), STEP(N2, 4)}},
+    {Index2221_1030,
+     {STEP(SQUARE, 8), STEP(N2_EVEN, 6), STEP(N2_EVEN, 2), STEP(N2, 4)}},
+    {Index2212, {STEP(SQUARE, 6), STEP(N2, 7), STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP2212, {STEP(SQUARE, 6), STEP(N2, 7), STEP(DP22, 2)}},
+    {Index2122, {STEP(SQUARE, 4), STEP(N2, 7), STEP(N2, 5), STEP(N2, 2)}},
+    {Index1222, {STEP(SQUARE, 2), STEP(N2, 7), STEP(N2, 5), STEP(N2, 3)}},
+    {Index31111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 5),
+      STEP(N3, 2)}},
+    {Index13111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(SQUARE, 2),
+      STEP(N3, 3)}},
+    {Index11311,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N3, 4)}},
+    {Index11131,
+     {STEP(SQUARE, 8), STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N3, 5)}},
+    {Index11113,
+     {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2),
+      STEP(N3, 6)}},
+    {Index3211, {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(N2, 5), STEP(N3, 2)}},
+    {Index3121, {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(N2, 6), STEP(N3, 2)}},
+    {Index3121_1100,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(N2, 6), STEP(N3_ODD, 2)}},
+    {Index3121_1111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(N2_ODD, 6), STEP(N3_ODD, 2)}},
+    {Index3121_1110,
+     {STEP(SQUARE, 8), STEP(SQUARE, 5), STEP(N2_EVEN, 6), STEP(N3_ODD, 2)}},
+    {Index3112, {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(N2, 7), STEP(N3, 2)}},
+    {Index2311, {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(N2, 2), STEP(N3, 4)}},
+    {Index2131, {STEP(SQUARE, 8), STEP(SQUARE, 4), STEP(N2, 2), STEP(N3, 5)}},
+    {Index2113, {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 2), STEP(N3, 6)}},
+    {Index1321, {STEP(SQUARE, 8), STEP(SQUARE, 2), STEP(N2, 6), STEP(N3, 3)}},
+    {Index1312, {STEP(SQUARE, 6), STEP(SQUARE, 2), STEP(N2, 7), STEP(N3, 3)}},
+    {Index1312_0010,
+     {STEP(SQUARE, 6), STEP(SQUARE, 2), STEP(N2_EVEN, 7), STEP(N3, 3)}},
+    {Index1312_0011,
+     {STEP(SQUARE, 6), STEP(SQUARE, 2), STEP(N2_ODD, 7), STEP(N3, 3)}},
+    {Index1231, {STEP(SQUARE, 8), STEP(SQUARE, 2), STEP(N2, 3), STEP(N3, 5)}},
+    {Index1213, {STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 3), STEP(N3, 6)}},
+    {Index1132, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 7), STEP(N3, 4)}},
+    {Index1123, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 4), STEP(N3, 6)}},
+    {Index322, {STEP(N2, 7), STEP(N2, 5), STEP(N3, 2)}},
+    {Index322_0010, {STEP(N2_EVEN, 5), STEP(N2, 7), STEP(N3, 2)}},
+    {Index322_0011, {STEP(N2_ODD, 5), STEP(N2, 7), STEP(N3, 2)}},
+    {Index232, {STEP(N2, 7), STEP(N2, 2), STEP(N3, 4)}},
+    {Index223, {STEP(N2, 4), STEP(N2, 2), STEP(N3, 6)}},
+    {IndexDP223, {STEP(N3, 6), STEP(DP22, 2)}},
+    {Index223_1100, {STEP(N2_ODD, 2), STEP(N2, 4), STEP(N3, 6)}},
+    {Index223_1000, {STEP(N2_EVEN, 2), STEP(N2, 4), STEP(N3, 6)}},
+    {Index331, {STEP(SQUARE, 8), STEP(N3, 5), STEP(N3, 2)}},
+    {Index331_0020, {STEP(SQUARE, 8), STEP(N3_EVEN, 5), STEP(N3, 2)}},
+    {Index331_0021, {STEP(SQUARE, 8), STEP(N3_ODD, 5), STEP(N3, 2)}},
+    {Index313, {STEP(SQUARE, 5), STEP(N3, 6), STEP(N3, 2)}},
+    {Index133, {STEP(SQUARE, 2), STEP(N3, 6), STEP(N3, 3)}},
+    {Index4111,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 6), STEP(N4, 2)}},
+    {Index1411,
+     {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(SQUARE, 2), STEP(N4, 3)}},
+    {Index1141,
+     {STEP(SQUARE, 8), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N4, 4)}},
+    {Index1114,
+     {STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N4, 5)}},
+    {Index421, {STEP(SQUARE, 8), STEP(N2, 6), STEP(N4, 2)}},
+    {Index421_0010, {STEP(SQUARE, 8), STEP(N2_EVEN, 6), STEP(N4, 2)}},
+    {Index421_0011, {STEP(SQUARE, 8), STEP(N2_ODD, 6), STEP(N4, 2)}},
+    {Index412, {STEP(SQUARE, 6), STEP(N2, 7), STEP(N4, 2)}},
+    {Index241, {STEP(SQUARE, 8), STEP(N2, 2), STEP(N4, 4)}},
+    {Index214, {STEP(SQUARE, 4), STEP(N2, 2), STEP(N4, 5)}},
+    {Index142, {STEP(SQUARE, 2), STEP(N2, 7), STEP(N4, 3)}},
+    {Index124, {STEP(SQUARE, 2), STEP(N2, 3), STEP(N4, 5)}},
+    {Index43, {STEP(N3, 6), STEP(N4, 2)}},
+    {Index34, {STEP(N3, 2), STEP(N4, 5)}},
+    {Index511, {STEP(SQUARE, 8), STEP(SQUARE, 7), STEP(N5, 2)}},
+    {Index151, {STEP(SQUARE, 8), STEP(SQUARE, 2), STEP(N5, 3)}},
+    {Index115, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N5, 4)}},
+    {Index52, {STEP(N2, 7), STEP(N5, 2)}},
+    {Index25, {STEP(N2, 2), STEP(N5, 4)}},
+    {Index61, {STEP(SQUARE, 8), STEP(N6, 2)}},
+    {Index16, {STEP(SQUARE, 2), STEP(N6, 3)}},
+    {Index1, {STEP(SQUARE, 2)}},
+    {Index11, {STEP(SQUARE, 3), STEP(SQUARE, 2)}},
+    {IndexBP11, {STEP(BP, 2)}},
+    {IndexOP11, {STEP(OP11, 2)}},
+    {Index111, {STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2)}},
+    {IndexBP111, {STEP(SQUARE, 4), STEP(BP, 2)}},
+    {IndexOP111, {STEP(SQUARE, 4), STEP(OP11, 2)}},
+    {Index1111,
+     {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2)}},
+    {IndexBP1111, {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(BP, 2)}},
+    {IndexOP1111, {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(OP11, 2)}},
+    {Index11111,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(SQUARE, 3),
+      STEP(SQUARE, 2)}},
+    {IndexBP11111,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(BP, 2)}},
+    {IndexOP11111,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(OP11, 2)}},
+    {Index2, {STEP(N2, 2)}},
+    {Index2_1100, {STEP(N2_ODD, 2)}},
+    {Index21, {STEP(SQUARE, 4), STEP(N2, 2)}},
+    {IndexOP21, {STEP(OP21, 2)}},
+    {Index12, {STEP(SQUARE, 2), STEP(N2, 3)}},
+    {IndexOP12, {STEP(OP12, 2)}},
+    {Index211, {STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 2)}},
+    {IndexOP211, {STEP(SQUARE, 5), STEP(OP21, 2)}},
+    {Index121, {STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 3)}},
+    {IndexOP121, {STEP(SQUARE, 5), STEP(OP12, 2)}},
+    {Index112, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 4)}},
+    {IndexBP112, {STEP(N2, 4), STEP(BP, 2)}},
+    {IndexOP112, {STEP(N2, 4), STEP(OP11, 2)}},
+    {Index2111,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 4), STEP(N2, 2)}},
+    {IndexOP2111, {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(OP21, 2)}},
+    {Index1211,
+     {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(SQUARE, 2), STEP(N2, 3)}},
+    {IndexOP1211, {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(OP12, 2)}},
+    {Index1121,
+     {STEP(SQUARE, 6), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 4)}},
+    {IndexBP1121, {STEP(SQUARE, 6), STEP(N2, 4), STEP(BP, 2)}},
+    {IndexOP1121, {STEP(SQUARE, 6), STEP(N2, 4), STEP(OP11, 2)}},
+    {Index1112,
+     {STEP(SQUARE, 4), STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N2, 5)}},
+    {IndexBP1112, {STEP(SQUARE, 4), STEP(N2, 5), STEP(BP, 2)}},
+    {IndexOP1112, {STEP(SQUARE, 4), STEP(N2, 5), STEP(OP11, 2)}},
+    {Index22, {STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP22, {STEP(DP22, 2)}},
+    {IndexOP22, {STEP(OP22, 2)}},
+    {Index221, {STEP(SQUARE, 6), STEP(N2, 4), STEP(N2, 2)}},
+    {IndexDP221, {STEP(SQUARE, 6), STEP(DP22, 2)}},
+    {IndexOP221, {STEP(SQUARE, 6), STEP(OP22, 2)}},
+    {Index212, {STEP(SQUARE, 4), STEP(N2, 5), STEP(N2, 2)}},
+    {IndexOP212, {STEP(N2, 5), STEP(OP21, 2)}},
+    {Index122, {STEP(SQUARE, 2), STEP(N2, 5), STEP(N2, 3)}},
+    {IndexOP122, {STEP(N2, 5), STEP(OP12, 2)}},
+    {Index3, {STEP(N3, 2)}},
+    {Index3_1100, {STEP(N3_ODD, 2)}},
+    {Index31, {STEP(SQUARE, 5), STEP(N3, 2)}},
+    {IndexOP31, {STEP(OP31, 2)}},
+    {Index13, {STEP(SQUARE, 2), STEP(N3, 3)}},
+    {IndexOP13, {STEP(OP13, 2)}},
+    {Index311, {STEP(SQUARE, 6), STEP(SQUARE, 5), STEP(N3, 2)}},
+    {IndexOP311, {STEP(SQUARE, 6), STEP(OP31, 2)}},
+    {Index131, {STEP(SQUARE, 6), STEP(SQUARE, 2), STEP(N3, 3)}},
+    {IndexOP131, {STEP(SQUARE, 6), STEP(OP13, 2)}},
+    {Index113, {STEP(SQUARE, 3), STEP(SQUARE, 2), STEP(N3, 4)}},
+    {IndexBP113, {STEP(N3, 4), STEP(BP, 2)}},
+    {IndexOP113, {STEP(N3, 4), STEP(OP11, 2)}},
+    {Index32, {STEP(N2, 5), STEP(N3, 2)}},
+    {Index23, {STEP(N2, 2), STEP(N3, 4)}},
+    {Index4, {STEP(N4, 2)}},
+    {Index41, {STEP(SQUARE, 6), STEP(N4, 2)}},
+    {Index14, {STEP(SQUARE, 2), STEP(N4, 3)}},
+    {Index5, {STEP(N5, 2)}},
+    {Index51, {STEP(SQUARE, 7), STEP(N5, 2)}},
+    {Index15, {STEP(SQUARE, 2), STEP(N5, 3)}},
+    {Index6, {STEP(N6, 2)}},
+    {Index7, {STEP(N7, 2)}},
+};
+
+#undef STEP
+
+_Static_assert(sizeof(IndexLayouts) / sizeof(IndexLayouts[0]) ==
+                   NumIndexTypes,
+               "IndexLayouts must parallel IndexTable");
+
+static const int UnrankPieces[NUM_UNRANK_TYPES] = {
+    [UNRANK_SQUARE] = 1, [UNRANK_N2] = 2,      [UNRANK_N3] = 3,
+    [UNRANK_N4] = 4,     [UNRANK_N5] = 5,      [UNRANK_N6] = 6,
+    [UNRANK_N7] = 7,     [UNRANK_BP] = 2,      [UNRANK_N2_EVEN] = 2,
+    [UNRANK_N2_ODD] = 2, [UNRANK_N3_EVEN] = 3, [UNRANK_N3_ODD] = 3,
+    [UNRANK_OP11] = 2,   [UNRANK_OP21] = 3,    [UNRANK_OP12] = 3,
+    [UNRANK_OP22] = 4,   [UNRANK_DP22] = 4,    [UNRANK_OP31] = 4,
+    [UNRANK_OP13] = 4,
+};
+
+// Radix of each digit, or 0 for rankers that only occur as the most
+// significant digit.
+static const ZIndex UnrankRadix[NUM_UNRANK_TYPES] = {
+    [UNRANK_SQUARE] = NSQUARES,
+    [UNRANK_N2] = N2_Offset,
+    [UNRANK_N3] = N3_Offset,
+    [UNRANK_N4] = N4_Offset,
+    [UNRANK_N2_EVEN] = N2_EVEN_PARITY_Offset,
+    [UNRANK_N2_ODD] = N2_ODD_PARITY_Offset,
+    [UNRANK_N3_EVEN] = N3_EVEN_PARITY_Offset,
+    [UNRANK_N3_ODD] = N3_ODD_PARITY_Offset,
+};
+
+static ZIndex Binomial[NSQUARES + 1][MAX_PIECES_MB - 1];
+
+// Squares of each group rank of the table driven rankers, packed in base
+// NSQUARES, least significant first. UINT32_MAX marks ranks no group has, up
+// to the allocated size.
+static uint32_t *UnrankTables[NUM_UNRANK_TYPES];
+static ZIndex UnrankTableSize[NUM_UNRANK_TYPES];
+
+static bool UnrankInitialized = false;
+
+// Ranks the group of squares sq with the forward ranker of type, in the
+// argument order of the index functions. Returns -1 for invalid groups.
+
+static int64_t RankGroup(UnrankType type, const int *sq) {
+    int pos[MAX_PIECES_MB];
+    ZIndex index;
+
+    switch (type) {
+    case UNRANK_N2_EVEN:
+        return N2_Even_Index(sq[1], sq[0]);
+    case UNRANK_N2_ODD:
+        return N2_Odd_Index(sq[1], sq[0]);
+    case UNRANK_N3_EVEN:
+        return N3_Even_Index(sq[2], sq[1], sq[0]);
+    case UNRANK_N3_ODD:
+        return N3_Odd_Index(sq[2], sq[1], sq[0]);
+    case UNRANK_OP11:
+        return N2_Opposing_Index(sq[1], sq[0]);
+    default:
+        break;
+    }
+
+    memcpy(pos + 2, sq, UnrankPieces[type] * sizeof(sq[0]));
+    switch (type) {
+    case UNRANK_OP21:
+        index = IndexOP21(pos);
+        break;
+    case UNRANK_OP12:
+        index = IndexOP12(pos);
+        break;
+    case UNRANK_OP22:
+        index = IndexOP22(pos);
+        break;
+    case UNRANK_DP22:
+        index = IndexDP22(pos);
+        break;
+    case UNRANK_OP31:
+        index = IndexOP31(pos);
+        break;
+    case UNRANK_OP13:
+        index = IndexOP13(pos);
+        break;
+    default:
+        assert(false);
+        return -1;
+    }
+    return index == ALL_ONES ? -1 : (int64_t)index;
+}
+
+// Fills the table of a table driven ranker by ranking every group of distinct
+// squares, keeping the first group of each rank. The table grows as ranks come
+// up, so that its size need not be known in advance.
+
+static void BuildUnrankTable(UnrankType type) {
+    int n = UnrankPieces[type];
+    assert(n <= 4);
+    uint32_t num_groups = 1;
+    for (int i = 0; i < n; i++)
+        num_groups *= NSQUARES;
+
+    for (uint32_t group = 0; group < num_groups; group++) {
+        int sq[4];
+        uint64_t occupied = 0;
+        bool distinct = true;
+        uint32_t rest = group;
+        for (int i = 0; i < n; i++) {
+            sq[i] = rest % NSQUARES;
+            rest /= NSQUARES;
+            distinct = distinct && !(occupied >> sq[i] & 1);
+            occupied |= UINT64_C(1) << sq[i];
+        }
+        if (!distinct)
+            continue;
+
+        int64_t rank = RankGroup(type, sq);
+        if (rank < 0)
+            continue;
+
+        ZIndex size = UnrankTableSize[type];
+        if ((ZIndex)rank >= size) {
+            ZIndex new_size = size > 0 ? size : 1024;
+            while (new_size <= (ZIndex)rank)
+                new_size *= 2;
+            uint32_t *table =
+                realloc(UnrankTables[type], new_size * sizeof(table[0]));
+            assert(table != NULL);
+            if (table == NULL)
+                abort();
+            memset(table + size, 0xff, (new_size - size) * sizeof(table[0]));
+            UnrankTables[type] = table;
+            UnrankTableSize[type] = new_size;
+        }
+        if (UnrankTables[type][rank] == UINT32_MAX)
+            UnrankTables[type][rank] = group;
+    }
+}
+
+void mbeval_init_unrank(void) {
+    assert(Initialized);
+    if (UnrankInitialized)
+        return;
+
+    for (size_t i = 0; i < NumIndexTypes; i++)
+        assert(IndexLayouts[i].index_from_pos == IndexTable[i].index_from_pos);
+
+    for (int n = 0; n <= NSQUARES; n++) {
+        Binomial[n][0] = 1;
+        for (int k = 1; k < MAX_PIECES_MB - 1; k++)
+            Binomial[n][k] =
+                n > 0 ? Binomial[n - 1][k - 1] + Binomial[n - 1][k] : 0;
+    }
+
+    for (int type = UNRANK_N2_EVEN; type < NUM_UNRANK_TYPES; type++)
+        BuildUnrankTable(type);
+
+    UnrankInitialized = true;
+}
+
+// Inverts N2_Index to N7_Index. As spelled out in Index5, a group of k squares
+// ranks as the complement of the colexicographic rank of its mirrored squares.
+
+static bool UnrankCombination(ZIndex rank, int k, int *squares) {
+    if (rank >= Binomial[NSQUARES][k])
+        return false;
+
+    ZIndex colex = Binomial[NSQUARES][k] - 1 - rank;
+    int x = NSQUARES;
+    for (int i = k; i > 0; i--) {
+        do
+            x--;
+        while (Binomial[x][i] > colex);
+        colex -= Binomial[x][i];
+        squares[k - i] = (NSQUARES - 1) - x;
+    }
+    return true;
+}
+
+static bool UnrankDigit(UnrankType type, ZIndex digit, int *squares) {
+    switch (type) {
+    case UNRANK_SQUARE:
+        squares[0] = digit;
+        return digit < NSQUARES;
+    case UNRANK_BP:
+        squares[0] = digit;
+        squares[1] = digit + NCOLS;
+        return digit < NSQUARES - NCOLS;
+    case UNRANK_N2:
+    case UNRANK_N3:
+    case UNRANK_N4:
+    case UNRANK_N5:
+    case UNRANK_N6:
+    case UNRANK_N7:
+        return UnrankCombination(digit, UnrankPieces[type], squares);
+    default:
+        break;
+    }
+
+    if (digit >= UnrankTableSize[type] ||
+        UnrankTables[type][digit] == UINT32_MAX)
+        return false;
+    uint32_t group = UnrankTables[type][digit];
+    for (int i = 0; i < UnrankPieces[type]; i++) {
+        squares[i] = group % NSQUARES;
+        group /= NSQUARES;
+    }
+    return true;
+}
+
+static bool UnrankIndex(const IndexLayout *layout, ZIndex index, int *pos) {
+    for (const UnrankStep *step = layout->steps; step->type != UNRANK_END;
+         step++) {
+        ZIndex radix = UnrankRadix[step->type];
+        ZIndex digit = index;
+        if (step[1].type != UNRANK_END) {
+            assert(radix != 0);
+            digit = index % radix;
+            index /= radix;
+        }
+        if (!UnrankDigit(step->type, digit, pos + step->first))
+            return false;
+    }
+    return true;
+}
+
+// Places the pieces of mb_pos on the board. A pawn on its own first row stands
+// for a pawn that has just moved two squares, which is checked to be capturable
+// en passant.
+
+static bool PlaceMBPosition(const int *mb_pos, const Piece *piece_types,
+                            int npieces, Piece pieces[NSQUARES],
+                            int *ep_square) {
+    memset(pieces, 0, NSQUARES * sizeof(pieces[0]));
+    *ep_square = 0;
+    int ep_pawn = -1;
+
+    for (int i = 0; i < npieces; i++) {
+        int sq = mb_pos[i];
+        Piece piece = piece_types[i];
+        if (piece == PAWN || piece == -PAWN) {
+            int home = piece == PAWN ? 0 : NROWS - 1;
+            if (Row(sq) == (NROWS - 1) - home)
+                return false;
+            if (Row(sq) == home) {
+                if (ep_pawn >= 0)
+                    return false;
+                int dir = piece == PAWN ? NCOLS : -NCOLS;
+                sq = SquareMake(piece == PAWN ? 3 : NROWS - 4, Column(sq));
+                ep_pawn = sq;
+                *ep_square = sq - dir;
+            }
+        }
+        if (pieces[sq] != NO_PIECE)
+            return false;
+        pieces[sq] = piece;
+    }
+
+    if (ep_pawn >= 0) {
+        Piece pawn = pieces[ep_pawn];
+        int dir = pawn == PAWN ? NCOLS : -NCOLS;
+        if (pieces[ep_pawn - dir] != NO_PIECE ||
+            pieces[ep_pawn - 2 * dir] != NO_PIECE)
+            return false;
+        bool capturable =
+            (Column(ep_pawn) > 0 && pieces[ep_pawn - 1] == -pawn) ||
+            (Column(ep_pawn) < NCOLS - 1 && pieces[ep_pawn + 1] == -pawn);
+        if (!capturable)
+            return false;
+    }
+    return true;
+}
+
+int mbeval_unrank(const int count[2][KING], PawnFileType pawn_file_type,
+                  const BishopParity bishop_parity[2], int kk_index,
+                  ZIndex index, Piece pieces[NSQUARES], int *ep_square) {
+    assert(UnrankInitialized);
+    assert(pieces != NULL);
+    assert(ep_square != NULL);
+
+    int npieces = 2;
+    for (int color = White; color <= Black; color++) {
+        for (int piece = PAWN; piece < KING; piece++)
+            npieces += count[color][piece];
+    }
+    if (npieces > MAX_PIECES_MB)
+        return TOO_MANY_PIECES;
+
+    Piece piece_types[MAX_PIECES_MB];
+    BishopParity parity[2] = {bishop_parity[White], bishop_parity[Black]};
+    int eindex = GetEndingType(count, piece_types, parity, pawn_file_type);
+    if (eindex < 0)
+        return ETYPE_NOT_MAPPED;
+
+    int mb_pos[MAX_PIECES_MB];
+    bool pawns_present = count[White][PAWN] > 0 || count[Black][PAWN] > 0;
+    if (kk_index < 0 ||
+        kk_index >= (pawns_present ? N_KINGS : N_KINGS_NOPAWNS))
+        return 1;
+    const KK_PAIR *kk =
+        pawns_present ? &KK_List[kk_index] : &KK_List_NoPawns[kk_index];
+    mb_pos[0] = kk->wk;
+    mb_pos[1] = kk->bk;
+
+    if (!UnrankIndex(&IndexLayouts[eindex], index, mb_pos) ||
+        !PlaceMBPosition(mb_pos, piece_types, npieces, pieces, ep_square))
+        return 1;
+
+    // The layouts admit positions the index functions never produce, such as
+    // non-canonical reflections, so only a position that ranks back to the
+    // same index is a real one.
+    BOARD board;
+    SetBoard(&board, pieces, White, *ep_square);
+    MbInfo mb_info;
+    if (GetMBInfo(&board, &mb_info, NULL, NULL, NULL) != 0 ||
+        mb_info.kk_index != kk_index)
+        return 1;
+
+    if (pawn_file_type == Free) {
+        for (int i = 0; i < mb_info.num_parities; i++) {
+            const ParityIndex *parity_index = &mb_info.parity_index[i];
+            if (parity_index->eptr == &IndexTable[eindex] &&
+                parity_index->index == index)
+                return 0;
+        }
+        return 1;
+    }
+
+    PawnFileType variants[2];
+    int num_variants = GetPawnFileVariants(mb_info.pawn_file_type, variants);
+    for (int i = 0; i < num_variants; i++) {
+        if (variants[i] == pawn_file_type &&
+            *PawnFileEptr(&mb_info, pawn_file_type) == &IndexTable[eindex] &&
+            *PawnFileIndex(&mb_info, pawn_file_type) == index)
+            return 0;
+    }
+    return 1;
 }
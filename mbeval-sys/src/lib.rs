@@ -1,4 +1,4 @@
-use std::ops;
+use std::{ffi::c_int, ops};
 
 include!(concat!(env!("OUT_DIR"), "/bindings.rs"));
 
@@ -9,3 +9,74 @@ impl ops::Neg for Piece {
         Piece(-self.0)
     }
 }
+
+impl MbPosition {
+    fn is_valid(&self) -> bool {
+        let mut kings = [0, 0];
+        let mut num_pieces = 0;
+        for (sq, &piece) in self.pieces.iter().enumerate() {
+            match piece.0.abs() {
+                0 => continue,
+                1 if !(8..56).contains(&sq) => return false,
+                1 | 2 | 4 | 8 | 12 => (),
+                16 => kings[usize::from(piece.0 < 0)] += 1,
+                _ => return false,
+            }
+            num_pieces += 1;
+        }
+        kings == [1, 1] && num_pieces <= MAX_PIECES_MB && self.is_valid_ep_square()
+    }
+
+    /// Whether `ep_square` is 0, or the square skipped by a pawn of the side
+    /// not to move that has just moved two squares.
+    fn is_valid_ep_square(&self) -> bool {
+        if self.ep_square == 0 {
+            return true;
+        }
+        let (skipped_rank, pawn, step) = match self.side {
+            Side::White => (5, -Piece::PAWN, 8),
+            Side::Black => (2, Piece::PAWN, -8),
+        };
+        if self.ep_square / 8 != skipped_rank {
+            return false;
+        }
+        let square = |offset: c_int| self.pieces[(self.ep_square + offset) as usize];
+        square(0) == Piece::NO_PIECE && square(step) == Piece::NO_PIECE && square(-step) == pawn
+    }
+}
+
+/// Computes the [`MbInfo`] of each position, like [`mbeval_get_mb_info`],
+/// storing its return value in `results`. Ending type resolution is shared
+/// between positions with the same material.
+///
+/// Fields that do not apply to a position are left untouched, so `infos` can
+/// be reused across batches without clearing it.
+///
+/// # Panics
+///
+/// Panics if mbeval is not initialized, if the slices have different lengths,
+/// or if a position does not have exactly one king per side, has more than
+/// [`MAX_PIECES_MB`] pieces, has an invalid piece or a pawn on the first or
+/// last rank, or has an en passant square other than 0 that is not behind a
+/// pawn of the side not to move that can have just moved two squares.
+pub fn get_mb_info_batch(positions: &[MbPosition], infos: &mut [MbInfo], results: &mut [c_int]) {
+    assert!(
+        unsafe { mbeval_is_initialized() } != 0,
+        "mbeval not initialized"
+    );
+    assert_eq!(positions.len(), infos.len());
+    assert_eq!(positions.len(), results.len());
+    assert!(
+        positions.iter().all(MbPosition::is_valid),
+        "invalid position"
+    );
+
+    unsafe {
+        mbeval_get_mb_info_batch(
+            positions.as_ptr(),
+            positions.len(),
+            infos.as_mut_ptr(),
+            results.as_mut_ptr(),
+        );
+    }
+}
@@ -0,0 +1,86 @@
+//! Checks that `get_mb_info_batch` agrees with `mbeval_get_mb_info` for each
+//! position, across mixed materials and with en passant squares.
+
+use std::mem;
+
+use mbeval_sys::{MbInfo, MbPosition, Piece, Side, get_mb_info_batch, mbeval_get_mb_info};
+
+use crate::common::{SplitMix64, ep_square, init_mbeval, random_board, summary};
+
+mod common;
+
+const BATCHES: usize = 200;
+
+const BATCH_SIZE: usize = 256;
+
+fn random_position(rng: &mut SplitMix64) -> MbPosition {
+    let (pieces, side) = random_board(rng);
+    MbPosition {
+        pieces,
+        side,
+        ep_square: ep_square(&pieces, side),
+    }
+}
+
+#[test]
+fn test_batch_matches_single() {
+    init_mbeval();
+
+    let mut rng = SplitMix64(0x6261_7463_68);
+    let mut infos: Vec<MbInfo> = vec![unsafe { mem::zeroed() }; BATCH_SIZE];
+    let mut results = vec![0; BATCH_SIZE];
+    let mut ep_positions = 0;
+
+    for _ in 0..BATCHES {
+        let positions: Vec<MbPosition> =
+            (0..BATCH_SIZE).map(|_| random_position(&mut rng)).collect();
+        get_mb_info_batch(&positions, &mut infos, &mut results);
+
+        for ((pos, info), &result) in positions.iter().zip(&infos).zip(&results) {
+            let mut expected: MbInfo = unsafe { mem::zeroed() };
+            let expected_result = unsafe {
+                mbeval_get_mb_info(pos.pieces.as_ptr(), pos.side, pos.ep_square, &mut expected)
+            };
+            assert_eq!(summary(result, info), summary(expected_result, &expected));
+            if pos.ep_square != 0 {
+                ep_positions += 1;
+            }
+        }
+    }
+
+    assert!(ep_positions > 100, "{ep_positions} en passant positions");
+}
+
+#[test]
+#[should_panic(expected = "invalid position")]
+fn test_batch_rejects_back_rank_pawn() {
+    init_mbeval();
+
+    let mut pos = MbPosition {
+        pieces: [Piece::NO_PIECE; 64],
+        side: Side::White,
+        ep_square: 0,
+    };
+    pos.pieces[4] = Piece::KING;
+    pos.pieces[60] = Piece::BLACK_KING;
+    pos.pieces[56] = Piece::PAWN;
+    let mut infos: [MbInfo; 1] = unsafe { mem::zeroed() };
+    get_mb_info_batch(&[pos], &mut infos, &mut [0]);
+}
+
+#[test]
+#[should_panic(expected = "invalid position")]
+fn test_batch_rejects_ep_square_without_pawn() {
+    init_mbeval();
+
+    let mut pos = MbPosition {
+        pieces: [Piece::NO_PIECE; 64],
+        side: Side::White,
+        ep_square: 44,
+    };
+    pos.pieces[4] = Piece::KING;
+    pos.pieces[60] = Piece::BLACK_KING;
+    pos.pieces[35] = Piece::PAWN;
+    let mut infos: [MbInfo; 1] = unsafe { mem::zeroed() };
+    get_mb_info_batch(&[pos], &mut infos, &mut [0]);
+}
@@ -0,0 +1,209 @@
+//! Checks that `mbeval_get_child_mb_info` agrees with computing the MbInfo of
+//! the position after the move from scratch, for quiet moves, captures,
+//! promotions, double pawn pushes and en passant captures.
+
+use std::mem;
+
+use mbeval_sys::{MbInfo, Piece, Side, mbeval_get_child_mb_info, mbeval_get_mb_info};
+
+use crate::common::{SplitMix64, adjacent, init_mbeval, random_board, summary};
+
+mod common;
+
+const POSITIONS: usize = 30_000;
+
+const PROMOTIONS: [Piece; 4] = [Piece::KNIGHT, Piece::BISHOP, Piece::ROOK, Piece::QUEEN];
+
+fn mb_info(board: &[Piece; 64], side: Side, ep_square: i32) -> (i32, MbInfo) {
+    let mut info: MbInfo = unsafe { mem::zeroed() };
+    let result = unsafe { mbeval_get_mb_info(board.as_ptr(), side, ep_square, &mut info) };
+    (result, info)
+}
+
+#[derive(Default)]
+struct Counts {
+    quiet: usize,
+    captures: usize,
+    promotions: usize,
+    double_pushes: usize,
+    en_passant: usize,
+}
+
+struct Checker {
+    counts: Counts,
+}
+
+impl Checker {
+    /// Plays the move on a copy of the board and compares the child MbInfo
+    /// with the one computed from scratch.
+    fn check(
+        &mut self,
+        parent: &MbInfo,
+        board: &[Piece; 64],
+        side: Side,
+        (from, to, promotion): (usize, usize, Piece),
+        ep_square: i32,
+    ) {
+        let mut child = *board;
+        let piece = child[from];
+        let en_passant = piece.0.abs() == Piece::PAWN.0 && from % 8 != to % 8 && child[to].0 == 0;
+        if en_passant {
+            child[from / 8 * 8 + to % 8] = Piece::NO_PIECE;
+            self.counts.en_passant += 1;
+        } else if child[to].0 != 0 {
+            self.counts.captures += 1;
+        } else if promotion.0 != 0 {
+            self.counts.promotions += 1;
+        } else if ep_square != 0 {
+            self.counts.double_pushes += 1;
+        } else {
+            self.counts.quiet += 1;
+        }
+        child[from] = Piece::NO_PIECE;
+        child[to] = if promotion.0 == 0 {
+            piece
+        } else {
+            Piece(promotion.0 * piece.0.signum())
+        };
+
+        let child_side = match side {
+            Side::White => Side::Black,
+            Side::Black => Side::White,
+        };
+        let mut info: MbInfo = unsafe { mem::zeroed() };
+        let result = unsafe {
+            mbeval_get_child_mb_info(
+                parent,
+                from as i32,
+                to as i32,
+                promotion,
+                child_side,
+                ep_square,
+                &mut info,
+            )
+        };
+        let (expected_result, expected_info) = mb_info(&child, child_side, ep_square);
+        assert_eq!(
+            summary(result, &info),
+            summary(expected_result, &expected_info),
+            "{board:?} {side:?} {from} -> {to} ({promotion:?})"
+        );
+    }
+
+    fn check_pawn(
+        &mut self,
+        parent: &MbInfo,
+        board: &[Piece; 64],
+        side: Side,
+        from: usize,
+        enemy_king: usize,
+    ) {
+        let (forward, last_rank, start_rank): (isize, usize, usize) = match side {
+            Side::White => (8, 7, 1),
+            Side::Black => (-8, 0, 6),
+        };
+        let own = board[from].0.signum();
+        let enemy_pawn = Piece(-own * Piece::PAWN.0);
+
+        let one = from.wrapping_add_signed(forward);
+        let promotions: &[Piece] = if one / 8 == last_rank {
+            &PROMOTIONS
+        } else {
+            &[Piece::NO_PIECE]
+        };
+
+        if board[one].0 == 0 {
+            for &promotion in promotions {
+                self.check(parent, board, side, (from, one, promotion), 0);
+            }
+
+            let two = one.wrapping_add_signed(forward);
+            if from / 8 == start_rank && board[two].0 == 0 {
+                let beside = (two % 8 > 0 && board[two - 1] == enemy_pawn)
+                    || (two % 8 < 7 && board[two + 1] == enemy_pawn);
+                let ep_square = if beside { one as i32 } else { 0 };
+                self.check(parent, board, side, (from, two, Piece::NO_PIECE), ep_square);
+            }
+        }
+
+        for to in [one.wrapping_sub(1), one + 1] {
+            if to / 8 != one / 8 || to == enemy_king {
+                continue;
+            }
+            if board[to].0.signum() == -own {
+                for &promotion in promotions {
+                    self.check(parent, board, side, (from, to, promotion), 0);
+                }
+            } else if board[to].0 == 0 {
+                // En passant, if the enemy pawn beside can have just moved
+                // two squares.
+                let behind = to.wrapping_add_signed(forward);
+                let captured = from / 8 * 8 + to % 8;
+                if board[captured] == enemy_pawn
+                    && from / 8 == (start_rank as isize + 3 * forward.signum()) as usize
+                    && board[behind].0 == 0
+                {
+                    self.check(parent, board, side, (from, to, Piece::NO_PIECE), 0);
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn test_child_mb_info() {
+    init_mbeval();
+
+    let mut rng = SplitMix64(0x6368_696c_64);
+    let mut checker = Checker {
+        counts: Counts::default(),
+    };
+    let mut parents = 0;
+
+    for _ in 0..POSITIONS {
+        let (board, side) = random_board(&mut rng);
+        let king = |king| board.iter().position(|&piece| piece == king).unwrap();
+        let (own, enemy_king) = match side {
+            Side::White => (1, king(Piece::BLACK_KING)),
+            Side::Black => (-1, king(Piece::KING)),
+        };
+
+        let (result, parent) = mb_info(&board, side, 0);
+        if result != 0 || parent.num_parities == 0 {
+            continue;
+        }
+        parents += 1;
+
+        for from in 0..64 {
+            let piece = board[from];
+            if piece.0.signum() != own {
+                continue;
+            }
+            if piece.0.abs() == Piece::PAWN.0 {
+                checker.check_pawn(&parent, &board, side, from, enemy_king);
+                continue;
+            }
+
+            // Destinations need not be reachable, only empty or enemy
+            // pieces other than the king.
+            for _ in 0..6 {
+                let to = (rng.next() % 64) as usize;
+                if to == from || board[to].0.signum() == own || to == enemy_king {
+                    continue;
+                }
+                if piece.0.abs() == Piece::KING.0 && adjacent(to, enemy_king) {
+                    continue;
+                }
+                checker.check(&parent, &board, side, (from, to, Piece::NO_PIECE), 0);
+            }
+        }
+    }
+
+    let counts = &checker.counts;
+    assert!(parents > POSITIONS / 2);
+    assert!(counts.quiet > 10_000);
+    assert!(counts.captures > 1_000);
+    assert!(counts.promotions > 100);
+    assert!(counts.double_pushes > 100);
+    assert!(counts.en_passant > 10);
+}
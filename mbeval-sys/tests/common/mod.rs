@@ -0,0 +1,181 @@
+//! Helpers shared by the integration tests.
+
+// Each test crate uses only some of the helpers.
+#![allow(dead_code)]
+
+use std::sync::Once;
+
+use mbeval_sys::{IndexType, MbInfo, PawnFileType, Piece, Side, ZIndex, mbeval_init};
+
+static INIT_MBEVAL: Once = Once::new();
+
+/// Initializes mbeval once per test binary. Tests run on parallel threads,
+/// and initializing again would release tables that other tests are reading.
+pub fn init_mbeval() {
+    INIT_MBEVAL.call_once(|| unsafe { mbeval_init() });
+}
+
+pub struct SplitMix64(pub u64);
+
+impl SplitMix64 {
+    pub fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        z ^ (z >> 31)
+    }
+
+    pub fn square(&mut self) -> usize {
+        (self.next() % 64) as usize
+    }
+}
+
+/// An `IndexTable` entry, by ending type, pawn file type and sub type.
+pub type Entry = (i32, i32, i32);
+
+pub fn entry(eptr: *const IndexType) -> Entry {
+    let index_type = unsafe { &*eptr };
+    (index_type.etype, index_type.op_type, index_type.sub_type)
+}
+
+/// The fields of info that apply to the position, with the index table entry
+/// in place of its address so that summaries can be recorded.
+pub fn summary(result: i32, info: &MbInfo) -> Vec<u64> {
+    let mut summary = vec![result as u64];
+    if result != 0 {
+        return summary;
+    }
+    summary.extend([info.kk_index as u64, info.pawn_file_type as u64]);
+    for parity_index in &info.parity_index[..info.num_parities as usize] {
+        let (etype, op_type, sub_type) = entry(parity_index.eptr);
+        summary.extend([
+            parity_index.index,
+            parity_index.bishop_parity[0] as u64,
+            parity_index.bishop_parity[1] as u64,
+            etype as u64,
+            op_type as u64,
+            sub_type as u64,
+        ]);
+    }
+    let pawn_file_indices: &[ZIndex] = match info.pawn_file_type {
+        PawnFileType::Free => &[],
+        PawnFileType::Bp11 => &[info.index_bp_11, info.index_op_11],
+        PawnFileType::Op11 => &[info.index_op_11],
+        PawnFileType::Op21 => &[info.index_op_21],
+        PawnFileType::Op12 => &[info.index_op_12],
+        PawnFileType::Op22 => &[info.index_op_22],
+        PawnFileType::Dp22 => &[info.index_dp_22, info.index_op_22],
+        PawnFileType::Op31 => &[info.index_op_31],
+        PawnFileType::Op13 => &[info.index_op_13],
+        PawnFileType::Op41 => &[info.index_op_41],
+        PawnFileType::Op14 => &[info.index_op_14],
+        PawnFileType::Op32 => &[info.index_op_32],
+        PawnFileType::Op23 => &[info.index_op_23],
+        PawnFileType::Op33 => &[info.index_op_33],
+        PawnFileType::Op42 => &[info.index_op_42],
+        PawnFileType::Op24 => &[info.index_op_24],
+    };
+    summary.extend(pawn_file_indices);
+    summary
+}
+
+/// Pieces in the order of roles in bitboards.
+const ROLES: [Piece; 6] = [
+    Piece::PAWN,
+    Piece::KNIGHT,
+    Piece::BISHOP,
+    Piece::ROOK,
+    Piece::QUEEN,
+    Piece::KING,
+];
+
+/// Whether the squares are the same or next to each other.
+pub fn adjacent(a: usize, b: usize) -> bool {
+    (a / 8).abs_diff(b / 8) <= 1 && (a % 8).abs_diff(b % 8) <= 1
+}
+
+/// A random board with up to 7 pieces besides the kings, mostly pawns, placed
+/// by [`random_board_with`], and a random side to move.
+pub fn random_board(rng: &mut SplitMix64) -> ([Piece; 64], Side) {
+    let pieces: Vec<Piece> = (0..rng.next() % 8)
+        .map(|_| {
+            let r = rng.next();
+            let piece = ROLES[((r >> 1) % 7).saturating_sub(2) as usize];
+            if r % 2 == 0 { piece } else { -piece }
+        })
+        .collect();
+    let side = if rng.next() % 2 == 0 {
+        Side::White
+    } else {
+        Side::Black
+    };
+    (random_board_with(rng, &pieces), side)
+}
+
+/// A board with the kings on random squares that are not adjacent, and the
+/// pieces on random empty squares. Pawns are mostly crowded onto the two
+/// central files, to get opposing and doubled pawns and en passant.
+pub fn random_board_with(rng: &mut SplitMix64, pieces: &[Piece]) -> [Piece; 64] {
+    let mut board = [Piece::NO_PIECE; 64];
+    let wk = rng.square();
+    let bk = loop {
+        let bk = rng.square();
+        if !adjacent(wk, bk) {
+            break bk;
+        }
+    };
+    board[wk] = Piece::KING;
+    board[bk] = Piece::BLACK_KING;
+
+    for &piece in pieces {
+        let sq = loop {
+            let sq = if piece == Piece::PAWN || piece == Piece::BLACK_PAWN {
+                let r = rng.next();
+                let file = if r & 3 != 0 {
+                    3 + (r >> 2) % 2
+                } else {
+                    (r >> 2) % 8
+                };
+                (8 * (1 + (r >> 8) % 6) + file) as usize
+            } else {
+                rng.square()
+            };
+            if board[sq] == Piece::NO_PIECE {
+                break sq;
+            }
+        };
+        board[sq] = piece;
+    }
+    board
+}
+
+/// The occupancy masks of the board by side and role, as taken by
+/// `mbeval_get_mb_info_bitboards`.
+pub fn bitboards(board: &[Piece; 64]) -> [[u64; 6]; 2] {
+    let mut bitboards = [[0; 6]; 2];
+    for (sq, piece) in board.iter().enumerate() {
+        if let Some(role) = ROLES.iter().position(|role| role.0 == piece.0.abs()) {
+            bitboards[usize::from(piece.0 < 0)][role] |= 1 << sq;
+        }
+    }
+    bitboards
+}
+
+/// The en passant square of the first pawn of the side not to move that can
+/// have just moved two squares and has an enemy pawn beside it, or 0.
+pub fn ep_square(pieces: &[Piece; 64], side: Side) -> i32 {
+    let (pawn, rank, step) = match side {
+        Side::White => (Piece::BLACK_PAWN, 4, 8),
+        Side::Black => (Piece::PAWN, 3, -8),
+    };
+    (8 * rank..8 * rank + 8)
+        .find(|&sq: &i32| {
+            let beside = |sq: i32| pieces[sq as usize] == -pawn;
+            pieces[sq as usize] == pawn
+                && pieces[(sq + step) as usize] == Piece::NO_PIECE
+                && pieces[(sq + 2 * step) as usize] == Piece::NO_PIECE
+                && ((sq % 8 > 0 && beside(sq - 1)) || (sq % 8 < 7 && beside(sq + 1)))
+        })
+        .map_or(0, |sq| sq + step)
+}
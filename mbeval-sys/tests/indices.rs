@@ -0,0 +1,559 @@
+//! Equivalence test for the index functions in `IndexTable`.
+//!
+//! Every material signature with up to 7 pieces besides the kings is sampled at
+//! pseudo-random placements, with pawns crowded onto the two central files so
+//! that opposing and doubled pawn structures come up. Samples where a pawn can have
+//! just moved two squares are also checked with the en passant square. Checking
+//! every position is out of reach, at up to about 10^15 positions per
+//! signature. Instead, the indices computed by each `IndexTable` entry are
+//! folded into a digest per entry, recorded with the original mbeval.c index
+//! functions, so any change to a ranker that is not bit-identical shows up here
+//! along with the entries it affects. The rank tables of 2, 3 and 4 identical
+//! pieces are compared with their arithmetic replacements on every index,
+//! through the check-ranking feature. The same samples check that
+//! `mbeval_unrank` inverts every index.
+
+use std::{collections::HashMap, iter, mem};
+
+use mbeval_sys::{
+    BishopParity, IndexType, MAX_PIECES_MB, MbInfo, PawnFileType, Piece, Side, ZIndex,
+    mbeval_get_mb_info, mbeval_init_unrank, mbeval_unrank,
+};
+
+use crate::common::{Entry, SplitMix64, entry, ep_square, init_mbeval, random_board_with};
+
+mod common;
+
+const ALL_ONES: ZIndex = !0;
+
+const PIECES: [Piece; 10] = [
+    Piece::PAWN,
+    Piece::KNIGHT,
+    Piece::BISHOP,
+    Piece::ROOK,
+    Piece::QUEEN,
+    Piece::BLACK_PAWN,
+    Piece::BLACK_KNIGHT,
+    Piece::BLACK_BISHOP,
+    Piece::BLACK_ROOK,
+    Piece::BLACK_QUEEN,
+];
+
+const MAX_NON_KING_PIECES: usize = MAX_PIECES_MB as usize - 2;
+
+/// Positions per material signature with `MAX_NON_KING_PIECES`, doubling for
+/// each piece less, so that the rare pawn structures and bishop parities of
+/// small signatures are covered too.
+const SAMPLES: usize = 8;
+
+/// Samples for which `mbeval_get_mb_info` fails, and pawn file type variants
+/// of samples that have no ending type, recorded with the original index
+/// functions.
+const EXPECTED_FAILURES: usize = 1_024;
+const EXPECTED_MISSING_VARIANTS: usize = 3_787;
+
+/// Indices of the samples that `mbeval_unrank` inverts, of those that are
+/// broken by `parity_on_other_pieces`, and of the inverted indices with an en
+/// passant square.
+const EXPECTED_UNRANKED: usize = 633_594;
+const EXPECTED_BROKEN: usize = 5;
+const EXPECTED_UNRANKED_EP: usize = 1_275;
+
+/// Digests of the samples indexed by each `IndexTable` entry, identified by
+/// its ending type, pawn file type and sub type, recorded with the original
+/// index functions.
+#[rustfmt::skip]
+const EXPECTED_DIGESTS: [((i32, i32, i32), u64); NUM_INDEX_TYPES] = [
+    ((1, 0, 0), 0x6cf2_4559_159e_b029),
+    ((2, 0, 0), 0xa2a3_ac1d_2346_64a0),
+    ((2, 0, 1100), 0x106a_56a3_09e3_f9fd),
+    ((3, 0, 0), 0x5174_43b1_386d_4d80),
+    ((3, 0, 1100), 0x9ae1_accd_9c4f_de09),
+    ((4, 0, 0), 0xb058_967b_b442_53ad),
+    ((5, 0, 0), 0x6164_4c33_922a_d8bd),
+    ((6, 0, 0), 0x07f4_af01_f355_67bd),
+    ((7, 0, 0), 0x362b_f5f7_741d_75b9),
+    ((11, 0, 0), 0x1a11_ee08_61b1_3545),
+    ((11, 1, 0), 0x93bf_f9df_0dde_7ff9),
+    ((11, 2, 0), 0xd7b5_dbbb_7dcf_2f41),
+    ((12, 0, 0), 0xc79e_c56b_48be_cba0),
+    ((12, 4, 0), 0x57b5_01ae_4bff_d36f),
+    ((13, 0, 0), 0x36fc_61e6_fad4_bfb4),
+    ((13, 8, 0), 0xf699_010e_c613_226a),
+    ((14, 0, 0), 0x6708_4468_0dbe_0da4),
+    ((15, 0, 0), 0x86d0_99f3_afa5_5b79),
+    ((16, 0, 0), 0x14eb_eaf4_7b5f_aa15),
+    ((21, 0, 0), 0xb6a0_30cd_d4d8_c492),
+    ((21, 3, 0), 0x3779_a38d_e18b_8fd9),
+    ((22, 0, 0), 0xaef1_1005_093f_4d94),
+    ((22, 5, 0), 0x83f6_315d_a158_1b44),
+    ((22, 6, 0), 0x05ac_8c07_b2c3_79fe),
+    ((23, 0, 0), 0x6f2f_bfd7_ae4a_029e),
+    ((24, 0, 0), 0x0333_bfd5_a005_b457),
+    ((25, 0, 0), 0x44fb_bcae_d38f_10dc),
+    ((31, 0, 0), 0xf121_eea3_1a0a_b9f5),
+    ((31, 7, 0), 0xbd89_7049_c306_b760),
+    ((32, 0, 0), 0xd7dc_8356_f173_bb42),
+    ((33, 0, 0), 0xf960_dd1c_2bfa_5a3b),
+    ((34, 0, 0), 0xa7e0_f65b_195a_0243),
+    ((41, 0, 0), 0xf53b_c761_c93d_26f5),
+    ((42, 0, 0), 0xc6fe_5ac7_edcb_4bdd),
+    ((43, 0, 0), 0x6c71_75f2_dfdd_25e8),
+    ((51, 0, 0), 0xe0f2_0c14_5083_8389),
+    ((52, 0, 0), 0x2a08_8e70_f757_3832),
+    ((61, 0, 0), 0x7400_5bd4_4718_8f0d),
+    ((111, 0, 0), 0x0163_7e0a_d69d_7065),
+    ((111, 1, 0), 0xea24_f2fd_35bc_70e8),
+    ((111, 2, 0), 0x08e9_cd51_c01c_2f30),
+    ((112, 0, 0), 0x243e_2472_0f48_97f7),
+    ((112, 1, 0), 0x8558_a452_3c5f_43d6),
+    ((112, 2, 0), 0x12e3_8274_4fad_1b01),
+    ((113, 0, 0), 0x6081_4132_df79_be69),
+    ((113, 1, 0), 0xfa5b_74df_a807_6c19),
+    ((113, 2, 0), 0x6bee_67c5_4082_1d63),
+    ((114, 0, 0), 0x1a56_b115_b983_9c09),
+    ((114, 1, 0), 0xeba3_d4cc_2726_1634),
+    ((114, 2, 0), 0x06a2_0ac1_6738_3db9),
+    ((115, 0, 0), 0x8125_eac4_63b4_9ce9),
+    ((121, 0, 0), 0x9630_2e17_4290_db7a),
+    ((121, 4, 0), 0x05c5_0218_2af1_63bf),
+    ((122, 0, 0), 0x2bfd_2375_31fe_1c42),
+    ((122, 4, 0), 0xdd9c_acd3_3e25_6697),
+    ((123, 0, 0), 0x37f2_b3f9_e4d8_2fa7),
+    ((123, 4, 0), 0xfc95_e5bb_7e99_f30e),
+    ((124, 0, 0), 0x6f7a_8b80_7959_9eb6),
+    ((131, 0, 0), 0xd145_294f_1d3c_99fb),
+    ((131, 8, 0), 0xfe3c_f356_deb7_9f1d),
+    ((132, 0, 0), 0x5996_5921_fbe2_49e5),
+    ((132, 8, 0), 0xc96b_2583_f4ff_66e0),
+    ((133, 0, 0), 0x1517_475e_3b47_c963),
+    ((141, 0, 0), 0x4fc8_8034_1e01_cdea),
+    ((142, 0, 0), 0xd982_0870_6b57_7235),
+    ((151, 0, 0), 0x042a_9f04_e83e_357d),
+    ((211, 0, 0), 0x583f_97e0_cb54_92d4),
+    ((211, 3, 0), 0xa685_85e1_8bad_88a8),
+    ((212, 0, 0), 0x331d_f758_be43_888a),
+    ((212, 3, 0), 0xfa77_ec4e_34e6_1a2f),
+    ((213, 0, 0), 0x30eb_15f0_c8bb_fbba),
+    ((213, 3, 0), 0xc0e7_b1e7_7574_bd63),
+    ((214, 0, 0), 0x77c4_c0fe_cb40_59ef),
+    ((221, 0, 0), 0x036f_2234_c7f6_47f8),
+    ((221, 5, 0), 0x646b_c35d_d1c4_aa9d),
+    ((221, 6, 0), 0x9d7e_69a4_9705_df9b),
+    ((222, 0, 0), 0xb6ee_9ef2_66e3_3627),
+    ((222, 5, 0), 0x1da8_19e6_9e2d_8ec4),
+    ((222, 6, 0), 0xc52f_23b6_29c9_01a8),
+    ((223, 0, 0), 0xb19c_b353_3384_c56e),
+    ((223, 0, 1000), 0xf251_7da9_8f77_32be),
+    ((223, 0, 1100), 0xc716_6c97_03eb_e654),
+    ((223, 6, 0), 0x298f_9501_199a_894e),
+    ((231, 0, 0), 0x15e6_8f65_f62e_9457),
+    ((232, 0, 0), 0x4a91_dc97_cf08_9ed1),
+    ((241, 0, 0), 0x6620_6d39_2ee1_01dd),
+    ((311, 0, 0), 0xc968_58a0_f10d_3c21),
+    ((311, 7, 0), 0x486f_07d7_aa84_966a),
+    ((312, 0, 0), 0x938c_f3f9_422a_bac0),
+    ((312, 7, 0), 0xbc90_d2bf_c975_133e),
+    ((313, 0, 0), 0x4e8a_a7e4_1be9_7f79),
+    ((321, 0, 0), 0xbc01_6b57_82e7_68c5),
+    ((322, 0, 0), 0xdece_956b_9153_9b8a),
+    ((322, 0, 10), 0x227a_28ab_b615_e79f),
+    ((322, 0, 11), 0x1aca_f9ee_6789_f530),
+    ((331, 0, 0), 0x0abc_6bed_c36b_8144),
+    ((331, 0, 20), 0x9186_ecb4_9abb_55fe),
+    ((331, 0, 21), 0x316d_86fa_7d06_c043),
+    ((411, 0, 0), 0x868f_454f_4dc6_5a4d),
+    ((412, 0, 0), 0xe345_5895_f6d1_729b),
+    ((421, 0, 0), 0x95c0_7909_42fa_b806),
+    ((421, 0, 10), 0xc6c8_c340_04ac_ff02),
+    ((421, 0, 11), 0x02d6_ebd3_8250_2b61),
+    ((511, 0, 0), 0x6785_54e2_d0fd_e911),
+    ((1111, 0, 0), 0xed22_7c2a_6a65_a055),
+    ((1111, 1, 0), 0x7970_82af_e01a_9f37),
+    ((1111, 2, 0), 0xd154_ce4e_aa51_512d),
+    ((1112, 0, 0), 0xd130_2a27_2698_066e),
+    ((1112, 1, 0), 0x5a81_acdf_f889_a8ed),
+    ((1112, 2, 0), 0xa7d8_93d4_5ec0_52a1),
+    ((1113, 0, 0), 0x7a27_dea9_f206_68e1),
+    ((1113, 1, 0), 0x02d9_da30_379a_cffb),
+    ((1113, 2, 0), 0x4f1a_2e2b_9acd_fcea),
+    ((1114, 0, 0), 0x3780_6c43_655f_5f6d),
+    ((1121, 0, 0), 0x91ec_863d_c1be_e869),
+    ((1121, 1, 0), 0x4d31_da6e_d124_02e3),
+    ((1121, 2, 0), 0x44f4_445d_89d7_e8eb),
+    ((1122, 0, 0), 0xb847_7fd1_e538_1a78),
+    ((1122, 1, 0), 0x7cc9_26a3_d8a8_73b4),
+    ((1122, 2, 0), 0x0b9b_0869_f658_fbd4),
+    ((1123, 0, 0), 0xdccc_5e2f_68fc_d8a7),
+    ((1131, 0, 0), 0xad93_d8c8_bfee_1f69),
+    ((1131, 1, 0), 0x958a_82c9_6003_6069),
+    ((1131, 2, 0), 0x35d6_23b4_b8e3_abff),
+    ((1132, 0, 0), 0x96e9_9d76_5784_f39b),
+    ((1141, 0, 0), 0xe344_8ca3_56a6_7275),
+    ((1211, 0, 0), 0x0025_7087_f1b9_90bb),
+    ((1211, 4, 0), 0xfe59_17fd_4254_d67f),
+    ((1212, 0, 0), 0x53b3_ae02_0a96_7a56),
+    ((1212, 4, 0), 0x8c49_8dd2_da03_174e),
+    ((1213, 0, 0), 0xbc92_1a7e_600f_6c64),
+    ((1221, 0, 0), 0xfaec_0b00_9863_da0c),
+    ((1221, 4, 0), 0x0d0f_1970_8d73_654f),
+    ((1222, 0, 0), 0x875a_2029_ff29_bca2),
+    ((1231, 0, 0), 0x1ab5_638a_6390_b048),
+    ((1311, 0, 0), 0xe55e_ec60_001e_866e),
+    ((1311, 8, 0), 0xd161_2d72_3bc8_bd48),
+    ((1312, 0, 0), 0xc66d_1d24_a2af_907b),
+    ((1312, 0, 10), 0xbd2b_1f3b_692b_90b9),
+    ((1312, 0, 11), 0xd81b_50c7_2964_b3a7),
+    ((1321, 0, 0), 0x1109_9821_0025_ee24),
+    ((1411, 0, 0), 0xa455_2e86_6f98_f7c5),
+    ((2111, 0, 0), 0x403e_2b0d_a5c2_2094),
+    ((2111, 3, 0), 0x72f1_0372_7e3d_874a),
+    ((2112, 0, 0), 0x80c2_d9ed_3087_9915),
+    ((2112, 3, 0), 0x305d_c3e3_b639_9bab),
+    ((2113, 0, 0), 0x42b1_d94e_7ebb_4121),
+    ((2121, 0, 0), 0x096a_eca2_b0e5_fc84),
+    ((2121, 3, 0), 0xa59e_c75d_a552_f374),
+    ((2122, 0, 0), 0xb14a_3920_f4a1_0fc7),
+    ((2131, 0, 0), 0xf38b_2c6b_6724_1235),
+    ((2211, 0, 0), 0xe96f_937a_bbc4_ead3),
+    ((2211, 0, 1000), 0x6d26_c0f8_96da_5cdd),
+    ((2211, 0, 1100), 0xbc00_36bb_36e8_08bc),
+    ((2211, 5, 0), 0x14c1_16a4_20b9_3ac4),
+    ((2211, 6, 0), 0x1dd8_9209_5e95_e43b),
+    ((2212, 0, 0), 0x8214_b14e_99f9_52cb),
+    ((2212, 6, 0), 0x0ace_7de3_8d29_01c6),
+    ((2221, 0, 0), 0x160c_6177_055e_1356),
+    ((2221, 0, 1030), 0x1807_e499_191b_f523),
+    ((2221, 0, 1130), 0x1fb1_618b_8dff_71f2),
+    ((2221, 0, 1131), 0xa37d_cada_5795_dd7e),
+    ((2221, 6, 0), 0x4efc_e98f_03f0_caec),
+    ((2311, 0, 0), 0x6fc7_0eb8_a7ad_b948),
+    ((3111, 0, 0), 0x105d_10e2_2b93_a0ac),
+    ((3111, 7, 0), 0x061a_a150_3a8a_aabc),
+    ((3112, 0, 0), 0x65d9_b745_8c7e_e2fc),
+    ((3121, 0, 0), 0xac60_2ea0_15b9_ee16),
+    ((3121, 0, 1100), 0x1657_a2af_c5bd_034d),
+    ((3121, 0, 1110), 0xf13a_237a_2023_4ae2),
+    ((3121, 0, 1111), 0x2d80_5104_d8bd_e044),
+    ((3211, 0, 0), 0xff43_c8bf_425d_0d5d),
+    ((4111, 0, 0), 0x1d8f_f62d_1226_0a0e),
+    ((11111, 0, 0), 0xea41_623b_4a31_2d11),
+    ((11111, 1, 0), 0x9025_2498_9257_2066),
+    ((11111, 2, 0), 0x3b3a_352c_b708_cc58),
+    ((11112, 0, 0), 0x77bb_af01_4d76_71c3),
+    ((11112, 1, 0), 0x9627_7191_2d0d_17ba),
+    ((11112, 2, 0), 0x45dd_c92e_711d_3533),
+    ((11113, 0, 0), 0x205d_af3b_69ef_a9f0),
+    ((11121, 0, 0), 0x9392_2f77_ca82_7aff),
+    ((11121, 1, 0), 0x4703_2ba5_1fcc_7815),
+    ((11121, 2, 0), 0x9554_cb4b_2a48_2f70),
+    ((11122, 0, 0), 0x4a8c_280f_8be8_67af),
+    ((11131, 0, 0), 0x7e8c_d35a_a71a_cd5b),
+    ((11211, 0, 0), 0xe670_6831_06de_e003),
+    ((11211, 1, 0), 0xf50d_54ae_882d_8e73),
+    ((11211, 2, 0), 0xe248_6df1_3f86_df85),
+    ((11212, 0, 0), 0x86a7_9834_bc9b_4ec8),
+    ((11221, 0, 0), 0x2649_0757_a121_53c3),
+    ((11311, 0, 0), 0xd43f_f549_e396_11ee),
+    ((12111, 0, 0), 0x2a32_0326_99fd_6bf9),
+    ((12111, 4, 0), 0xdfe8_5416_50f3_9cf0),
+    ((12112, 0, 0), 0x8d0e_357f_1f88_d9cf),
+    ((12121, 0, 0), 0xd686_ed52_8a5c_ab9a),
+    ((12211, 0, 0), 0xa139_cf96_244c_973b),
+    ((13111, 0, 0), 0xfc73_4c0a_ae77_fda6),
+    ((21111, 0, 0), 0x8557_34d7_66c9_0c70),
+    ((21111, 3, 0), 0xc59c_d74d_b7b9_d712),
+    ((21112, 0, 0), 0xe33a_599e_b3a1_9e57),
+    ((21121, 0, 0), 0xed8c_ccad_484a_5da2),
+    ((21211, 0, 0), 0xcc72_5906_9877_9602),
+    ((22111, 0, 0), 0xbea6_ade8_f724_2101),
+    ((22111, 6, 0), 0x64a4_c5b6_0232_b760),
+    ((31111, 0, 0), 0xebcc_04ad_3289_264e),
+    ((111111, 0, 0), 0x64da_249b_4660_4acd),
+    ((111111, 1, 0), 0x204b_642d_72c6_38d8),
+    ((111111, 2, 0), 0x64a1_853b_818e_a41c),
+    ((111112, 0, 0), 0xb41c_e3b6_7aec_1285),
+    ((111121, 0, 0), 0x8ad6_5be5_15c0_06ba),
+    ((111211, 0, 0), 0xb735_e3bc_cae2_a211),
+    ((112111, 0, 0), 0x9dac_15f7_0023_1e67),
+    ((121111, 0, 0), 0x4861_0218_d25d_1a47),
+    ((211111, 0, 0), 0x0679_09ad_4365_d954),
+    ((1111111, 0, 0), 0x57e3_defc_bfb1_bb89),
+];
+
+/// Number of entries in `IndexTable`.
+const NUM_INDEX_TYPES: usize = 215;
+
+/// Index and ending type of a table variant with blocked or opposing pawns.
+fn variant(info: &MbInfo, pawn_file_type: PawnFileType) -> (ZIndex, *const IndexType) {
+    match pawn_file_type {
+        PawnFileType::Free => unreachable!(),
+        PawnFileType::Bp11 => (info.index_bp_11, info.eptr_bp_11),
+        PawnFileType::Op11 => (info.index_op_11, info.eptr_op_11),
+        PawnFileType::Op21 => (info.index_op_21, info.eptr_op_21),
+        PawnFileType::Op12 => (info.index_op_12, info.eptr_op_12),
+        PawnFileType::Op22 => (info.index_op_22, info.eptr_op_22),
+        PawnFileType::Dp22 => (info.index_dp_22, info.eptr_dp_22),
+        PawnFileType::Op31 => (info.index_op_31, info.eptr_op_31),
+        PawnFileType::Op13 => (info.index_op_13, info.eptr_op_13),
+        PawnFileType::Op41 => (info.index_op_41, info.eptr_op_41),
+        PawnFileType::Op14 => (info.index_op_14, info.eptr_op_14),
+        PawnFileType::Op32 => (info.index_op_32, info.eptr_op_32),
+        PawnFileType::Op23 => (info.index_op_23, info.eptr_op_23),
+        PawnFileType::Op33 => (info.index_op_33, info.eptr_op_33),
+        PawnFileType::Op42 => (info.index_op_42, info.eptr_op_42),
+        PawnFileType::Op24 => (info.index_op_24, info.eptr_op_24),
+    }
+}
+
+/// Index of the table variant in info, or `ALL_ONES` if it does not apply.
+fn table_index(
+    info: &MbInfo,
+    pawn_file_type: PawnFileType,
+    bishop_parity: [BishopParity; 2],
+) -> ZIndex {
+    if pawn_file_type != PawnFileType::Free {
+        return match (info.pawn_file_type, pawn_file_type) {
+            (PawnFileType::Bp11, PawnFileType::Op11) | (PawnFileType::Dp22, PawnFileType::Op22) => {
+                variant(info, pawn_file_type).0
+            }
+            (found, wanted) if found == wanted => variant(info, pawn_file_type).0,
+            _ => ALL_ONES,
+        };
+    }
+    info.parity_index[..info.num_parities as usize]
+        .iter()
+        .find(|parity_index| parity_index.bishop_parity == bishop_parity)
+        .map_or(ALL_ONES, |parity_index| parity_index.index)
+}
+
+/// Whether the index of a table with a white bishop parity is broken. The
+/// index functions of these tables, with sub types from 1000, rank the group
+/// at mb position 2 by parity. For some materials, like those of
+/// `Index3121_1100` and `Index223_1000`, that group is queens rather than
+/// bishops, and the index of a position whose queens are not on squares of
+/// the parity ranks no position.
+fn parity_on_other_pieces(info: &MbInfo, eptr: *const IndexType) -> bool {
+    entry(eptr).2 >= 1000 && info.mb_piece_types[2] != Piece::BISHOP
+}
+
+struct Checker {
+    rng: SplitMix64,
+    digests: HashMap<Entry, u64>,
+    failures: usize,
+    missing_variants: usize,
+    unrank: bool,
+    /// Indices passed to `mbeval_unrank`, those that round-tripped, those
+    /// broken by `parity_on_other_pieces`, and those that round-tripped with
+    /// an en passant square.
+    tried: usize,
+    unranked: usize,
+    broken: usize,
+    unranked_ep: usize,
+}
+
+impl Checker {
+    fn fold(&mut self, eptr: *const IndexType, values: &[u64]) {
+        let digest = self
+            .digests
+            .entry(entry(eptr))
+            .or_insert(0xcbf2_9ce4_8422_2325);
+        for &value in values {
+            // FNV-1a over whole words
+            *digest = (*digest ^ value).wrapping_mul(0x100_0000_01b3);
+        }
+    }
+
+    fn fold_variant(&mut self, info: &MbInfo, pawn_file_type: PawnFileType) {
+        let (index, eptr) = variant(info, pawn_file_type);
+        if eptr.is_null() {
+            self.missing_variants += 1;
+            return;
+        }
+        self.fold(eptr, &[info.kk_index as u64, index]);
+        if index != ALL_ONES {
+            self.check_unrank(info, eptr, pawn_file_type, [BishopParity::None; 2], index);
+        }
+    }
+
+    fn check_unrank(
+        &mut self,
+        info: &MbInfo,
+        eptr: *const IndexType,
+        pawn_file_type: PawnFileType,
+        bishop_parity: [BishopParity; 2],
+        index: ZIndex,
+    ) {
+        if !self.unrank {
+            return;
+        }
+        self.tried += 1;
+
+        let mut board = [Piece::NO_PIECE; 64];
+        let mut ep_square = 0;
+        let result = unsafe {
+            mbeval_unrank(
+                info.piece_type_count.as_ptr(),
+                pawn_file_type,
+                bishop_parity.as_ptr(),
+                info.kk_index,
+                index,
+                board.as_mut_ptr(),
+                &mut ep_square,
+            )
+        };
+        if result == 1 && parity_on_other_pieces(info, eptr) {
+            self.broken += 1;
+            return;
+        }
+        assert_eq!(
+            result,
+            0,
+            "{:?} index {index} of kk_index {} is not broken",
+            entry(eptr),
+            info.kk_index
+        );
+
+        let mut unranked: MbInfo = unsafe { mem::zeroed() };
+        let result =
+            unsafe { mbeval_get_mb_info(board.as_ptr(), Side::White, ep_square, &mut unranked) };
+        assert_eq!(result, 0);
+        assert_eq!(unranked.piece_type_count, info.piece_type_count);
+        assert_eq!(unranked.kk_index, info.kk_index);
+        assert_eq!(table_index(&unranked, pawn_file_type, bishop_parity), index);
+        self.unranked += 1;
+        if ep_square != 0 {
+            self.unranked_ep += 1;
+        }
+    }
+
+    fn signatures(&mut self, counts: &mut [usize; PIECES.len()], piece: usize, left: usize) {
+        if piece == PIECES.len() {
+            self.sample(counts);
+            return;
+        }
+        for count in 0..=left {
+            counts[piece] = count;
+            self.signatures(counts, piece + 1, left - count);
+        }
+        counts[piece] = 0;
+    }
+
+    fn sample(&mut self, counts: &[usize; PIECES.len()]) {
+        let size: usize = counts.iter().sum();
+        let pieces: Vec<Piece> = PIECES
+            .iter()
+            .zip(counts)
+            .flat_map(|(&piece, &count)| iter::repeat_n(piece, count))
+            .collect();
+
+        for s in 0..SAMPLES << (MAX_NON_KING_PIECES - size) {
+            let board = random_board_with(&mut self.rng, &pieces);
+            let side = if s % 2 == 0 { Side::White } else { Side::Black };
+            self.check_position(&board, side, 0);
+            let ep_square = ep_square(&board, side);
+            if ep_square != 0 {
+                self.check_position(&board, side, ep_square);
+            }
+        }
+    }
+
+    fn check_position(&mut self, board: &[Piece; 64], side: Side, ep_square: i32) {
+        let mut info: MbInfo = unsafe { mem::zeroed() };
+        let result = unsafe { mbeval_get_mb_info(board.as_ptr(), side, ep_square, &mut info) };
+        if result != 0 {
+            self.failures += 1;
+            return;
+        }
+
+        for parity_index in &info.parity_index[..info.num_parities as usize] {
+            self.fold(
+                parity_index.eptr,
+                &[
+                    info.kk_index as u64,
+                    parity_index.index,
+                    parity_index.bishop_parity[0] as u64,
+                    parity_index.bishop_parity[1] as u64,
+                ],
+            );
+            self.check_unrank(
+                &info,
+                parity_index.eptr,
+                PawnFileType::Free,
+                parity_index.bishop_parity,
+                parity_index.index,
+            );
+        }
+
+        match info.pawn_file_type {
+            PawnFileType::Free => (),
+            PawnFileType::Bp11 => {
+                self.fold_variant(&info, PawnFileType::Bp11);
+                self.fold_variant(&info, PawnFileType::Op11);
+            }
+            PawnFileType::Dp22 => {
+                self.fold_variant(&info, PawnFileType::Dp22);
+                self.fold_variant(&info, PawnFileType::Op22);
+            }
+            pawn_file_type => self.fold_variant(&info, pawn_file_type),
+        }
+    }
+}
+
+fn check_samples(unrank: bool) -> Checker {
+    init_mbeval();
+    if unrank {
+        unsafe { mbeval_init_unrank() };
+    }
+
+    let mut checker = Checker {
+        rng: SplitMix64(0x6d62_6576_616c),
+        digests: HashMap::new(),
+        failures: 0,
+        missing_variants: 0,
+        unrank,
+        tried: 0,
+        unranked: 0,
+        broken: 0,
+        unranked_ep: 0,
+    };
+    checker.signatures(&mut [0; PIECES.len()], 0, MAX_NON_KING_PIECES);
+    checker
+}
+
+#[test]
+fn test_indices_match_reference() {
+    let checker = check_samples(false);
+
+    assert_eq!(checker.failures, EXPECTED_FAILURES);
+    assert_eq!(checker.missing_variants, EXPECTED_MISSING_VARIANTS);
+    assert_eq!(checker.digests.len(), NUM_INDEX_TYPES);
+    let mismatches: Vec<String> = EXPECTED_DIGESTS
+        .iter()
+        .filter_map(|&(entry, expected)| match checker.digests.get(&entry) {
+            Some(&digest) if digest == expected => None,
+            Some(&digest) => Some(format!("{entry:?}: {digest:#x}, expected {expected:#x}")),
+            None => Some(format!("{entry:?}: not reached")),
+        })
+        .collect();
+    assert!(
+        mismatches.is_empty(),
+        "indices differ for IndexTable entries:\n{}",
+        mismatches.join("\n")
+    );
+}
+
+#[test]
+fn test_unrank_inverts_indices() {
+    let checker = check_samples(true);
+
+    assert_eq!(
+        (checker.unranked, checker.broken, checker.tried),
+        (
+            EXPECTED_UNRANKED,
+            EXPECTED_BROKEN,
+            EXPECTED_UNRANKED + EXPECTED_BROKEN
+        )
+    );
+    assert_eq!(checker.unranked_ep, EXPECTED_UNRANKED_EP);
+}
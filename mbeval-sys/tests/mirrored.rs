@@ -0,0 +1,70 @@
+//! Checks that `mbeval_get_mb_info_mirrored` agrees with computing the MbInfo
+//! of the position and of its colour-mirrored counterpart separately.
+
+use std::{mem, ptr};
+
+use mbeval_sys::{MbInfo, Side, mbeval_get_mb_info_bitboards, mbeval_get_mb_info_mirrored};
+
+use crate::common::{SplitMix64, bitboards, ep_square, init_mbeval, random_board, summary};
+
+mod common;
+
+const POSITIONS: usize = 100_000;
+
+fn mb_info(bitboards: &[[u64; 6]; 2], side: Side, ep_square: i32) -> Vec<u64> {
+    let mut info: MbInfo = unsafe { mem::zeroed() };
+    let result =
+        unsafe { mbeval_get_mb_info_bitboards(bitboards.as_ptr(), side, ep_square, &mut info) };
+    summary(result, &info)
+}
+
+#[test]
+fn test_mirrored_mb_info() {
+    init_mbeval();
+
+    let mut rng = SplitMix64(0x6d69_7272_6f72);
+    let mut pawn_file_types = 0_u32;
+
+    for _ in 0..POSITIONS {
+        let (board, side) = random_board(&mut rng);
+        let bitboards = bitboards(&board);
+        let ep_square = ep_square(&board, side);
+
+        let mut infos: [MbInfo; 2] = unsafe { mem::zeroed() };
+        let mut results = [0; 2];
+        unsafe {
+            mbeval_get_mb_info_mirrored(
+                bitboards.as_ptr(),
+                side,
+                ep_square,
+                None,
+                ptr::null_mut(),
+                ptr::null_mut(),
+                infos.as_mut_ptr(),
+                results.as_mut_ptr(),
+            )
+        };
+
+        let mirrored_bitboards = [
+            bitboards[1].map(u64::swap_bytes),
+            bitboards[0].map(u64::swap_bytes),
+        ];
+        let mirrored_side = match side {
+            Side::White => Side::Black,
+            Side::Black => Side::White,
+        };
+        let mirrored_ep_square = if ep_square > 0 { ep_square ^ 56 } else { 0 };
+
+        assert_eq!(
+            summary(results[0], &infos[0]),
+            mb_info(&bitboards, side, ep_square)
+        );
+        assert_eq!(
+            summary(results[1], &infos[1]),
+            mb_info(&mirrored_bitboards, mirrored_side, mirrored_ep_square)
+        );
+        pawn_file_types |= 1 << infos[1].pawn_file_type as u32;
+    }
+
+    assert!(pawn_file_types.count_ones() > 8);
+}
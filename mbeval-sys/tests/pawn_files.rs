@@ -0,0 +1,113 @@
+//! Equivalence test for the pawn file type of positions with up to three pawns
+//! on one side and one on the other, or two on each side.
+//!
+//! Every placement of the pawns on the second to seventh rank is classified,
+//! once without and once with each legal en passant square. The pawn file type
+//! and the indices of each position are folded into a digest that was recorded
+//! with the original classification by probing the opposing pawn tables.
+
+use std::{collections::HashSet, mem};
+
+use mbeval_sys::{MbInfo, PawnFileType, Piece, Side, mbeval_get_mb_info};
+
+use crate::common::{init_mbeval, summary};
+
+mod common;
+
+const EXPECTED_DIGEST: u64 = 0x372b_342d_4f06_1e41;
+
+/// Pawn counts (white, black) whose pawn file type depends on opposing pawns.
+const PAWN_COUNTS: [(usize, usize); 6] = [(1, 1), (2, 1), (1, 2), (2, 2), (3, 1), (1, 3)];
+
+struct Checker {
+    digest: u64,
+    board: [Piece; 64],
+    pawn_file_types: HashSet<PawnFileType>,
+}
+
+impl Checker {
+    fn fold(&mut self, value: u64) {
+        // FNV-1a over whole words
+        self.digest = (self.digest ^ value).wrapping_mul(0x100_0000_01b3);
+    }
+
+    fn place(
+        &mut self,
+        pawn: Piece,
+        count: usize,
+        from: usize,
+        rest: &mut dyn FnMut(&mut Checker),
+    ) {
+        if count == 0 {
+            rest(self);
+            return;
+        }
+        for sq in from..56 {
+            if self.board[sq] == Piece::NO_PIECE {
+                self.board[sq] = pawn;
+                self.place(pawn, count - 1, sq + 1, rest);
+                self.board[sq] = Piece::NO_PIECE;
+            }
+        }
+    }
+
+    fn classify(&mut self) {
+        self.classify_with(Side::White, 0);
+        for sq in 24..32 {
+            if self.board[sq] == Piece::PAWN && self.en_passant(sq, sq - 8, sq - 16) {
+                self.classify_with(Side::Black, sq as i32 - 8);
+            }
+        }
+        for sq in 32..40 {
+            if self.board[sq] == Piece::BLACK_PAWN && self.en_passant(sq, sq + 8, sq + 16) {
+                self.classify_with(Side::White, sq as i32 + 8);
+            }
+        }
+    }
+
+    /// Whether the pawn on sq can have just moved two squares from origin, and
+    /// be captured en passant by a pawn next to it.
+    fn en_passant(&self, sq: usize, ep_square: usize, origin: usize) -> bool {
+        let pawn = self.board[sq];
+        let capturer = Piece(-pawn.0);
+        self.board[ep_square] == Piece::NO_PIECE
+            && self.board[origin] == Piece::NO_PIECE
+            && ((sq % 8 > 0 && self.board[sq - 1] == capturer)
+                || (sq % 8 < 7 && self.board[sq + 1] == capturer))
+    }
+
+    fn classify_with(&mut self, side: Side, ep_square: i32) {
+        let mut info: MbInfo = unsafe { mem::zeroed() };
+        let result = unsafe { mbeval_get_mb_info(self.board.as_ptr(), side, ep_square, &mut info) };
+        assert_eq!(result, 0, "{:?} {side:?} ep {ep_square}", self.board);
+        for value in summary(result, &info) {
+            self.fold(value);
+        }
+        self.pawn_file_types.insert(info.pawn_file_type);
+    }
+}
+
+#[test]
+fn test_pawn_file_types_match_reference() {
+    init_mbeval();
+
+    let mut checker = Checker {
+        digest: 0xcbf2_9ce4_8422_2325,
+        board: [Piece::NO_PIECE; 64],
+        pawn_file_types: HashSet::new(),
+    };
+    // kings on the back ranks, out of the way of pawns and en passant squares
+    checker.board[4] = Piece::KING;
+    checker.board[60] = Piece::BLACK_KING;
+
+    for (white, black) in PAWN_COUNTS {
+        checker.place(Piece::PAWN, white, 8, &mut |checker| {
+            checker.place(Piece::BLACK_PAWN, black, 8, &mut |checker| {
+                checker.classify()
+            });
+        });
+    }
+
+    assert_eq!(checker.pawn_file_types.len(), 9);
+    assert_eq!(checker.digest, EXPECTED_DIGEST);
+}
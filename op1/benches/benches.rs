@@ -1,8 +1,23 @@
-use std::hint::black_box;
+use std::{
+    ffi::c_int,
+    hint::black_box,
+    mem::MaybeUninit,
+    sync::{
+        Barrier,
+        atomic::{AtomicU64, Ordering},
+    },
+    thread,
+    time::Instant,
+};
 
-use criterion::{Criterion, criterion_group, criterion_main};
-use op1::{Tablebase, Value, guess_winner};
-use shakmaty::{CastlingMode, Chess, fen::Fen};
+use criterion::{BatchSize, Criterion, Throughput, criterion_group, criterion_main};
+use mbeval_sys::{
+    MBEVAL_PAGES_HUGE, MBEVAL_PAGES_HUGETLB, MBEVAL_PAGES_INTERLEAVE, MbInfo, Side,
+    mbeval_get_mb_info_bitboards, mbeval_init, mbeval_is_initialized, mbeval_set_table_placement,
+    mbeval_table_placement,
+};
+use op1::{ProbeContext, TableAccess, Tablebase, Value, guess_winner};
+use shakmaty::{CastlingMode, Chess, Color, EnPassantMode, Position as _, Role, Square, fen::Fen};
 
 fn kbpkpppp(c: &mut Criterion) {
     let pos: Chess = "8/2b5/8/8/3P4/pPP5/P7/1k2K3 w - - 0 1"
@@ -25,10 +40,315 @@ fn kbpkpppp(c: &mut Criterion) {
         });
     });
 
+    c.bench_function("probe_kbpkpppp_mmap", |b| {
+        let mut tablebase = Tablebase::new();
+        tablebase
+            .add_path_with_access("../tables", TableAccess::Mmap)
+            .unwrap();
+
+        b.iter(|| {
+            assert_eq!(
+                tablebase.probe(black_box(&pos)).unwrap(),
+                black_box(Some(Value::LosingDtc(1)))
+            );
+        });
+    });
+
     c.bench_function("guess_kbpkpppp", |b| {
         b.iter(|| guess_winner(black_box(&pos)));
     });
 }
 
-criterion_group!(benches, kbpkpppp);
+fn ascending_offsets(c: &mut Criterion) {
+    // The kbpkpppp position of probe_kbpkpppp with the bishop on each dark
+    // square in turn. Only the bishop moves, so the probes read nearby
+    // offsets of the same blocks, mostly in ascending order.
+    let setup = "8/8/8/8/3P4/pPP5/P7/1k2K3 w - - 0 1"
+        .parse::<Fen>()
+        .unwrap()
+        .into_setup();
+    let positions: Vec<Chess> = Square::ALL
+        .into_iter()
+        .filter(|square| square.is_dark() && setup.board.piece_at(*square).is_none())
+        .filter_map(|square| {
+            let mut setup = setup.clone();
+            setup.board.set_piece_at(square, Color::Black.bishop());
+            Fen(setup).into_position(CastlingMode::Chess960).ok()
+        })
+        .collect();
+
+    let mut tablebase = Tablebase::new();
+    tablebase.add_path("../tables").unwrap();
+
+    let mut group = c.benchmark_group("ascending_offsets");
+    group.throughput(Throughput::Elements(positions.len() as u64));
+    group.bench_function("probe", |b| {
+        // Start each iteration with a fresh context, so that the blocks are
+        // decompressed again.
+        b.iter_batched_ref(
+            ProbeContext::new,
+            |ctx| {
+                for pos in &positions {
+                    black_box(tablebase.probe_with_context(black_box(pos), ctx).unwrap());
+                }
+            },
+            BatchSize::SmallInput,
+        );
+    });
+    group.finish();
+}
+
+fn mb_info(c: &mut Criterion) {
+    if unsafe { mbeval_is_initialized() } == 0 {
+        unsafe { mbeval_init() };
+    }
+
+    // Each computation resolves one or more ending types: plain, with bishop
+    // parities, and with opposing pawns.
+    //
+    // To compare the ending type hash against the original scan of the index
+    // table:
+    //
+    //   cargo bench -p op1 --features mbeval-sys/scan-ending-types -- mb_info_k --save-baseline scan
+    //   cargo bench -p op1 -- mb_info_k --baseline scan
+    for (name, fen) in [
+        ("mb_info_kbpkpppp", "8/2b5/8/8/3P4/pPP5/P7/1k2K3 w - - 0 1"),
+        (
+            "mb_info_kbbnnkrn",
+            "8/8/2k1r3/8/3n4/8/1BB1N3/3NK3 w - - 0 1",
+        ),
+        (
+            "mb_info_krppkrpp",
+            "8/5k2/1p3p2/8/1P3P2/4K3/8/r3R3 b - - 0 1",
+        ),
+    ] {
+        let pos: Chess = fen
+            .parse::<Fen>()
+            .unwrap()
+            .into_position(CastlingMode::Chess960)
+            .unwrap();
+        let bitboards = Color::ALL
+            .map(|color| Role::ALL.map(|role| u64::from(pos.board().by_piece(role.of(color)))));
+        let side = pos.turn().fold_wb(Side::White, Side::Black);
+        let ep_square = pos.ep_square(EnPassantMode::Legal).map_or(0, c_int::from);
+
+        c.bench_function(name, |b| {
+            b.iter(|| {
+                let mut mb_info = MaybeUninit::<MbInfo>::uninit();
+                let result = unsafe {
+                    mbeval_get_mb_info_bitboards(
+                        black_box(&bitboards).as_ptr(),
+                        side,
+                        ep_square,
+                        mb_info.as_mut_ptr(),
+                    )
+                };
+                assert_eq!(result, 0);
+            });
+        });
+    }
+}
+
+fn identical_pieces(c: &mut Criterion) {
+    if unsafe { mbeval_is_initialized() } == 0 {
+        unsafe { mbeval_init() };
+    }
+
+    // Random placements of 5, 6 and 7 knights next to kings on e1 and e8. Their
+    // indices rank the knight squares after sorting them, and the squares come
+    // in random order, as in real probes.
+    //
+    // To compare the sorting networks against the original branchy sort:
+    //
+    //   cargo bench -p op1 --features mbeval-sys/swap-sort -- knights --save-baseline swap-sort
+    //   cargo bench -p op1 -- knights --baseline swap-sort
+    let mut state = 0x2545_f491_4f6c_dd1d_u64;
+    let mut next_square = move || {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        state % 64
+    };
+
+    for count in 5..=7 {
+        let positions: Vec<[[u64; 6]; 2]> = (0..1024)
+            .map(|_| {
+                let mut bitboards = [[0; 6]; 2];
+                bitboards[0][5] = 1 << 4;
+                bitboards[1][5] = 1 << 60;
+                let mut occupied = bitboards[0][5] | bitboards[1][5];
+                for _ in 0..count {
+                    let knight = loop {
+                        let bit = 1 << next_square();
+                        if occupied & bit == 0 {
+                            break bit;
+                        }
+                    };
+                    occupied |= knight;
+                    bitboards[0][1] |= knight;
+                }
+                bitboards
+            })
+            .collect();
+
+        c.bench_function(&format!("mb_info_{count}_knights"), |b| {
+            b.iter(|| {
+                for bitboards in &positions {
+                    let mut mb_info = MaybeUninit::<MbInfo>::uninit();
+                    let result = unsafe {
+                        mbeval_get_mb_info_bitboards(
+                            black_box(bitboards).as_ptr(),
+                            Side::White,
+                            0,
+                            mb_info.as_mut_ptr(),
+                        )
+                    };
+                    assert_eq!(result, 0);
+                }
+            });
+        });
+    }
+}
+
+fn table_placement(c: &mut Criterion) {
+    // Random rook and pawn endings on all threads, with the pawns crowded onto
+    // the center files so that most indices come from the opposing pawn
+    // tables, which are the largest. Only the index computation is measured,
+    // since that is all the placement affects. Full probes would mostly time
+    // reading and decompressing blocks, and need tables for these endings.
+    let mut state = 0x9e37_79b9_7f4a_7c15_u64;
+    let mut next = move || {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        state
+    };
+
+    unsafe { mbeval_init() };
+    let positions: Vec<[[u64; 6]; 2]> = (0..)
+        .map(|_| {
+            let mut bitboards = [[0; 6]; 2];
+            bitboards[0][5] = 1 << 4;
+            bitboards[1][5] = 1 << 60;
+            let mut occupied = bitboards[0][5] | bitboards[1][5];
+            for (color, role) in [(0, 0), (0, 0), (1, 0), (1, 0), (0, 3), (1, 3)] {
+                let bit = loop {
+                    let r = next();
+                    let square = if role == 0 {
+                        8 * (1 + (r >> 8) % 6) + 2 + r % 4
+                    } else {
+                        r % 64
+                    };
+                    if occupied & 1 << square == 0 {
+                        break 1 << square;
+                    }
+                };
+                occupied |= bit;
+                bitboards[color][role] |= bit;
+            }
+            bitboards
+        })
+        .filter(|bitboards| {
+            let mut mb_info = MaybeUninit::<MbInfo>::uninit();
+            let result = unsafe {
+                mbeval_get_mb_info_bitboards(
+                    bitboards.as_ptr(),
+                    Side::White,
+                    0,
+                    mb_info.as_mut_ptr(),
+                )
+            };
+            result == 0
+        })
+        .take(4096)
+        .collect();
+
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    let mut group = c.benchmark_group("table_placement");
+    group.throughput(Throughput::Elements((positions.len() * threads) as u64));
+
+    for (name, placement) in [
+        ("default", 0),
+        ("huge_pages", MBEVAL_PAGES_HUGE),
+        ("hugetlb", MBEVAL_PAGES_HUGETLB),
+        ("numa_interleave", MBEVAL_PAGES_INTERLEAVE),
+        (
+            "huge_pages_numa_interleave",
+            MBEVAL_PAGES_HUGE | MBEVAL_PAGES_INTERLEAVE,
+        ),
+    ] {
+        // Recompute the tables with the requested placement, and skip modes
+        // that the system does not support
+        unsafe {
+            mbeval_set_table_placement(placement as c_int);
+            mbeval_init();
+        }
+        if unsafe { mbeval_table_placement() } as u32 != placement {
+            continue;
+        }
+
+        // Spawn the workers once per placement, outside of the measurement,
+        // and time only the probes. Each measurement hands them the number of
+        // iterations, with 0 telling them to stop.
+        let iters = AtomicU64::new(0);
+        let start = Barrier::new(threads + 1);
+        let done = Barrier::new(threads + 1);
+        thread::scope(|scope| {
+            for _ in 0..threads {
+                scope.spawn(|| {
+                    loop {
+                        start.wait();
+                        let iters = iters.load(Ordering::Relaxed);
+                        if iters == 0 {
+                            break;
+                        }
+                        for _ in 0..iters {
+                            for bitboards in &positions {
+                                let mut mb_info = MaybeUninit::<MbInfo>::uninit();
+                                let result = unsafe {
+                                    mbeval_get_mb_info_bitboards(
+                                        black_box(bitboards).as_ptr(),
+                                        Side::White,
+                                        0,
+                                        mb_info.as_mut_ptr(),
+                                    )
+                                };
+                                assert_eq!(result, 0);
+                            }
+                        }
+                        done.wait();
+                    }
+                });
+            }
+
+            group.bench_function(name, |b| {
+                b.iter_custom(|n| {
+                    iters.store(n, Ordering::Relaxed);
+                    start.wait();
+                    let started = Instant::now();
+                    done.wait();
+                    started.elapsed()
+                });
+            });
+
+            iters.store(0, Ordering::Relaxed);
+            start.wait();
+        });
+    }
+    group.finish();
+
+    unsafe {
+        mbeval_set_table_placement(0);
+        mbeval_init();
+    }
+}
+
+criterion_group!(
+    benches,
+    kbpkpppp,
+    ascending_offsets,
+    mb_info,
+    identical_pieces,
+    table_placement
+);
 criterion_main!(benches);
@@ -0,0 +1,64 @@
+use std::path::PathBuf;
+
+use clap::{Parser, builder::PathBufValueParser};
+use op1::{RepackOptions, repack_seekable};
+
+/// Repack an Mb table into the seekable format, where each block is split
+/// into independently compressed frames and probes decompress only the frame
+/// holding their entry. Reports the size overhead and the time per probe,
+/// before and after.
+#[derive(Parser, Debug)]
+struct Opt {
+    /// Decompressed size of each frame, in KiB.
+    #[arg(long, default_value = "32")]
+    frame_kib: u32,
+    /// Zstd compression level of the frames.
+    #[arg(long, default_value = "19")]
+    level: i32,
+    /// Number of random entries per block to time decompression with.
+    #[arg(long, default_value = "16")]
+    samples_per_block: usize,
+    #[arg(value_parser = PathBufValueParser::new())]
+    input: PathBuf,
+    /// Where to write the repacked table, which may be the input itself. If
+    /// omitted, only report.
+    #[arg(value_parser = PathBufValueParser::new())]
+    output: Option<PathBuf>,
+}
+
+fn main() {
+    let opt = Opt::parse();
+
+    let report = repack_seekable(
+        &opt.input,
+        opt.output.as_deref(),
+        &RepackOptions {
+            frame_size: opt.frame_kib * 1024,
+            level: opt.level,
+            samples_per_block: opt.samples_per_block,
+        },
+    )
+    .expect("repack table");
+
+    println!(
+        "{}: {} blocks, {} frames",
+        opt.input.display(),
+        report.blocks,
+        report.frames
+    );
+    println!(
+        "size: {} -> {} bytes ({:+.2}%)",
+        report.original_size,
+        report.repacked_size,
+        report.size_overhead() * 100.0
+    );
+    println!(
+        "time per probe ({} samples): {:?} -> {:?}",
+        report.samples,
+        report.mean_original_decompression(),
+        report.mean_repacked_decompression()
+    );
+    if let Some(output) = &opt.output {
+        println!("wrote {}", output.display());
+    }
+}
@@ -0,0 +1,200 @@
+use std::{
+    hash::{BuildHasher as _, Hash},
+    sync::{
+        Arc, Mutex,
+        atomic::{AtomicU64, Ordering},
+    },
+};
+
+use rustc_hash::{FxBuildHasher, FxHashMap};
+
+const MAX_SHARDS: usize = 64;
+
+/// Smallest budget of a shard, so that each can hold several blocks. Smaller
+/// caches use fewer shards.
+const MIN_SHARD_CAPACITY: usize = 8 * 1024 * 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct BlockKey {
+    pub table_id: u32,
+    pub block_index: u32,
+}
+
+/// Decompressed table blocks, shared by all probing threads. The total size
+/// of cached blocks is bounded by a byte budget that is split evenly across
+/// independently locked shards. Each shard evicts its least recently used
+/// blocks. Blocks larger than the budget of a shard are not cached.
+pub struct BlockCache {
+    shards: Box<[Mutex<Shard>]>,
+    shard_capacity: usize,
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+#[derive(Default)]
+struct Shard {
+    blocks: FxHashMap<BlockKey, Entry>,
+    bytes: usize,
+    clock: u64,
+}
+
+struct Entry {
+    block: Arc<Vec<u8>>,
+    last_used: u64,
+}
+
+impl BlockCache {
+    pub(crate) fn new(capacity: usize) -> BlockCache {
+        let num_shards = (capacity / MIN_SHARD_CAPACITY).clamp(1, MAX_SHARDS);
+        BlockCache {
+            shards: (0..num_shards)
+                .map(|_| Mutex::new(Shard::default()))
+                .collect(),
+            shard_capacity: capacity / num_shards,
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+        }
+    }
+
+    fn shard(&self, key: &BlockKey) -> &Mutex<Shard> {
+        &self.shards[FxBuildHasher.hash_one(key) as usize % self.shards.len()]
+    }
+
+    pub(crate) fn get(&self, key: &BlockKey) -> Option<Arc<Vec<u8>>> {
+        let mut shard = self.shard(key).lock().expect("block cache shard");
+        shard.clock += 1;
+        let clock = shard.clock;
+        let block = shard.blocks.get_mut(key).map(|entry| {
+            entry.last_used = clock;
+            Arc::clone(&entry.block)
+        });
+        drop(shard);
+
+        if block.is_some() {
+            self.hits.fetch_add(1, Ordering::Relaxed);
+        } else {
+            self.misses.fetch_add(1, Ordering::Relaxed);
+        }
+        block
+    }
+
+    /// Whether blocks of `size` bytes can be cached at all.
+    pub(crate) fn admits(&self, size: usize) -> bool {
+        size <= self.shard_capacity
+    }
+
+    pub(crate) fn insert(&self, key: BlockKey, block: Arc<Vec<u8>>) {
+        let size = block.capacity();
+        if !self.admits(size) {
+            return;
+        }
+
+        let mut shard = self.shard(&key).lock().expect("block cache shard");
+
+        // Do not count the entry that is replaced when making room.
+        if let Some(replaced) = shard.blocks.remove(&key) {
+            shard.bytes -= replaced.block.capacity();
+        }
+
+        while shard.bytes + size > self.shard_capacity {
+            let Some(lru) = shard
+                .blocks
+                .iter()
+                .min_by_key(|(_, entry)| entry.last_used)
+                .map(|(lru, _)| *lru)
+            else {
+                break;
+            };
+            let evicted = shard.blocks.remove(&lru).expect("lru entry");
+            shard.bytes -= evicted.block.capacity();
+        }
+
+        shard.clock += 1;
+        let last_used = shard.clock;
+        shard.blocks.insert(key, Entry { block, last_used });
+        shard.bytes += size;
+    }
+
+    pub fn hits(&self) -> u64 {
+        self.hits.load(Ordering::Relaxed)
+    }
+
+    pub fn misses(&self) -> u64 {
+        self.misses.load(Ordering::Relaxed)
+    }
+
+    pub fn bytes(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().expect("block cache shard").bytes)
+            .sum()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn block(size: usize) -> Arc<Vec<u8>> {
+        Arc::new(Vec::with_capacity(size))
+    }
+
+    fn key(block_index: u32) -> BlockKey {
+        BlockKey {
+            table_id: 0,
+            block_index,
+        }
+    }
+
+    #[test]
+    fn test_block_cache_budget() {
+        let cache = BlockCache::new(MAX_SHARDS * 1000);
+
+        for block_index in 0..10_000 {
+            cache.insert(
+                BlockKey {
+                    table_id: 0,
+                    block_index,
+                },
+                block(300),
+            );
+        }
+
+        assert!(cache.bytes() <= MAX_SHARDS * 1000);
+
+        let key = BlockKey {
+            table_id: 1,
+            block_index: 0,
+        };
+        cache.insert(key, block(300));
+        assert!(cache.get(&key).is_some());
+
+        cache.insert(key, block(MAX_SHARDS * 1000 + 1));
+        assert!(cache.get(&key).is_some_and(|b| b.capacity() == 300));
+    }
+
+    #[test]
+    fn test_block_cache_small_budget() {
+        // A budget too small to give every shard a block still caches some.
+        let cache = BlockCache::new(4 * 650_000);
+        assert!(cache.admits(650_000));
+        for block_index in 0..4 {
+            cache.insert(key(block_index), block(650_000));
+        }
+        assert!(cache.get(&key(3)).is_some());
+        assert!(!cache.admits(5_000_000));
+    }
+
+    #[test]
+    fn test_block_cache_replace() {
+        let cache = BlockCache::new(1000);
+        cache.insert(key(0), block(400));
+        cache.insert(key(1), block(400));
+
+        // Replacing a block makes room for it, not for both.
+        cache.insert(key(1), block(500));
+        assert!(cache.get(&key(0)).is_some());
+        assert!(cache.get(&key(1)).is_some_and(|b| b.capacity() == 500));
+        assert_eq!(cache.bytes(), 900);
+    }
+}
@@ -5,19 +5,33 @@ use std::{
 
 use zerocopy::IntoBytes;
 use zstd_sys::{
-    ZSTD_DStream, ZSTD_createDStream, ZSTD_decompressStream, ZSTD_freeDStream, ZSTD_getErrorName,
-    ZSTD_inBuffer_s, ZSTD_initDStream, ZSTD_isError, ZSTD_outBuffer_s,
+    ZSTD_DStream, ZSTD_compressBound, ZSTD_createDStream, ZSTD_decompressStream, ZSTD_freeDStream,
+    ZSTD_getErrorName, ZSTD_inBuffer_s, ZSTD_initDStream, ZSTD_isError, ZSTD_outBuffer_s,
 };
 
+/// Upper bound for the compressed size of `size` bytes.
+pub fn max_compressed_size(size: usize) -> usize {
+    unsafe { ZSTD_compressBound(size) }
+}
+
 pub struct Decompressor {
     ctx: *mut ZSTD_DStream,
+    /// Input consumed by the stream that [`Decompressor::decompress_bytes`]
+    /// can resume, if any.
+    resumable_pos: Option<usize>,
 }
 
+// A zstd context may move between threads, as long as it is not shared.
+unsafe impl Send for Decompressor {}
+
 impl Decompressor {
     pub fn new() -> Decompressor {
         let ctx = unsafe { ZSTD_createDStream() };
         assert!(!ctx.is_null());
-        Decompressor { ctx }
+        Decompressor {
+            ctx,
+            resumable_pos: None,
+        }
     }
 
     pub fn decompress_prefix<T>(
@@ -43,13 +57,101 @@ impl Decompressor {
             pos: 0,
         };
 
+        self.resumable_pos = None;
         unsafe {
             ZSTD_initDStream(self.ctx);
         }
+        self.decompress(&mut in_buffer, &mut out_buffer)?;
+
+        unsafe {
+            decompressed.set_len(out_buffer.pos / std::mem::size_of::<T>());
+        }
+
+        Ok(())
+    }
+
+    /// Makes `decompressed` hold at least the first `len` bytes of the block,
+    /// or all of it if it is shorter.
+    ///
+    /// With `resume`, continues the stream of the previous call, which must
+    /// have been given the same compressed block and left `decompressed`
+    /// untouched since. Bytes already there are not decompressed again.
+    pub fn decompress_bytes(
+        &mut self,
+        compressed: &[u8],
+        decompressed: &mut Vec<u8>,
+        len: usize,
+        resume: bool,
+    ) -> io::Result<()> {
+        let pos = match self.resumable_pos.take() {
+            Some(pos) if resume => pos,
+            _ => {
+                decompressed.clear();
+                unsafe {
+                    ZSTD_initDStream(self.ctx);
+                }
+                0
+            }
+        };
+
+        self.resumable_pos = Some(self.append(compressed, pos, decompressed, len)?);
+        Ok(())
+    }
+
+    /// Decompresses a zstd frame after the bytes already in `decompressed`,
+    /// stopping once it holds `len` bytes.
+    pub fn decompress_append(
+        &mut self,
+        compressed: &[u8],
+        decompressed: &mut Vec<u8>,
+        len: usize,
+    ) -> io::Result<()> {
+        self.resumable_pos = None;
+        unsafe {
+            ZSTD_initDStream(self.ctx);
+        }
+        self.append(compressed, 0, decompressed, len)?;
+        Ok(())
+    }
+
+    /// Feeds `compressed` from `pos` to the stream until `decompressed` holds
+    /// `len` bytes or the input ends. Returns the input position reached.
+    fn append(
+        &mut self,
+        compressed: &[u8],
+        pos: usize,
+        decompressed: &mut Vec<u8>,
+        len: usize,
+    ) -> io::Result<usize> {
+        let mut in_buffer = ZSTD_inBuffer_s {
+            src: compressed.as_ptr().cast::<c_void>(),
+            size: compressed.len(),
+            pos,
+        };
+
+        decompressed.reserve(len.saturating_sub(decompressed.len()));
+        let mut out_buffer = ZSTD_outBuffer_s {
+            dst: decompressed.as_mut_ptr().cast::<c_void>(),
+            size: len.max(decompressed.len()),
+            pos: decompressed.len(),
+        };
+
+        self.decompress(&mut in_buffer, &mut out_buffer)?;
+
+        unsafe {
+            decompressed.set_len(out_buffer.pos);
+        }
+
+        Ok(in_buffer.pos)
+    }
 
+    fn decompress(
+        &mut self,
+        in_buffer: &mut ZSTD_inBuffer_s,
+        out_buffer: &mut ZSTD_outBuffer_s,
+    ) -> io::Result<()> {
         while in_buffer.pos < in_buffer.size && out_buffer.pos < out_buffer.size {
-            let result =
-                unsafe { ZSTD_decompressStream(self.ctx, &mut out_buffer, &mut in_buffer) };
+            let result = unsafe { ZSTD_decompressStream(self.ctx, out_buffer, in_buffer) };
             if unsafe { ZSTD_isError(result) } != 0 {
                 return Err(io::Error::new(io::ErrorKind::InvalidData, unsafe {
                     CStr::from_ptr(ZSTD_getErrorName(result))
@@ -58,11 +160,6 @@ impl Decompressor {
                 }));
             }
         }
-
-        unsafe {
-            decompressed.set_len(out_buffer.pos / std::mem::size_of::<T>());
-        }
-
         Ok(())
     }
 }
@@ -72,3 +169,82 @@ impl Drop for Decompressor {
         unsafe { ZSTD_freeDStream(self.ctx) };
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use zstd_sys::ZSTD_compress;
+
+    use super::*;
+
+    #[test]
+    fn test_decompress_bytes_resume() {
+        let block: Vec<u8> = (0..100_000_u32)
+            .map(|i| (i.wrapping_mul(2_654_435_761) >> 29) as u8)
+            .collect();
+        let mut compressed = vec![0; max_compressed_size(block.len())];
+        let size = unsafe {
+            ZSTD_compress(
+                compressed.as_mut_ptr().cast(),
+                compressed.len(),
+                block.as_ptr().cast(),
+                block.len(),
+                3,
+            )
+        };
+        compressed.truncate(size);
+
+        let mut decompressor = Decompressor::new();
+        let mut decompressed = Vec::new();
+        for (len, resume) in [
+            (1_000, false),
+            (50_000, true),
+            (20, true),
+            (200_000, true),
+            (10, false),
+        ] {
+            decompressor
+                .decompress_bytes(&compressed, &mut decompressed, len, resume)
+                .unwrap();
+            let expected = if resume {
+                decompressed.len().max(len.min(block.len()))
+            } else {
+                len
+            };
+            assert_eq!(decompressed.len(), expected);
+            assert_eq!(decompressed[..], block[..expected]);
+        }
+    }
+
+    #[test]
+    fn test_decompress_append() {
+        let block: Vec<u8> = (0..100_000_u32)
+            .map(|i| (i.wrapping_mul(2_654_435_761) >> 29) as u8)
+            .collect();
+        let frames: Vec<Vec<u8>> = block
+            .chunks(30_000)
+            .map(|chunk| {
+                let mut compressed = vec![0; max_compressed_size(chunk.len())];
+                let size = unsafe {
+                    ZSTD_compress(
+                        compressed.as_mut_ptr().cast(),
+                        compressed.len(),
+                        chunk.as_ptr().cast(),
+                        chunk.len(),
+                        3,
+                    )
+                };
+                compressed.truncate(size);
+                compressed
+            })
+            .collect();
+
+        let mut decompressor = Decompressor::new();
+        let mut decompressed = Vec::new();
+        for frame in &frames {
+            decompressor
+                .decompress_append(frame, &mut decompressed, 70_000)
+                .unwrap();
+        }
+        assert_eq!(decompressed[..], block[..70_000]);
+    }
+}
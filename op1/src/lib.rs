@@ -1,7 +1,18 @@
+mod block_cache;
 mod decompressor;
 mod guess;
+mod mmap;
+mod position_cache;
+mod predictor;
+mod repack;
 mod table;
 mod tablebase;
 
 pub use guess::guess_winner;
-pub use tablebase::{Tablebase, Value};
+pub use predictor::WinnerPredictor;
+pub use repack::{RepackOptions, RepackReport, repack_seekable};
+pub use table::{ProbeContext, TableAccess};
+pub use tablebase::{
+    MbevalPlacement, ProbedChildren, Tablebase, Value, init_mbeval_from_snapshot, mbeval_placement,
+    set_mbeval_placement, write_mbeval_snapshot,
+};
@@ -3,7 +3,7 @@ use std::{
     net::SocketAddr,
     path::PathBuf,
     sync::atomic::{AtomicU64, Ordering},
-    time::Instant,
+    time::{Duration, Instant},
 };
 
 use axum::{
@@ -15,18 +15,26 @@ use axum::{
 };
 use clap::{ArgAction, CommandFactory as _, Parser, builder::PathBufValueParser};
 use listenfd::ListenFd;
-use op1::{Tablebase, Value};
+use op1::{
+    MbevalPlacement, TableAccess, Tablebase, Value, init_mbeval_from_snapshot,
+    set_mbeval_placement, write_mbeval_snapshot,
+};
 use rustc_hash::FxHashMap;
 use serde::{Deserialize, Serialize};
-use shakmaty::{CastlingMode, Chess, Position, PositionError, fen::Fen, uci::UciMove};
+use shakmaty::{CastlingMode, Chess, PositionError, fen::Fen, uci::UciMove};
 use tikv_jemallocator::Jemalloc;
 use tokio::{
     net::{TcpListener, UnixListener},
-    task,
+    signal, task,
 };
 use tower::ServiceBuilder;
 use tower_http::trace::TraceLayer;
 
+const PREDICTOR_SAVE_INTERVAL: Duration = Duration::from_secs(5 * 60);
+
+/// Children of a position probed per blocking task.
+const CHILDREN_PER_TASK: usize = 4;
+
 #[global_allocator]
 static GLOBAL: Jemalloc = Jemalloc;
 
@@ -36,6 +44,39 @@ struct Opt {
     bind: SocketAddr,
     #[arg(long, action = ArgAction::Append, value_parser = PathBufValueParser::new())]
     path: Vec<PathBuf>,
+    /// Map table files into memory instead of reading blocks with pread.
+    #[arg(long)]
+    mmap: bool,
+    /// Size of the shared cache for decompressed table blocks, in MiB.
+    #[arg(long, default_value = "0")]
+    block_cache_mib: usize,
+    /// Number of recently probed positions to remember, shared by mirrored
+    /// and symmetric positions.
+    #[arg(long, default_value = "0")]
+    position_cache_entries: usize,
+    /// Map mbeval index tables from this snapshot file, if present.
+    #[arg(long, value_parser = PathBufValueParser::new())]
+    mbeval_snapshot: Option<PathBuf>,
+    /// Write the snapshot given by --mbeval-snapshot and exit.
+    #[arg(long, requires = "mbeval_snapshot")]
+    write_mbeval_snapshot: bool,
+    /// Back computed mbeval index tables with transparent huge pages.
+    #[arg(long)]
+    mbeval_huge_pages: bool,
+    /// Back computed mbeval index tables with preallocated huge pages, falling
+    /// back to transparent huge pages.
+    #[arg(long)]
+    mbeval_hugetlb: bool,
+    /// Interleave computed mbeval index tables across NUMA nodes.
+    #[arg(long)]
+    mbeval_numa_interleave: bool,
+    /// Load learned winner predictions from this file, if present, and save
+    /// them back periodically.
+    #[arg(long, value_parser = PathBufValueParser::new())]
+    predictor: Option<PathBuf>,
+    /// Seed the predictor given by --predictor from the tables and exit.
+    #[arg(long, requires = "predictor")]
+    seed_predictor: bool,
 }
 
 struct AppState {
@@ -100,46 +141,41 @@ async fn handle_probe(
         .or_else(PositionError::ignore_invalid_ep_square)
         .or_else(PositionError::ignore_impossible_check)?;
 
-    let child_handles = pos
-        .legal_moves()
-        .into_iter()
-        .map(|m| {
-            let mut after = pos.clone();
-            after.play_unchecked(m);
-            (
-                m,
-                task::spawn_blocking(move || {
-                    app.tablebase
-                        .probe(&after)
-                        .map(|maybe_v| maybe_v.map(Value::zero_draw))
-                }),
-            )
+    let root_pos = pos.clone();
+    let root = task::spawn_blocking(move || app.tablebase.probe(&root_pos))
+        .await
+        .expect("blocking root probe")
+        .inspect(|_| tracing::trace!("root success"))
+        .inspect_err(|error| tracing::error!(%error, "root fail"))?;
+
+    // Probe the children in parts on the blocking pool, so that their reads
+    // overlap, while each part batches its own lookups.
+    let moves = pos.legal_moves();
+    let part_handles = moves
+        .chunks(CHILDREN_PER_TASK)
+        .map(|moves| {
+            let pos = pos.clone();
+            let moves = moves.to_vec();
+            task::spawn_blocking(move || {
+                let values = app.tablebase.probe_children(&pos, root, &moves);
+                moves.into_iter().zip(values).collect::<Vec<_>>()
+            })
         })
         .collect::<Vec<_>>();
 
-    let root = task::spawn_blocking(move || {
-        app.tablebase
-            .probe(&pos)
-            .map(|maybe_v| maybe_v.map(Value::zero_draw))
-    })
-    .await
-    .expect("blocking root probe")
-    .inspect(|_| tracing::trace!("root success"))
-    .inspect_err(|error| tracing::error!(%error, "root fail"))?;
-
-    let mut children = FxHashMap::with_capacity_and_hasher(child_handles.len(), Default::default());
-    for (m, child) in child_handles {
-        let uci = m.to_uci(CastlingMode::Chess960);
-        children.insert(
-            uci,
-            child
-                .await
-                .expect("blocking child probe")
+    let mut children = FxHashMap::with_capacity_and_hasher(moves.len(), Default::default());
+    for part in part_handles {
+        for (m, value) in part.await.expect("blocking child probe") {
+            let uci = m.to_uci(CastlingMode::Chess960);
+            let value = value
                 .inspect(|_| tracing::trace!(%uci, "child success"))
-                .inspect_err(|error| tracing::error!(%uci, %error, "child fail"))?,
-        );
+                .inspect_err(|error| tracing::error!(%uci, %error, "child fail"))?;
+            children.insert(uci, value.map(Value::zero_draw));
+        }
     }
 
+    let root = root.map(Value::zero_draw);
+
     app.stats.probe_requests.fetch_add(1, Ordering::Relaxed);
     app.stats
         .probe_micros
@@ -151,7 +187,7 @@ async fn handle_probe(
 #[axum::debug_handler]
 async fn handle_monitor(State(app): State<&'static AppState>) -> String {
     let stats = app.tablebase.stats();
-    let metrics = &[
+    let mut metrics = vec![
         // Application stats
         format!(
             "probe_requests={}u",
@@ -165,7 +201,30 @@ async fn handle_monitor(State(app): State<&'static AppState>) -> String {
         format!("draws={}u", stats.draws()),
         format!("true_predictions={}u", stats.true_predictions()),
         format!("false_predictions={}u", stats.false_predictions()),
+        format!(
+            "learned_true_predictions={}u",
+            stats.learned_true_predictions()
+        ),
+        format!(
+            "learned_false_predictions={}u",
+            stats.learned_false_predictions()
+        ),
+        format!("predictor_keys={}u", app.tablebase.predictor().len()),
     ];
+    if let Some(block_cache) = app.tablebase.block_cache() {
+        metrics.extend([
+            format!("block_cache_hits={}u", block_cache.hits()),
+            format!("block_cache_misses={}u", block_cache.misses()),
+            format!("block_cache_bytes={}u", block_cache.bytes()),
+        ]);
+    }
+    if let Some(position_cache) = app.tablebase.position_cache() {
+        metrics.extend([
+            format!("position_cache_hits={}u", position_cache.hits()),
+            format!("position_cache_misses={}u", position_cache.misses()),
+            format!("position_cache_entries={}u", position_cache.len()),
+        ]);
+    }
     format!("op1 {}", metrics.join(","))
 }
 
@@ -173,6 +232,12 @@ async fn handle_monitor(State(app): State<&'static AppState>) -> String {
 async fn main() {
     // Parse arguments
     let opt = Opt::parse();
+    if opt.write_mbeval_snapshot {
+        let path = opt.mbeval_snapshot.expect("snapshot path");
+        write_mbeval_snapshot(&path).expect("write mbeval snapshot");
+        println!("wrote {}", path.display());
+        return;
+    }
     if opt.path.is_empty() {
         Opt::command().print_help().expect("usage");
         println!();
@@ -187,11 +252,49 @@ async fn main() {
         .init();
 
     // Initialize tablebase
+    set_mbeval_placement(MbevalPlacement {
+        huge_pages: opt.mbeval_huge_pages,
+        hugetlb: opt.mbeval_hugetlb,
+        numa_interleave: opt.mbeval_numa_interleave,
+    });
+    if let Some(path) = &opt.mbeval_snapshot {
+        if !init_mbeval_from_snapshot(path).expect("mbeval snapshot path") {
+            tracing::warn!("mbeval snapshot {} missing or stale", path.display());
+        }
+    }
     let mut tablebase = Tablebase::new();
+    tablebase.set_block_cache_capacity(opt.block_cache_mib * 1024 * 1024);
+    tablebase.set_position_cache_capacity(opt.position_cache_entries);
+    let access = if opt.mmap {
+        TableAccess::Mmap
+    } else {
+        TableAccess::Pread
+    };
     for path in opt.path {
-        let num = tablebase.add_path(&path).expect("add path");
+        let num = tablebase
+            .add_path_with_access(&path, access)
+            .expect("add path");
         tracing::info!("loaded {} tables from {}", num, path.display());
     }
+    if let Some(path) = &opt.predictor {
+        if opt.seed_predictor {
+            tablebase.seed_predictor().expect("seed predictor");
+            tablebase.predictor().save(path).expect("save predictor");
+            println!("wrote {}", path.display());
+            return;
+        }
+        match tablebase.predictor().load(path) {
+            Ok(()) => tracing::info!(
+                "loaded {} predictor keys from {}",
+                tablebase.predictor().len(),
+                path.display()
+            ),
+            Err(err) if err.kind() == io::ErrorKind::NotFound => {
+                tracing::warn!("predictor {} missing", path.display());
+            }
+            Err(err) => panic!("load predictor: {err}"),
+        }
+    }
 
     // Start server
     let state: &'static AppState = Box::leak(Box::new(AppState {
@@ -199,6 +302,23 @@ async fn main() {
         stats: AppStats::default(),
     }));
 
+    if let Some(path) = opt.predictor.clone() {
+        tokio::spawn(async move {
+            let mut interval = tokio::time::interval(PREDICTOR_SAVE_INTERVAL);
+            interval.tick().await;
+            loop {
+                interval.tick().await;
+                let path = path.clone();
+                let saved = task::spawn_blocking(move || state.tablebase.predictor().save(&path))
+                    .await
+                    .expect("blocking predictor save");
+                if let Err(error) = saved {
+                    tracing::error!(%error, "predictor save fail");
+                }
+            }
+        });
+    }
+
     let app = Router::new()
         .route("/probe", get(handle_probe))
         .route("/monitor", get(handle_monitor))
@@ -209,13 +329,39 @@ async fn main() {
     if let Ok(Some(uds)) = fds.take_unix_listener(0) {
         uds.set_nonblocking(true).expect("set nonblocking");
         let listener = UnixListener::from_std(uds).expect("listener");
-        axum::serve(listener, app).await.expect("serve");
+        axum::serve(listener, app)
+            .with_graceful_shutdown(shutdown_signal())
+            .await
+            .expect("serve");
     } else if let Ok(Some(tcp)) = fds.take_tcp_listener(0) {
         tcp.set_nonblocking(true).expect("set nonblocking");
         let listener = TcpListener::from_std(tcp).expect("listener");
-        axum::serve(listener, app).await.expect("serve");
+        axum::serve(listener, app)
+            .with_graceful_shutdown(shutdown_signal())
+            .await
+            .expect("serve");
     } else {
         let listener = TcpListener::bind(&opt.bind).await.expect("bind");
-        axum::serve(listener, app).await.expect("serve");
+        axum::serve(listener, app)
+            .with_graceful_shutdown(shutdown_signal())
+            .await
+            .expect("serve");
+    }
+
+    // Keep what was learned since the last periodic save.
+    if let Some(path) = &opt.predictor {
+        match state.tablebase.predictor().save(path) {
+            Ok(()) => tracing::info!("saved predictor to {}", path.display()),
+            Err(error) => tracing::error!(%error, "predictor save fail"),
+        }
+    }
+}
+
+async fn shutdown_signal() {
+    let mut terminate =
+        signal::unix::signal(signal::unix::SignalKind::terminate()).expect("sigterm handler");
+    tokio::select! {
+        result = signal::ctrl_c() => result.expect("ctrl-c handler"),
+        _ = terminate.recv() => (),
     }
 }
@@ -0,0 +1,70 @@
+use std::{
+    ffi::{c_int, c_void},
+    fs::File,
+    io, ops,
+    os::fd::AsRawFd as _,
+    ptr, slice,
+};
+
+/// Read-only shared mapping of an entire file.
+pub(crate) struct Mmap {
+    ptr: *mut c_void,
+    len: usize,
+}
+
+// The mapping is read-only and never changes after construction.
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+
+impl Mmap {
+    pub(crate) fn map(file: &File) -> io::Result<Mmap> {
+        let len = usize::try_from(file.metadata()?.len())
+            .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "file too large to map"))?;
+        if len == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::UnexpectedEof,
+                "cannot map empty file",
+            ));
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(Mmap { ptr, len })
+    }
+
+    pub(crate) fn advise(&self, advice: c_int) -> io::Result<()> {
+        if unsafe { libc::madvise(self.ptr, self.len, advice) } < 0 {
+            Err(io::Error::last_os_error())
+        } else {
+            Ok(())
+        }
+    }
+}
+
+impl ops::Deref for Mmap {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr.cast::<u8>(), self.len) }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
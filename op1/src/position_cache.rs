@@ -0,0 +1,225 @@
+use std::{
+    collections::VecDeque,
+    hash::{BuildHasher as _, Hash},
+    sync::{
+        Mutex,
+        atomic::{AtomicU64, Ordering},
+    },
+};
+
+use mbeval_sys::ZIndex;
+use rustc_hash::{FxBuildHasher, FxHashMap, FxHashSet};
+
+use crate::table::SideValue;
+
+const NUM_SHARDS: usize = 64;
+
+/// Highest access count remembered for an entry.
+const MAX_FREQ: u8 = 3;
+
+/// Identifies a position by its entry in an Mb table. Table indices are
+/// symmetry reduced, and a position and its colour-mirrored counterpart are
+/// looked up in the same table, so they share a key.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct PositionKey {
+    pub table_id: u32,
+    pub index: ZIndex,
+}
+
+/// Values of recently probed positions for one side, shared by all probing
+/// threads. The number of entries is bounded by a budget that is split evenly
+/// across independently locked shards.
+///
+/// Each shard evicts with S3-FIFO: new entries enter a small queue, and only
+/// those that are looked up again before they reach its end move on to the
+/// main queue. Positions seen once, like those of a scan through a game
+/// database, therefore do not displace frequently probed ones.
+pub struct PositionCache {
+    shards: Box<[Mutex<Shard>]>,
+    shard_capacity: usize,
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+#[derive(Default)]
+struct Shard {
+    entries: FxHashMap<PositionKey, Entry>,
+    small: VecDeque<PositionKey>,
+    main: VecDeque<PositionKey>,
+    /// Keys recently evicted from the small queue, which go straight to the
+    /// main queue when inserted again.
+    ghosts: FxHashSet<PositionKey>,
+    ghost_order: VecDeque<PositionKey>,
+}
+
+struct Entry {
+    value: SideValue,
+    freq: u8,
+}
+
+impl PositionCache {
+    pub(crate) fn new(capacity: usize) -> PositionCache {
+        PositionCache {
+            shards: (0..NUM_SHARDS)
+                .map(|_| Mutex::new(Shard::default()))
+                .collect(),
+            shard_capacity: capacity.div_ceil(NUM_SHARDS),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+        }
+    }
+
+    fn shard(&self, key: &PositionKey) -> &Mutex<Shard> {
+        &self.shards[FxBuildHasher.hash_one(key) as usize % NUM_SHARDS]
+    }
+
+    pub(crate) fn get(&self, key: &PositionKey) -> Option<SideValue> {
+        let mut shard = self.shard(key).lock().expect("position cache shard");
+        let value = shard.entries.get_mut(key).map(|entry| {
+            entry.freq = (entry.freq + 1).min(MAX_FREQ);
+            entry.value
+        });
+        drop(shard);
+
+        if value.is_some() {
+            self.hits.fetch_add(1, Ordering::Relaxed);
+        } else {
+            self.misses.fetch_add(1, Ordering::Relaxed);
+        }
+        value
+    }
+
+    pub(crate) fn insert(&self, key: PositionKey, value: SideValue) {
+        let mut shard = self.shard(&key).lock().expect("position cache shard");
+
+        if let Some(entry) = shard.entries.get_mut(&key) {
+            entry.value = value;
+            return;
+        }
+
+        while shard.entries.len() >= self.shard_capacity {
+            if !shard.evict(self.shard_capacity) {
+                return;
+            }
+        }
+
+        if shard.ghosts.remove(&key) {
+            shard.main.push_back(key);
+        } else {
+            shard.small.push_back(key);
+        }
+        shard.entries.insert(key, Entry { value, freq: 0 });
+    }
+
+    pub fn hits(&self) -> u64 {
+        self.hits.load(Ordering::Relaxed)
+    }
+
+    pub fn misses(&self) -> u64 {
+        self.misses.load(Ordering::Relaxed)
+    }
+
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().expect("position cache shard").entries.len())
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+impl Shard {
+    /// Evicts one entry. Returns `false` if there is nothing to evict.
+    fn evict(&mut self, capacity: usize) -> bool {
+        loop {
+            // Keep the small queue at about a tenth of the entries.
+            if self.small.len() > capacity / 10 || self.main.is_empty() {
+                let Some(key) = self.small.pop_front() else {
+                    return false;
+                };
+                let entry = self.entries.get_mut(&key).expect("small queue entry");
+                if entry.freq > 0 {
+                    entry.freq = 0;
+                    self.main.push_back(key);
+                } else {
+                    self.entries.remove(&key);
+                    self.remember_ghost(key, capacity);
+                    return true;
+                }
+            } else {
+                let key = self.main.pop_front().expect("main queue entry");
+                let entry = self.entries.get_mut(&key).expect("main queue entry");
+                if entry.freq > 0 {
+                    entry.freq -= 1;
+                    self.main.push_back(key);
+                } else {
+                    self.entries.remove(&key);
+                    return true;
+                }
+            }
+        }
+    }
+
+    fn remember_ghost(&mut self, key: PositionKey, capacity: usize) {
+        if self.ghosts.insert(key) {
+            self.ghost_order.push_back(key);
+        }
+        while self.ghost_order.len() > capacity {
+            if let Some(forgotten) = self.ghost_order.pop_front() {
+                self.ghosts.remove(&forgotten);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key(index: ZIndex) -> PositionKey {
+        PositionKey { table_id: 0, index }
+    }
+
+    #[test]
+    fn test_position_cache_budget() {
+        let cache = PositionCache::new(NUM_SHARDS * 100);
+
+        for index in 0..100_000 {
+            cache.insert(key(index), SideValue::Dtc(index as u32));
+        }
+
+        assert!(cache.len() <= NUM_SHARDS * 100);
+        assert!(matches!(
+            cache.get(&key(99_999)),
+            Some(SideValue::Dtc(99_999))
+        ));
+    }
+
+    #[test]
+    fn test_position_cache_scan_resistance() {
+        let cache = PositionCache::new(NUM_SHARDS * 100);
+
+        // A working set of half the capacity, probed repeatedly
+        let hot = 0..(NUM_SHARDS * 50) as ZIndex;
+        for _ in 0..2 {
+            for index in hot.clone() {
+                if cache.get(&key(index)).is_none() {
+                    cache.insert(key(index), SideValue::Unresolved);
+                }
+            }
+        }
+
+        // A scan through many positions that are probed once
+        for index in 1_000_000..1_100_000 {
+            cache.insert(key(index), SideValue::Unresolved);
+        }
+
+        let retained = hot
+            .filter(|&index| cache.get(&key(index)).is_some())
+            .count();
+        assert!(retained > NUM_SHARDS * 45, "retained {retained}");
+    }
+}
@@ -0,0 +1,283 @@
+use std::{
+    fs,
+    io::{self, BufRead as _, BufReader, BufWriter, Write as _},
+    path::Path,
+    sync::{
+        Mutex, RwLock,
+        atomic::{AtomicU64, Ordering},
+    },
+};
+
+use mbeval_sys::PawnFileType;
+use rustc_hash::FxHashMap;
+use shakmaty::Color;
+
+use crate::tablebase::{
+    Material, material_name, parse_material, parse_pawn_file_type, pawn_file_type_name,
+};
+
+/// Outcomes needed for both sides before the learned ratios are trusted over
+/// the material heuristic.
+const MIN_SAMPLES: u64 = 16;
+
+/// Weight of the share of resolved entries seeded from the tables, in probe
+/// outcomes. Enough to predict before any probes, but few enough that the
+/// outcomes observed online soon take over.
+const PRIOR_SAMPLES: u64 = 4 * MIN_SAMPLES;
+
+/// Identifies the Mb tables of a side, as oriented for mbeval: `material` and
+/// `side` to move with the side tried playing white.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct PredictorKey {
+    pub material: Material,
+    pub side: Color,
+    pub pawn_file_type: PawnFileType,
+}
+
+/// Learns which side to try first from the outcomes of earlier probes.
+///
+/// For each key it counts how many of the positions looked up were resolved,
+/// that is, won by the side tried. The side whose key has the larger share of
+/// resolved positions is predicted to be the winner, which saves probing the
+/// other side as well. The counts can be seeded from the tables themselves,
+/// as a prior worth a few probes, and saved across restarts.
+#[derive(Default)]
+pub struct WinnerPredictor {
+    counts: RwLock<FxHashMap<PredictorKey, Counts>>,
+    /// Held while saving, since saves share the temporary file.
+    saving: Mutex<()>,
+}
+
+#[derive(Default)]
+struct Counts {
+    resolved: AtomicU64,
+    total: AtomicU64,
+}
+
+impl WinnerPredictor {
+    pub fn new() -> WinnerPredictor {
+        WinnerPredictor::default()
+    }
+
+    /// Predicts the winner given the keys for white and black winning, or
+    /// `None` if there is not enough data to tell.
+    pub(crate) fn predict(&self, keys: &[Option<PredictorKey>; 2]) -> Option<Color> {
+        let counts = self.counts.read().expect("predictor counts");
+        let [white, black] = keys.map(|key| {
+            let counts = counts.get(&key?)?;
+            let total = counts.total.load(Ordering::Relaxed);
+            (total >= MIN_SAMPLES).then(|| {
+                (
+                    u128::from(counts.resolved.load(Ordering::Relaxed)),
+                    u128::from(total),
+                )
+            })
+        });
+        let ((white_resolved, white_total), (black_resolved, black_total)) = (white?, black?);
+
+        // Compare the shares of resolved positions without dividing.
+        let white_share = white_resolved * black_total;
+        let black_share = black_resolved * white_total;
+        if white_share > black_share {
+            Some(Color::White)
+        } else if black_share > white_share {
+            Some(Color::Black)
+        } else {
+            None
+        }
+    }
+
+    /// Records that `total` positions with the key were looked up, of which
+    /// `resolved` were won by the side tried.
+    pub(crate) fn record(&self, key: PredictorKey, resolved: u64, total: u64) {
+        {
+            let counts = self.counts.read().expect("predictor counts");
+            if let Some(counts) = counts.get(&key) {
+                counts.add(resolved, total);
+                return;
+            }
+        }
+        self.counts
+            .write()
+            .expect("predictor counts")
+            .entry(key)
+            .or_default()
+            .add(resolved, total);
+    }
+
+    /// Records the share of resolved entries in the tables of the key as a
+    /// prior, counted as `PRIOR_SAMPLES` outcomes however many entries the
+    /// tables have.
+    pub(crate) fn record_prior(&self, key: PredictorKey, resolved: u64, total: u64) {
+        if total == 0 {
+            return;
+        }
+        let prior_resolved = (u128::from(resolved) * u128::from(PRIOR_SAMPLES)
+            + u128::from(total) / 2)
+            / u128::from(total);
+        self.record(key, prior_resolved as u64, PRIOR_SAMPLES);
+    }
+
+    /// Number of keys with any outcomes.
+    pub fn len(&self) -> usize {
+        self.counts.read().expect("predictor counts").len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Loads counts written by [`WinnerPredictor::save`], adding them to the
+    /// current ones.
+    pub fn load(&self, path: &Path) -> io::Result<()> {
+        let invalid = |line: &str| {
+            io::Error::new(
+                io::ErrorKind::InvalidData,
+                format!("invalid predictor line: {line}"),
+            )
+        };
+
+        for line in BufReader::new(fs::File::open(path)?).lines() {
+            let line = line?;
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+            let mut parts = line.split(' ');
+            let (
+                Some(material),
+                Some(pawn_file_type),
+                Some(side),
+                Some(resolved),
+                Some(total),
+                None,
+            ) = (
+                parts.next().and_then(parse_material),
+                parts.next().and_then(|s| match s {
+                    "-" => Some(PawnFileType::Free),
+                    s => parse_pawn_file_type(s),
+                }),
+                parts
+                    .next()
+                    .and_then(|s| s.parse::<char>().ok())
+                    .and_then(Color::from_char),
+                parts.next().and_then(|s| s.parse().ok()),
+                parts.next().and_then(|s| s.parse().ok()),
+                parts.next(),
+            )
+            else {
+                return Err(invalid(&line));
+            };
+            if resolved > total {
+                return Err(invalid(&line));
+            }
+            self.record(
+                PredictorKey {
+                    material,
+                    side,
+                    pawn_file_type,
+                },
+                resolved,
+                total,
+            );
+        }
+        Ok(())
+    }
+
+    /// Saves the counts to a small text file, replacing it atomically.
+    pub fn save(&self, path: &Path) -> io::Result<()> {
+        let _saving = self.saving.lock().expect("predictor saving");
+        let tmp = path.with_extension("tmp");
+        {
+            let mut writer = BufWriter::new(fs::File::create(&tmp)?);
+            writeln!(writer, "# material pawn_file_type side resolved total")?;
+            let counts = self.counts.read().expect("predictor counts");
+            for (key, counts) in counts.iter() {
+                writeln!(
+                    writer,
+                    "{} {} {} {} {}",
+                    material_name(&key.material),
+                    pawn_file_type_name(key.pawn_file_type).unwrap_or("-"),
+                    key.side.char(),
+                    counts.resolved.load(Ordering::Relaxed),
+                    counts.total.load(Ordering::Relaxed),
+                )?;
+            }
+            writer
+                .into_inner()
+                .map_err(|err| err.into_error())?
+                .sync_all()?;
+        }
+        fs::rename(tmp, path)
+    }
+}
+
+impl Counts {
+    fn add(&self, resolved: u64, total: u64) {
+        self.resolved.fetch_add(resolved, Ordering::Relaxed);
+        self.total.fetch_add(total, Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use shakmaty::{ByColor, ByRole};
+
+    use super::*;
+
+    fn key(side: Color) -> PredictorKey {
+        PredictorKey {
+            material: ByColor {
+                white: ByRole {
+                    rook: 1,
+                    pawn: 2,
+                    king: 1,
+                    ..ByRole::default()
+                },
+                black: ByRole {
+                    knight: 1,
+                    pawn: 3,
+                    king: 1,
+                    ..ByRole::default()
+                },
+            },
+            side,
+            pawn_file_type: PawnFileType::Op21,
+        }
+    }
+
+    #[test]
+    fn test_predictor() {
+        let predictor = WinnerPredictor::new();
+        let keys = [Some(key(Color::White)), Some(key(Color::Black))];
+        assert_eq!(predictor.predict(&keys), None);
+
+        predictor.record(key(Color::White), 3, 20);
+        predictor.record(key(Color::Black), 15, 20);
+        assert_eq!(predictor.predict(&keys), Some(Color::Black));
+        assert_eq!(predictor.predict(&[keys[0], None]), None);
+
+        let path = std::env::temp_dir().join(format!("op1-predictor-{}", std::process::id()));
+        predictor.save(&path).unwrap();
+        let loaded = WinnerPredictor::new();
+        loaded.load(&path).unwrap();
+        fs::remove_file(&path).unwrap();
+        assert_eq!(loaded.len(), 2);
+        assert_eq!(loaded.predict(&keys), Some(Color::Black));
+    }
+
+    #[test]
+    fn test_prior_yields_to_outcomes() {
+        let predictor = WinnerPredictor::new();
+        let keys = [Some(key(Color::White)), Some(key(Color::Black))];
+
+        predictor.record_prior(key(Color::White), 6_000_000_000, 10_000_000_000);
+        predictor.record_prior(key(Color::Black), 4_000_000_000, 10_000_000_000);
+        assert_eq!(predictor.predict(&keys), Some(Color::White));
+
+        for _ in 0..100 {
+            predictor.record(key(Color::White), 0, 1);
+            predictor.record(key(Color::Black), 1, 1);
+        }
+        assert_eq!(predictor.predict(&keys), Some(Color::Black));
+    }
+}
@@ -0,0 +1,314 @@
+use std::{
+    ffi::CStr,
+    fs::{self, File},
+    io::{self, BufWriter, Write as _},
+    mem,
+    os::unix::fs::FileExt as _,
+    path::Path,
+    time::{Duration, Instant},
+};
+
+use zerocopy::{
+    FromBytes, FromZeros, IntoBytes,
+    little_endian::{U32, U64},
+};
+use zstd_sys::{
+    ZSTD_CCtx, ZSTD_compressCCtx, ZSTD_createCCtx, ZSTD_freeCCtx, ZSTD_getErrorName, ZSTD_isError,
+};
+
+use crate::{
+    decompressor::{Decompressor, max_compressed_size},
+    table::{
+        COMPRESSION_ZSTD_FRAMES, CompressionMethod, FrameIndexHeader, MAX_FRAMES_PER_BLOCK,
+        RawHeader,
+    },
+};
+
+#[derive(Debug, Clone)]
+pub struct RepackOptions {
+    /// Decompressed size of each frame.
+    pub frame_size: u32,
+    /// Zstd compression level of the frames.
+    pub level: i32,
+    /// Number of random entries of each block to time decompression with.
+    pub samples_per_block: usize,
+}
+
+/// Sizes and sampled decompression times of a table before and after
+/// repacking.
+#[derive(Debug, Default)]
+pub struct RepackReport {
+    pub blocks: u32,
+    pub frames: u64,
+    pub original_size: u64,
+    pub repacked_size: u64,
+    pub samples: u64,
+    /// Total time spent probing the sampled entries in the original blocks:
+    /// decompressing up to the entry, or reading the whole block if it is
+    /// uncompressed.
+    pub original_decompression: Duration,
+    /// Total time spent decompressing the sampled entries from the frames.
+    pub repacked_decompression: Duration,
+}
+
+impl RepackReport {
+    /// Relative growth of the file, for example `0.05` for 5% larger.
+    pub fn size_overhead(&self) -> f64 {
+        self.repacked_size as f64 / self.original_size as f64 - 1.0
+    }
+
+    pub fn mean_original_decompression(&self) -> Duration {
+        self.original_decompression
+            .div_f64(self.samples.max(1) as f64)
+    }
+
+    pub fn mean_repacked_decompression(&self) -> Duration {
+        self.repacked_decompression
+            .div_f64(self.samples.max(1) as f64)
+    }
+}
+
+/// Repacks an Mb table into the seekable format, where each block is split
+/// into independently compressed frames, so that a probe decompresses only
+/// the frame holding its entry.
+///
+/// Writes the result to `output`, if given, replacing it atomically. The
+/// output may be the input itself. Sampled entries are checked against the
+/// original block.
+pub fn repack_seekable(
+    input: &Path,
+    output: Option<&Path>,
+    options: &RepackOptions,
+) -> io::Result<RepackReport> {
+    let invalid = |msg: &str| io::Error::new(io::ErrorKind::InvalidData, msg.to_owned());
+
+    let mut file = File::open(input)?;
+    let mut raw = RawHeader::read_from_io(&mut file)?;
+    if raw.list_element_size != 1 {
+        return Err(invalid("only mb tables can be repacked"));
+    }
+    let compression_method = CompressionMethod::try_from(raw.compression_method)?;
+    if let CompressionMethod::ZstdFrames = compression_method {
+        return Err(invalid("table already repacked"));
+    }
+
+    let block_size = raw.block_size.get() as usize;
+    let frame_size = options.frame_size as usize;
+    if frame_size == 0 || block_size.div_ceil(frame_size) > MAX_FRAMES_PER_BLOCK {
+        return Err(invalid("frame size too small for block size"));
+    }
+
+    let num_blocks = raw.num_blocks.get();
+    let mut offsets = <[U64]>::new_box_zeroed_with_elems(num_blocks as usize + 1)
+        .expect("allocate offsets vector");
+    file.read_exact_at(offsets.as_mut_bytes(), mem::size_of::<RawHeader>() as u64)?;
+
+    let mut report = RepackReport {
+        blocks: num_blocks,
+        original_size: file.metadata()?.len(),
+        ..RepackReport::default()
+    };
+
+    let tmp = output.map(|path| path.with_extension("tmp"));
+    let mut writer = match tmp {
+        Some(ref tmp) => {
+            let mut writer = BufWriter::new(File::create(tmp)?);
+            raw.compression_method = COMPRESSION_ZSTD_FRAMES;
+            writer.write_all(raw.as_bytes())?;
+            // Placeholder for the offsets, written once the blocks are.
+            writer.write_all(offsets.as_bytes())?;
+            Some(writer)
+        }
+        None => None,
+    };
+
+    let mut repacked_offsets = <[U64]>::new_box_zeroed_with_elems(num_blocks as usize + 1)
+        .expect("allocate offsets vector");
+    let mut position = (mem::size_of::<RawHeader>() + offsets.as_bytes().len()) as u64;
+
+    let mut compressor = Compressor::new();
+    let mut decompressor = Decompressor::new();
+    let mut rng = SplitMix64(0x7265_7061_636b);
+    let mut compressed_block = Vec::new();
+    let mut decompressed_block = Vec::new();
+    let mut reread_block = Vec::new();
+    let mut repacked_block = Vec::new();
+    let mut frame_offsets = Vec::new();
+    let mut frame = Vec::new();
+    let mut decompressed = Vec::with_capacity(block_size);
+
+    for block_index in 0..num_blocks as usize {
+        let (start, end) = (offsets[block_index].get(), offsets[block_index + 1].get());
+        let size = end
+            .checked_sub(start)
+            .ok_or_else(|| invalid("block offsets not monotonic"))?;
+        compressed_block.resize(size as usize, 0);
+        file.read_exact_at(&mut compressed_block, start)?;
+
+        let block = match compression_method {
+            CompressionMethod::None => {
+                reread_block.resize(compressed_block.len(), 0);
+                &compressed_block[..]
+            }
+            _ => {
+                decompressor.decompress_prefix(
+                    &compressed_block,
+                    &mut decompressed_block,
+                    block_size,
+                )?;
+                &decompressed_block[..]
+            }
+        };
+
+        // Compress the frames after the index, then fill in the index.
+        let num_frames = block.len().div_ceil(frame_size);
+        let index_len =
+            mem::size_of::<FrameIndexHeader>() + (num_frames + 1) * mem::size_of::<U32>();
+        repacked_block.clear();
+        repacked_block.resize(index_len, 0);
+        frame_offsets.clear();
+        for chunk in block.chunks(frame_size) {
+            frame_offsets.push(U32::new(repacked_block.len() as u32));
+            compressor.compress(chunk, options.level, &mut frame)?;
+            repacked_block.extend_from_slice(&frame);
+        }
+        frame_offsets.push(U32::new(repacked_block.len() as u32));
+        let header = FrameIndexHeader {
+            frame_size: U32::new(options.frame_size),
+            num_frames: U32::new(num_frames as u32),
+        };
+        let (index_header, index_offsets) =
+            repacked_block[..index_len].split_at_mut(mem::size_of::<FrameIndexHeader>());
+        index_header.copy_from_slice(header.as_bytes());
+        index_offsets.copy_from_slice(frame_offsets.as_bytes());
+        report.frames += num_frames as u64;
+
+        // Time probing random entries in the original block, decompressing
+        // up to the entry or reading the uncompressed block, and decompressing
+        // up to the entry from the start of its frame.
+        let samples = if block.is_empty() {
+            0
+        } else {
+            options.samples_per_block
+        };
+        for _ in 0..samples {
+            let byte_index = (rng.next() % block.len() as u64) as usize;
+
+            let started = Instant::now();
+            match compression_method {
+                // Uncompressed blocks are read whole, like read_mb does.
+                CompressionMethod::None => file.read_exact_at(&mut reread_block, start)?,
+                _ => decompressor.decompress_bytes(
+                    &compressed_block,
+                    &mut decompressed,
+                    byte_index + 1,
+                    false,
+                )?,
+            }
+            report.original_decompression += started.elapsed();
+
+            let frame_index = byte_index / frame_size;
+            let compressed_frame = &repacked_block[frame_offsets[frame_index].get() as usize
+                ..frame_offsets[frame_index + 1].get() as usize];
+            let offset = byte_index - frame_index * frame_size;
+            let started = Instant::now();
+            decompressor.decompress_bytes(
+                compressed_frame,
+                &mut decompressed,
+                offset + 1,
+                false,
+            )?;
+            report.repacked_decompression += started.elapsed();
+
+            if decompressed.get(offset) != Some(&block[byte_index]) {
+                return Err(invalid("repacked entry differs from original"));
+            }
+            report.samples += 1;
+        }
+
+        repacked_offsets[block_index] = U64::new(position);
+        position += repacked_block.len() as u64;
+        if let Some(ref mut writer) = writer {
+            writer.write_all(&repacked_block)?;
+        }
+    }
+    repacked_offsets[num_blocks as usize] = U64::new(position);
+
+    // Whatever follows the last block, though Mb tables have nothing there.
+    let trailer_len = report
+        .original_size
+        .saturating_sub(offsets[num_blocks as usize].get());
+    report.repacked_size = position + trailer_len;
+
+    if let (Some(mut writer), Some(tmp), Some(output)) = (writer, tmp, output) {
+        let mut trailer = vec![0; trailer_len as usize];
+        file.read_exact_at(&mut trailer, offsets[num_blocks as usize].get())?;
+        writer.write_all(&trailer)?;
+
+        let file = writer.into_inner().map_err(|err| err.into_error())?;
+        file.write_all_at(
+            repacked_offsets.as_bytes(),
+            mem::size_of::<RawHeader>() as u64,
+        )?;
+        file.sync_all()?;
+        fs::rename(tmp, output)?;
+    }
+
+    Ok(report)
+}
+
+struct Compressor {
+    ctx: *mut ZSTD_CCtx,
+}
+
+impl Compressor {
+    fn new() -> Compressor {
+        let ctx = unsafe { ZSTD_createCCtx() };
+        assert!(!ctx.is_null());
+        Compressor { ctx }
+    }
+
+    fn compress(&mut self, src: &[u8], level: i32, dst: &mut Vec<u8>) -> io::Result<()> {
+        dst.clear();
+        dst.reserve(max_compressed_size(src.len()));
+        let result = unsafe {
+            ZSTD_compressCCtx(
+                self.ctx,
+                dst.as_mut_ptr().cast(),
+                dst.capacity(),
+                src.as_ptr().cast(),
+                src.len(),
+                level,
+            )
+        };
+        if unsafe { ZSTD_isError(result) } != 0 {
+            return Err(io::Error::other(unsafe {
+                CStr::from_ptr(ZSTD_getErrorName(result))
+                    .to_str()
+                    .expect("zstd error")
+            }));
+        }
+        unsafe {
+            dst.set_len(result);
+        }
+        Ok(())
+    }
+}
+
+impl Drop for Compressor {
+    fn drop(&mut self) {
+        unsafe { ZSTD_freeCCtx(self.ctx) };
+    }
+}
+
+struct SplitMix64(u64);
+
+impl SplitMix64 {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        z ^ (z >> 31)
+    }
+}
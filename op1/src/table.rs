@@ -5,28 +5,58 @@ use std::{
     io::Read,
     mem,
     num::NonZeroU32,
+    ops::Range,
     os::{fd::AsRawFd as _, unix::fs::FileExt as _},
     path::Path,
+    sync::Arc,
 };
 
 use mbeval_sys::ZIndex;
 use zerocopy::{
-    FromBytes, FromZeros, Immutable, IntoBytes,
+    FromBytes, FromZeros, Immutable, IntoBytes, KnownLayout,
     little_endian::{U32, U64},
 };
 
-use crate::decompressor::Decompressor;
+use crate::{
+    block_cache::{BlockCache, BlockKey},
+    decompressor::{Decompressor, max_compressed_size},
+    mmap::Mmap,
+};
 
 pub(crate) struct Table {
+    id: u32,
     table_type: TableType,
-    file: File,
     header: Header,
-    offsets: Box<[U64]>,
-    starting_indices: Box<[U64]>,
+    storage: Storage,
+}
+
+/// How table files are accessed when probing.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub enum TableAccess {
+    /// Read each compressed block into a buffer with `pread`.
+    #[default]
+    Pread,
+    /// Map the entire file and decompress directly from the mapping, leaving
+    /// caching of compressed blocks to the kernel page cache.
+    Mmap,
+}
+
+enum Storage {
+    Pread {
+        file: File,
+        offsets: Box<[U64]>,
+        starting_indices: Box<[U64]>,
+    },
+    Mmap(Mmap),
 }
 
 impl Table {
-    pub(crate) fn open(path: &Path, table_type: TableType) -> io::Result<Table> {
+    pub(crate) fn open(
+        path: &Path,
+        table_type: TableType,
+        id: u32,
+        access: TableAccess,
+    ) -> io::Result<Table> {
         tracing::trace!("try open table: {}", path.display());
 
         let mut file = File::open(path)?;
@@ -55,6 +85,15 @@ impl Table {
             ));
         }
 
+        if table_type == TableType::HighDtc
+            && matches!(header.compression_method, CompressionMethod::ZstdFrames)
+        {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "seekable frames not supported for high dtc tables",
+            ));
+        }
+
         if i32::try_from(header.max_dtc).is_err() {
             return Err(io::Error::new(
                 io::ErrorKind::InvalidData,
@@ -62,41 +101,107 @@ impl Table {
             ));
         }
 
-        let mut offsets = <[U64]>::new_box_zeroed_with_elems(header.num_blocks as usize + 1)
-            .expect("allocate offsets vector");
-        file.read_exact(offsets.as_mut_bytes())?;
-
-        let starting_indices = match table_type {
-            TableType::Mb => Box::default(),
-            TableType::HighDtc => {
-                let mut starting_indices =
+        let storage = match access {
+            TableAccess::Pread => {
+                let mut offsets =
                     <[U64]>::new_box_zeroed_with_elems(header.num_blocks as usize + 1)
-                        .expect("allocate starting indices vector");
-                file.read_exact(starting_indices.as_mut_bytes())?;
-                starting_indices
+                        .expect("allocate offsets vector");
+                file.read_exact(offsets.as_mut_bytes())?;
+
+                let starting_indices = match table_type {
+                    TableType::Mb => Box::default(),
+                    TableType::HighDtc => {
+                        let mut starting_indices =
+                            <[U64]>::new_box_zeroed_with_elems(header.num_blocks as usize + 1)
+                                .expect("allocate starting indices vector");
+                        file.read_exact(starting_indices.as_mut_bytes())?;
+                        starting_indices
+                    }
+                };
+
+                fadvise(&file, libc::POSIX_FADV_RANDOM)?;
+
+                Storage::Pread {
+                    file,
+                    offsets,
+                    starting_indices,
+                }
+            }
+            TableAccess::Mmap => {
+                let mmap = Mmap::map(&file)?;
+                mmap.advise(libc::MADV_RANDOM)?;
+
+                let index_end = match table_type {
+                    TableType::Mb => header.offsets_range().end,
+                    TableType::HighDtc => header.starting_indices_range().end,
+                };
+                if mmap.len() < index_end {
+                    return Err(io::Error::new(
+                        io::ErrorKind::UnexpectedEof,
+                        format!("table {} truncated", path.display()),
+                    ));
+                }
+
+                Storage::Mmap(mmap)
             }
         };
 
-        fadvise(&file, libc::POSIX_FADV_RANDOM)?;
-
         Ok(Table {
+            id,
             table_type,
-            file,
             header,
-            offsets,
-            starting_indices,
+            storage,
         })
     }
 
+    fn offsets(&self) -> &[U64] {
+        match self.storage {
+            Storage::Pread { ref offsets, .. } => &offsets[..],
+            Storage::Mmap(ref mmap) => {
+                <[U64]>::ref_from_bytes(&mmap[self.header.offsets_range()]).expect("mapped offsets")
+            }
+        }
+    }
+
+    fn starting_indices(&self) -> &[U64] {
+        match self.storage {
+            Storage::Pread {
+                ref starting_indices,
+                ..
+            } => &starting_indices[..],
+            Storage::Mmap(ref mmap) => {
+                <[U64]>::ref_from_bytes(&mmap[self.header.starting_indices_range()])
+                    .expect("mapped starting indices")
+            }
+        }
+    }
+
     fn block_offset(&self, block_index: u32) -> io::Result<u64> {
-        self.offsets
+        self.offsets()
             .get(block_index as usize)
             .copied()
             .map(u64::from)
             .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidInput, "block index out of range"))
     }
 
-    fn load_compressed_block(&self, block_index: u32, ctx: &mut ProbeContext) -> io::Result<()> {
+    /// Returns the compressed block, either read into `buf` or borrowed
+    /// directly from the mapped file.
+    fn compressed_block<'a>(
+        &'a self,
+        block_index: u32,
+        buf: &'a mut Vec<u8>,
+    ) -> io::Result<&'a [u8]> {
+        self.compressed_block_part(block_index, 0..usize::MAX, buf)
+    }
+
+    /// Like [`Table::compressed_block`], but only the bytes in `range`,
+    /// relative to the start of the block and clamped to its end.
+    fn compressed_block_part<'a>(
+        &'a self,
+        block_index: u32,
+        range: Range<usize>,
+        buf: &'a mut Vec<u8>,
+    ) -> io::Result<&'a [u8]> {
         let compressed_block_start = self.block_offset(block_index)?;
         let compressed_block_end =
             self.block_offset(block_index.checked_add(1).ok_or_else(|| {
@@ -107,35 +212,309 @@ impl Table {
             .ok_or_else(|| {
                 io::Error::new(io::ErrorKind::InvalidData, "block offsets not monotonic")
             })?;
+        let end = compressed_block_start + (range.end as u64).min(compressed_block_size);
+        let start = (compressed_block_start + range.start as u64).min(end);
+
+        match self.storage {
+            Storage::Pread { ref file, .. } => {
+                // Make room for any block of the table at once, so that the
+                // buffer stops growing after the first read.
+                buf.clear();
+                buf.reserve(max_compressed_size(self.header.block_size.get() as usize));
+                buf.resize((end - start) as usize, 0);
+                file.read_exact_at(&mut buf[..], start)?;
+                Ok(&buf[..])
+            }
+            Storage::Mmap(ref mmap) => mmap.get(start as usize..end as usize).ok_or_else(|| {
+                io::Error::new(
+                    io::ErrorKind::UnexpectedEof,
+                    "block offset beyond end of table",
+                )
+            }),
+        }
+    }
+
+    /// Returns the fully decompressed block, either from the cache or by
+    /// decompressing it and then adding it to the cache.
+    fn load_cached_block(
+        &self,
+        block_index: u32,
+        ctx: &mut ProbeContext,
+        cache: &BlockCache,
+    ) -> io::Result<Arc<Vec<u8>>> {
+        let key = BlockKey {
+            table_id: self.id,
+            block_index,
+        };
+
+        if let Some(block) = cache.get(&key) {
+            return Ok(block);
+        }
+
+        ctx.partial_mb_block = None;
+        let compressed_block = self.compressed_block(block_index, &mut ctx.compressed_block)?;
+
+        let block_size = self.header.block_size.get() as usize;
+        let mut block = Vec::with_capacity(block_size);
+        if let CompressionMethod::ZstdFrames = self.header.compression_method {
+            decompress_frames(
+                &mut ctx.decompressor,
+                compressed_block,
+                &mut block,
+                block_size,
+            )?;
+        } else {
+            ctx.decompressor
+                .decompress_prefix(compressed_block, &mut block, block_size)?;
+        }
+
+        let block = Arc::new(block);
+        cache.insert(key, Arc::clone(&block));
+        Ok(block)
+    }
+
+    /// The cache, unless it is too small to hold blocks of the table, in
+    /// which case probes are better off decompressing only what they need.
+    fn usable_cache<'a>(&self, cache: Option<&'a BlockCache>) -> Option<&'a BlockCache> {
+        cache.filter(|cache| cache.admits(self.header.block_size.get() as usize))
+    }
 
-        ctx.compressed_block
-            .resize(compressed_block_size as usize, 0);
-        self.file
-            .read_exact_at(&mut ctx.compressed_block[..], compressed_block_start)
+    pub(crate) fn id(&self) -> u32 {
+        self.id
     }
 
-    pub(crate) fn read_mb(&self, index: ZIndex, ctx: &mut ProbeContext) -> io::Result<MbValue> {
+    pub(crate) fn read_mb(
+        &self,
+        index: ZIndex,
+        ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
+    ) -> io::Result<MbValue> {
         assert_eq!(self.table_type, TableType::Mb);
+        let cache = self.usable_cache(cache);
 
-        let block_index = u32::try_from(index / u64::from(self.header.block_size.get()))
-            .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "index out of range"))?;
-        let byte_index = index % u64::from(self.header.block_size.get());
+        let (block_index, byte_index) = self.mb_position(index)?;
+        let value = match (&self.header.compression_method, cache) {
+            (CompressionMethod::ZstdFrames, None) => {
+                self.read_mb_frame_byte(block_index, byte_index, ctx)?
+            }
+            _ => self.with_mb_block(block_index, byte_index + 1, ctx, cache, |block| {
+                block.get(byte_index).copied()
+            })?,
+        };
+        self.mb_value(value, byte_index)
+    }
 
-        self.load_compressed_block(block_index, ctx)?;
+    /// Decompresses only the frame of a block in the seekable format that
+    /// holds the byte, and only up to the byte, continuing where the previous
+    /// probe stopped if it was into the same frame.
+    fn read_mb_frame_byte(
+        &self,
+        block_index: u32,
+        byte_index: usize,
+        ctx: &mut ProbeContext,
+    ) -> io::Result<Option<u8>> {
+        let key = BlockKey {
+            table_id: self.id,
+            block_index,
+        };
+        let (partial, resume) = match ctx.partial_mb_block.take() {
+            Some(partial) if partial.key == key && partial.bytes.contains(&byte_index) => {
+                (partial, true)
+            }
+            _ => {
+                let index_len = mem::size_of::<FrameIndexHeader>()
+                    + (MAX_FRAMES_PER_BLOCK + 1) * mem::size_of::<U32>();
+                let head = self.compressed_block_part(
+                    block_index,
+                    0..index_len,
+                    &mut ctx.compressed_block,
+                )?;
+                let (frame_size, offsets) = frame_index(head)?;
+                let frame = byte_index / frame_size;
+                let (Some(start), Some(end)) = (offsets.get(frame), offsets.get(frame + 1)) else {
+                    return Ok(None);
+                };
+                let compressed = start.get() as usize..end.get() as usize;
+                if compressed.is_empty() {
+                    return Err(io::Error::new(
+                        io::ErrorKind::InvalidData,
+                        "frame offsets not monotonic",
+                    ));
+                }
+                (
+                    PartialMbBlock {
+                        key,
+                        bytes: frame * frame_size..(frame + 1) * frame_size,
+                        compressed,
+                    },
+                    false,
+                )
+            }
+        };
 
-        let block = match self.header.compression_method {
-            CompressionMethod::None => &ctx.compressed_block,
-            CompressionMethod::Zstd => {
-                ctx.decompressor.decompress_prefix(
-                    &ctx.compressed_block,
+        let compressed_frame = match self.storage {
+            Storage::Pread { .. } if resume => &ctx.compressed_block[..],
+            _ => self.compressed_block_part(
+                block_index,
+                partial.compressed.clone(),
+                &mut ctx.compressed_block,
+            )?,
+        };
+        if !resume {
+            ctx.decompressed_block.clear();
+            ctx.decompressed_block.reserve(partial.bytes.len());
+        }
+        let offset = byte_index - partial.bytes.start;
+        ctx.decompressor.decompress_bytes(
+            compressed_frame,
+            &mut ctx.decompressed_block,
+            offset + 1,
+            resume,
+        )?;
+        let value = ctx.decompressed_block.get(offset).copied();
+        ctx.partial_mb_block = Some(partial);
+        Ok(value)
+    }
+
+    /// Like [`Table::read_mb`] for indices in ascending order, appending a
+    /// value for each of them to `values`. Each block is read and
+    /// decompressed once, up to the largest byte needed from it.
+    pub(crate) fn read_mb_sorted(
+        &self,
+        indices: &[ZIndex],
+        ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
+        values: &mut Vec<io::Result<MbValue>>,
+    ) {
+        assert_eq!(self.table_type, TableType::Mb);
+        let cache = self.usable_cache(cache);
+        debug_assert!(indices.is_sorted());
+
+        if let (CompressionMethod::ZstdFrames, None) = (&self.header.compression_method, cache) {
+            // Decompress only the frames holding the indices.
+            values.extend(indices.iter().map(|&index| self.read_mb(index, ctx, None)));
+            return;
+        }
+
+        let block_size = u64::from(self.header.block_size.get());
+        for group in indices.chunk_by(|a, b| a / block_size == b / block_size) {
+            let last = group[group.len() - 1];
+            let result = self
+                .mb_position(last)
+                .and_then(|(block_index, byte_index)| {
+                    self.with_mb_block(block_index, byte_index + 1, ctx, cache, |block| {
+                        values.extend(group.iter().map(|&index| {
+                            let byte_index = (index % block_size) as usize;
+                            self.mb_value(block.get(byte_index).copied(), byte_index)
+                        }));
+                    })
+                });
+            if let Err(err) = result {
+                values.extend(group.iter().map(|_| Err(copy_error(&err))));
+            }
+        }
+    }
+
+    /// Counts the entries of the table that are resolved, that is, won by
+    /// the side to which the table applies, and all entries.
+    pub(crate) fn count_resolved(&self, ctx: &mut ProbeContext) -> io::Result<(u64, u64)> {
+        assert_eq!(self.table_type, TableType::Mb);
+
+        let block_size = u64::from(self.header.block_size.get());
+        let mut resolved = 0;
+        let mut total = 0;
+        for block_index in 0..self.header.num_blocks {
+            let len = self
+                .header
+                .num_elements
+                .saturating_sub(u64::from(block_index) * block_size)
+                .min(block_size) as usize;
+            self.with_mb_block(block_index, len, ctx, None, |block| {
+                let block = &block[..len.min(block.len())];
+                resolved += block.iter().filter(|&&value| value != 255).count() as u64;
+                total += block.len() as u64;
+            })?;
+        }
+        Ok((resolved, total))
+    }
+
+    fn mb_position(&self, index: ZIndex) -> io::Result<(u32, usize)> {
+        let block_size = u64::from(self.header.block_size.get());
+        let block_index = u32::try_from(index / block_size)
+            .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "index out of range"))?;
+        Ok((block_index, (index % block_size) as usize))
+    }
+
+    /// Calls `f` with the block, of which at least the first `prefix_len`
+    /// bytes are decompressed.
+    fn with_mb_block<R>(
+        &self,
+        block_index: u32,
+        prefix_len: usize,
+        ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
+        f: impl FnOnce(&[u8]) -> R,
+    ) -> io::Result<R> {
+        Ok(match (&self.header.compression_method, cache) {
+            (CompressionMethod::Zstd | CompressionMethod::ZstdFrames, Some(cache)) => {
+                f(&self.load_cached_block(block_index, ctx, cache)?)
+            }
+            (CompressionMethod::None, _) => {
+                ctx.partial_mb_block = None;
+                f(self.compressed_block(block_index, &mut ctx.compressed_block)?)
+            }
+            (CompressionMethod::Zstd, None) => {
+                // Continue decompressing the block of the previous probe, if
+                // it is the same, or serve the prefix already there.
+                let key = BlockKey {
+                    table_id: self.id,
+                    block_index,
+                };
+                let resume = ctx
+                    .partial_mb_block
+                    .take()
+                    .is_some_and(|partial| partial.key == key);
+                let compressed_block = match self.storage {
+                    Storage::Pread { .. } if resume => &ctx.compressed_block[..],
+                    _ => self.compressed_block(block_index, &mut ctx.compressed_block)?,
+                };
+                if !resume {
+                    // Size the buffer for the whole block, so that probes
+                    // further into a block do not have to grow it.
+                    ctx.decompressed_block.clear();
+                    ctx.decompressed_block
+                        .reserve(self.header.block_size.get() as usize);
+                }
+                ctx.decompressor.decompress_bytes(
+                    compressed_block,
                     &mut ctx.decompressed_block,
-                    byte_index as usize + 1,
+                    prefix_len,
+                    resume,
                 )?;
-                &ctx.decompressed_block
+                ctx.partial_mb_block = Some(PartialMbBlock {
+                    key,
+                    bytes: 0..self.header.block_size.get() as usize,
+                    compressed: 0..usize::MAX,
+                });
+                f(&ctx.decompressed_block)
             }
-        };
+            (CompressionMethod::ZstdFrames, None) => {
+                ctx.partial_mb_block = None;
+                let compressed_block =
+                    self.compressed_block(block_index, &mut ctx.compressed_block)?;
+                decompress_frames(
+                    &mut ctx.decompressor,
+                    compressed_block,
+                    &mut ctx.decompressed_block,
+                    prefix_len,
+                )?;
+                f(&ctx.decompressed_block)
+            }
+        })
+    }
 
-        let value = block.get(byte_index as usize).copied().ok_or_else(|| {
+    fn mb_value(&self, value: Option<u8>, byte_index: usize) -> io::Result<MbValue> {
+        let value = value.ok_or_else(|| {
             io::Error::new(
                 io::ErrorKind::InvalidData,
                 format!("index {byte_index} not found in decompressed block"),
@@ -162,52 +541,99 @@ impl Table {
         &self,
         index: ZIndex,
         ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
     ) -> io::Result<SideValue> {
         assert_eq!(self.table_type, TableType::HighDtc);
+        let cache = self.usable_cache(cache);
 
-        let block_index = match self.starting_indices.binary_search(&U64::new(index)) {
-            Ok(block_index) => block_index,
-            Err(0) => return Ok(SideValue::Dtc(254)),
-            Err(block_index) => block_index - 1,
-        } as u32;
+        let value = match self.high_dtc_block_index(index) {
+            None => 254,
+            Some(block_index) => self.with_high_dtc_block(block_index, ctx, cache, |entries| {
+                self.find_high_dtc(block_index, entries, index)
+            })?,
+        };
+        self.high_dtc_value(value)
+    }
 
-        self.load_compressed_block(block_index, ctx)?;
+    /// Like [`Table::read_high_dtc`] for indices in ascending order, appending
+    /// a value for each of them to `values`. Each block is read and
+    /// decompressed once.
+    pub(crate) fn read_high_dtc_sorted(
+        &self,
+        indices: &[ZIndex],
+        ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
+        values: &mut Vec<io::Result<SideValue>>,
+    ) {
+        assert_eq!(self.table_type, TableType::HighDtc);
+        let cache = self.usable_cache(cache);
+        debug_assert!(indices.is_sorted());
+
+        for group in
+            indices.chunk_by(|&a, &b| self.high_dtc_block_index(a) == self.high_dtc_block_index(b))
+        {
+            let result = match self.high_dtc_block_index(group[0]) {
+                None => {
+                    values.extend(group.iter().map(|_| self.high_dtc_value(254)));
+                    Ok(())
+                }
+                Some(block_index) => self.with_high_dtc_block(block_index, ctx, cache, |entries| {
+                    values.extend(group.iter().map(|&index| {
+                        self.high_dtc_value(self.find_high_dtc(block_index, entries, index))
+                    }));
+                }),
+            };
+            if let Err(err) = result {
+                values.extend(group.iter().map(|_| Err(copy_error(&err))));
+            }
+        }
+    }
 
-        let num_per_block = self.header.block_size.get() as usize / mem::size_of::<HighDtc>();
+    /// Block that may contain the index, or `None` if it precedes all blocks.
+    fn high_dtc_block_index(&self, index: ZIndex) -> Option<u32> {
+        match self.starting_indices().binary_search(&U64::new(index)) {
+            Ok(block_index) => Some(block_index as u32),
+            Err(0) => None,
+            Err(block_index) => Some(block_index as u32 - 1),
+        }
+    }
 
-        let mut decompressed_block = match self.header.compression_method {
-            CompressionMethod::None => {
-                let mut decompressed_block = HighDtc::new_vec_zeroed(num_per_block)
-                    .expect("allocate memory for decompressed block");
-                decompressed_block
-                    .as_mut_bytes()
-                    .copy_from_slice(&ctx.compressed_block);
-                decompressed_block
+    /// Calls `f` with the entries of the fully decompressed block.
+    fn with_high_dtc_block<R>(
+        &self,
+        block_index: u32,
+        ctx: &mut ProbeContext,
+        cache: Option<&BlockCache>,
+        f: impl FnOnce(&[HighDtc]) -> R,
+    ) -> io::Result<R> {
+        Ok(match (&self.header.compression_method, cache) {
+            (CompressionMethod::Zstd | CompressionMethod::ZstdFrames, Some(cache)) => {
+                let block = self.load_cached_block(block_index, ctx, cache)?;
+                f(high_dtc_entries(&block)?)
+            }
+            (CompressionMethod::None, _) => {
+                ctx.partial_mb_block = None;
+                let block = self.compressed_block(block_index, &mut ctx.compressed_block)?;
+                f(high_dtc_entries(block)?)
             }
-            CompressionMethod::Zstd => {
-                let mut decompressed_block = Vec::<HighDtc>::new();
+            (CompressionMethod::Zstd, None) => {
+                ctx.partial_mb_block = None;
+                let compressed_block =
+                    self.compressed_block(block_index, &mut ctx.compressed_block)?;
                 ctx.decompressor.decompress_prefix(
-                    &ctx.compressed_block,
-                    &mut decompressed_block,
-                    num_per_block,
+                    compressed_block,
+                    &mut ctx.high_dtc_block,
+                    self.header.block_size.get() as usize / mem::size_of::<HighDtc>(),
                 )?;
-                decompressed_block
+                f(&ctx.high_dtc_block)
             }
-        };
-
-        if block_index == self.header.num_blocks - 1 {
-            let last_block_entries = self.header.num_elements % num_per_block as u64;
-            if last_block_entries != 0 {
-                decompressed_block.truncate(last_block_entries as usize);
+            (CompressionMethod::ZstdFrames, None) => {
+                unreachable!("seekable frames in high dtc table")
             }
-        }
-
-        let value =
-            match decompressed_block.binary_search_by_key(&U64::new(index), |entry| entry.index) {
-                Ok(ptr) => u32::from(decompressed_block[ptr].value),
-                _ => 254,
-            };
+        })
+    }
 
+    fn high_dtc_value(&self, value: u32) -> io::Result<SideValue> {
         if !(254..=self.header.max_dtc).contains(&value) {
             return Err(io::Error::new(
                 io::ErrorKind::InvalidData,
@@ -220,6 +646,72 @@ impl Table {
 
         Ok(SideValue::Dtc(value))
     }
+
+    fn find_high_dtc(&self, block_index: u32, mut entries: &[HighDtc], index: ZIndex) -> u32 {
+        if block_index == self.header.num_blocks - 1 {
+            let num_per_block = self.header.block_size.get() as usize / mem::size_of::<HighDtc>();
+            let last_block_entries = self.header.num_elements % num_per_block as u64;
+            if last_block_entries != 0 {
+                entries = &entries[..entries.len().min(last_block_entries as usize)];
+            }
+        }
+
+        match entries.binary_search_by_key(&U64::new(index), |entry| entry.index) {
+            Ok(ptr) => u32::from(entries[ptr].value),
+            _ => 254,
+        }
+    }
+}
+
+/// io::Error is not Clone, but an error reading a block applies to all
+/// probes into it.
+fn copy_error(err: &io::Error) -> io::Error {
+    io::Error::new(err.kind(), err.to_string())
+}
+
+/// Parses the frame index at the start of a block in the seekable format,
+/// returning the frame size and the offsets of the frames.
+fn frame_index(block: &[u8]) -> io::Result<(usize, &[U32])> {
+    let invalid = || io::Error::new(io::ErrorKind::InvalidData, "invalid frame index");
+    let (header, rest) = FrameIndexHeader::ref_from_prefix(block).map_err(|_| invalid())?;
+    let num_frames = header.num_frames.get() as usize;
+    if header.frame_size.get() == 0 || num_frames > MAX_FRAMES_PER_BLOCK {
+        return Err(invalid());
+    }
+    let (offsets, _) =
+        <[U32]>::ref_from_prefix_with_elems(rest, num_frames + 1).map_err(|_| invalid())?;
+    Ok((header.frame_size.get() as usize, offsets))
+}
+
+/// Decompresses the frames of a block in the seekable format, until `block`
+/// holds at least `len` bytes.
+fn decompress_frames(
+    decompressor: &mut Decompressor,
+    compressed_block: &[u8],
+    block: &mut Vec<u8>,
+    len: usize,
+) -> io::Result<()> {
+    block.clear();
+    let (_, offsets) = frame_index(compressed_block)?;
+    for frame in offsets.windows(2) {
+        if block.len() >= len {
+            break;
+        }
+        let frame = compressed_block
+            .get(frame[0].get() as usize..frame[1].get() as usize)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, "invalid frame offsets"))?;
+        decompressor.decompress_append(frame, block, len)?;
+    }
+    Ok(())
+}
+
+fn high_dtc_entries(block: &[u8]) -> io::Result<&[HighDtc]> {
+    <[HighDtc]>::ref_from_bytes(block).map_err(|_| {
+        io::Error::new(
+            io::ErrorKind::InvalidData,
+            "decompressed block size not divisible by list element size",
+        )
+    })
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
@@ -237,24 +729,24 @@ impl TableType {
     }
 }
 
-#[derive(FromBytes, Debug)]
+#[derive(FromBytes, IntoBytes, Immutable, KnownLayout, Debug, Clone)]
 #[repr(C)]
-struct RawHeader {
+pub(crate) struct RawHeader {
     unused: [u8; 16],
     basename: [u8; 16],
-    num_elements: U64,
+    pub num_elements: U64,
     kk_index: U32,
     max_dtc: U32, // aka max_depth
-    block_size: U32,
-    num_blocks: U32,
+    pub block_size: U32,
+    pub num_blocks: U32,
     nrows: u8,
     ncols: u8,
     side: u8,
     metric: u8,
-    compression_method: u8,
+    pub compression_method: u8,
     index_size: u8,
     format_type: u8,
-    list_element_size: u8,
+    pub list_element_size: u8,
 }
 
 struct Header {
@@ -266,6 +758,18 @@ struct Header {
     list_element_size: u8,
 }
 
+impl Header {
+    fn offsets_range(&self) -> Range<usize> {
+        let start = mem::size_of::<RawHeader>();
+        start..start + (self.num_blocks as usize + 1) * mem::size_of::<U64>()
+    }
+
+    fn starting_indices_range(&self) -> Range<usize> {
+        let start = self.offsets_range().end;
+        start..start + (self.num_blocks as usize + 1) * mem::size_of::<U64>()
+    }
+}
+
 impl TryFrom<RawHeader> for Header {
     type Error = io::Error;
 
@@ -283,7 +787,7 @@ impl TryFrom<RawHeader> for Header {
 }
 
 #[repr(C)]
-#[derive(FromBytes, IntoBytes, Immutable)]
+#[derive(FromBytes, IntoBytes, Immutable, KnownLayout)]
 struct HighDtc {
     index: U64,
     value: U32,
@@ -294,9 +798,28 @@ const _: () = const {
     assert!(mem::size_of::<HighDtc>() == 16);
 };
 
-enum CompressionMethod {
+/// Compression method of the seekable format, where each block is split into
+/// independently compressed frames that each hold `frame_size` bytes of the
+/// decompressed block, except maybe the last.
+///
+/// A block starts with a [`FrameIndexHeader`], followed by `num_frames + 1`
+/// offsets of the frames relative to the start of the block, the last of
+/// which is the end of the block, and then the frames.
+pub(crate) const COMPRESSION_ZSTD_FRAMES: u8 = 3;
+
+pub(crate) const MAX_FRAMES_PER_BLOCK: usize = 256;
+
+#[repr(C)]
+#[derive(FromBytes, IntoBytes, Immutable, KnownLayout)]
+pub(crate) struct FrameIndexHeader {
+    pub frame_size: U32,
+    pub num_frames: U32,
+}
+
+pub(crate) enum CompressionMethod {
     None,
     Zstd,
+    ZstdFrames,
 }
 
 impl TryFrom<u8> for CompressionMethod {
@@ -312,6 +835,7 @@ impl TryFrom<u8> for CompressionMethod {
                 ));
             }
             2 => CompressionMethod::Zstd,
+            COMPRESSION_ZSTD_FRAMES => CompressionMethod::ZstdFrames,
             _ => {
                 return Err(io::Error::new(
                     io::ErrorKind::InvalidData,
@@ -329,25 +853,53 @@ pub(crate) enum MbValue {
     MaybeHighDtc,
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone, Copy)]
 pub(crate) enum SideValue {
     Dtc(u32),
     Unresolved,
 }
 
+/// Scratch space for probing: a zstd decompression context and block buffers.
+/// The buffers grow to the largest block seen and are then reused, so probing
+/// with a long-lived context does not allocate.
+///
+/// Without a block cache, the context also keeps the Mb block (or frame) it
+/// decompressed last, so that later probes into the same block continue
+/// decompression where it stopped rather than starting over.
 pub struct ProbeContext {
     compressed_block: Vec<u8>,
     decompressed_block: Vec<u8>,
+    /// Block that `decompressed_block` holds a prefix of, with the stream of
+    /// `decompressor` positioned after it.
+    partial_mb_block: Option<PartialMbBlock>,
+    high_dtc_block: Vec<HighDtc>,
     decompressor: Decompressor,
 }
 
+struct PartialMbBlock {
+    key: BlockKey,
+    /// Bytes of the decompressed block that the stream covers, starting
+    /// with the first byte in `decompressed_block`.
+    bytes: Range<usize>,
+    /// Bytes of the compressed block that the stream reads.
+    compressed: Range<usize>,
+}
+
+impl Default for ProbeContext {
+    fn default() -> ProbeContext {
+        ProbeContext::new()
+    }
+}
+
 impl ProbeContext {
-    pub fn new() -> io::Result<ProbeContext> {
-        Ok(ProbeContext {
+    pub fn new() -> ProbeContext {
+        ProbeContext {
             compressed_block: Vec::new(),
             decompressed_block: Vec::new(),
+            partial_mb_block: None,
+            high_dtc_block: Vec::new(),
             decompressor: Decompressor::new(),
-        })
+        }
     }
 }
 
@@ -1,38 +1,163 @@
 use std::{
+    cell::RefCell,
     cmp::max,
-    ffi::c_int,
+    ffi::{CString, c_int, c_void},
     io,
     mem::MaybeUninit,
+    ops::ControlFlow,
+    os::unix::ffi::OsStrExt as _,
     path::{Path, PathBuf},
+    slice,
     sync::{
         Once,
-        atomic::{AtomicU64, Ordering},
+        atomic::{AtomicU32, AtomicU64, Ordering},
     },
 };
 
 use mbeval_sys::{
-    BishopParity, MbInfo, PawnFileType, Side, ZIndex, mbeval_get_mb_info, mbeval_init,
+    BishopParity, MBEVAL_PAGES_HUGE, MBEVAL_PAGES_HUGETLB, MBEVAL_PAGES_INTERLEAVE, MbInfo,
+    ParityIndex, PawnFileType, Piece, Side, ZIndex, mbeval_get_child_mb_info,
+    mbeval_get_mb_info_mirrored, mbeval_init, mbeval_init_from_snapshot,
+    mbeval_set_table_placement, mbeval_table_placement, mbeval_write_snapshot,
 };
 use once_cell::sync::OnceCell;
-use rustc_hash::FxHashMap;
+use rustc_hash::{FxHashMap, FxHashSet};
 use shakmaty::{
-    ByColor, ByRole, CastlingMode, Chess, Color, EnPassantMode, Position as _, Role, fen::Fen,
+    ByColor, ByRole, Chess, Color, EnPassantMode, Move, Position as _, Role, Square, fen::Fen,
 };
 
 use crate::{
+    block_cache::BlockCache,
     guess::guess_winner,
-    table::{MbValue, ProbeContext, SideValue, Table, TableType},
+    position_cache::{PositionCache, PositionKey},
+    predictor::{PredictorKey, WinnerPredictor},
+    table::{MbValue, ProbeContext, SideValue, Table, TableAccess, TableType},
 };
 
 const ALL_ONES: ZIndex = !0;
 
 static INIT_MBEVAL: Once = Once::new();
 
+/// Source of table ids, unique across all tablebases in the process, since
+/// probe contexts are shared between them and key the blocks they hold by
+/// table id.
+static NEXT_TABLE_ID: AtomicU32 = AtomicU32::new(0);
+
+thread_local! {
+    static PROBE_CONTEXT: RefCell<ProbeContext> = RefCell::new(ProbeContext::new());
+}
+
+fn init_mbeval() {
+    INIT_MBEVAL.call_once(|| {
+        unsafe {
+            mbeval_init();
+        }
+        tracing::info!(placement = ?mbeval_placement(), "mbeval initialized");
+    });
+}
+
+/// Placement of the computed mbeval index tables in memory. The tables are
+/// read at random on every probe.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct MbevalPlacement {
+    /// Back the tables with transparent huge pages, to save TLB misses.
+    pub huge_pages: bool,
+    /// Take huge pages from the preallocated hugetlbfs pool, falling back to
+    /// transparent huge pages.
+    pub hugetlb: bool,
+    /// Interleave the pages across NUMA nodes, so that probing threads on all
+    /// nodes see the same memory latency.
+    pub numa_interleave: bool,
+}
+
+impl MbevalPlacement {
+    fn flags(self) -> c_int {
+        let mut flags = 0;
+        if self.huge_pages {
+            flags |= MBEVAL_PAGES_HUGE;
+        }
+        if self.hugetlb {
+            flags |= MBEVAL_PAGES_HUGETLB;
+        }
+        if self.numa_interleave {
+            flags |= MBEVAL_PAGES_INTERLEAVE;
+        }
+        flags as c_int
+    }
+
+    fn from_flags(flags: c_int) -> MbevalPlacement {
+        let flags = flags as u32;
+        MbevalPlacement {
+            huge_pages: flags & MBEVAL_PAGES_HUGE != 0,
+            hugetlb: flags & MBEVAL_PAGES_HUGETLB != 0,
+            numa_interleave: flags & MBEVAL_PAGES_INTERLEAVE != 0,
+        }
+    }
+}
+
+/// Sets how the mbeval index tables are placed in memory when they are
+/// computed rather than mapped from a snapshot.
+///
+/// Must be called before the tables are initialized to have any effect.
+pub fn set_mbeval_placement(placement: MbevalPlacement) {
+    unsafe { mbeval_set_table_placement(placement.flags()) };
+}
+
+/// Returns the placement that took effect for the mbeval index tables. Options
+/// that the system does not support are missing.
+pub fn mbeval_placement() -> MbevalPlacement {
+    MbevalPlacement::from_flags(unsafe { mbeval_table_placement() })
+}
+
+/// Initializes the mbeval index tables by mapping a snapshot written by
+/// [`write_mbeval_snapshot`], so that restarts are fast and all processes on
+/// the host share the same pages. Falls back to computing the tables if the
+/// snapshot is missing or stale.
+///
+/// Must be called before the first [`Tablebase::new()`] to have any effect.
+/// Returns whether the snapshot was used.
+pub fn init_mbeval_from_snapshot(path: &Path) -> io::Result<bool> {
+    let path = c_path(path)?;
+    let mut used = false;
+    INIT_MBEVAL.call_once(|| {
+        used = unsafe { mbeval_init_from_snapshot(path.as_ptr()) } != 0;
+        tracing::info!(snapshot = used, placement = ?mbeval_placement(), "mbeval initialized");
+    });
+    Ok(used)
+}
+
+/// Writes a snapshot of the mbeval index tables for
+/// [`init_mbeval_from_snapshot`].
+pub fn write_mbeval_snapshot(path: &Path) -> io::Result<()> {
+    init_mbeval();
+    let path = c_path(path)?;
+    if unsafe { mbeval_write_snapshot(path.as_ptr()) } != 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+fn c_path(path: &Path) -> io::Result<CString> {
+    CString::new(path.as_os_str().as_bytes())
+        .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "path contains nul byte"))
+}
+
 pub struct Tablebase {
-    tables: FxHashMap<TableKey, (PathBuf, OnceCell<Table>)>,
+    tables: FxHashMap<TableKey, TableEntry>,
+    materials: FxHashSet<Material>,
+    block_cache: Option<BlockCache>,
+    position_cache: Option<PositionCache>,
+    predictor: WinnerPredictor,
     stats: Stats,
 }
 
+struct TableEntry {
+    path: PathBuf,
+    id: u32,
+    access: TableAccess,
+    table: OnceCell<Table>,
+}
+
 impl Default for Tablebase {
     fn default() -> Tablebase {
         Tablebase::new()
@@ -41,20 +166,85 @@ impl Default for Tablebase {
 
 impl Tablebase {
     pub fn new() -> Tablebase {
-        INIT_MBEVAL.call_once(|| {
-            unsafe {
-                mbeval_init();
-            }
-            tracing::info!("mbeval initialized");
-        });
+        init_mbeval();
 
         Tablebase {
             tables: FxHashMap::default(),
+            materials: FxHashSet::default(),
+            block_cache: None,
+            position_cache: None,
+            predictor: WinnerPredictor::new(),
             stats: Stats::default(),
         }
     }
 
+    /// Keep up to `bytes` of decompressed table blocks in memory, shared by
+    /// all threads. A capacity of `0` disables the cache.
+    pub fn set_block_cache_capacity(&mut self, bytes: usize) {
+        self.block_cache = (bytes > 0).then(|| BlockCache::new(bytes));
+    }
+
+    pub fn block_cache(&self) -> Option<&BlockCache> {
+        self.block_cache.as_ref()
+    }
+
+    /// Remember the values of up to `entries` recently probed positions,
+    /// shared by all threads. A capacity of `0` disables the cache.
+    pub fn set_position_cache_capacity(&mut self, entries: usize) {
+        self.position_cache = (entries > 0).then(|| PositionCache::new(entries));
+    }
+
+    pub fn position_cache(&self) -> Option<&PositionCache> {
+        self.position_cache.as_ref()
+    }
+
+    /// The predictor of the side to try first, which learns from every
+    /// probe.
+    pub fn predictor(&self) -> &WinnerPredictor {
+        &self.predictor
+    }
+
+    /// Seeds the predictor with the share of resolved entries in the Mb
+    /// tables that have been added, as a prior for each predictor key. This
+    /// reads and decompresses every block, so it is meant to be run offline,
+    /// saving the result with [`WinnerPredictor::save`].
+    pub fn seed_predictor(&self) -> io::Result<()> {
+        let mut ctx = ProbeContext::new();
+        let mut counts: FxHashMap<PredictorKey, (u64, u64)> = FxHashMap::default();
+        for key in self.tables.keys() {
+            if key.table_type != TableType::Mb {
+                continue;
+            }
+            let Some(table) = self.open_table(key)? else {
+                continue;
+            };
+            let (resolved, total) = table.count_resolved(&mut ctx)?;
+            let counts = counts
+                .entry(PredictorKey {
+                    material: key.material,
+                    side: key.side,
+                    pawn_file_type: key.pawn_file_type,
+                })
+                .or_default();
+            counts.0 += resolved;
+            counts.1 += total;
+        }
+        for (key, (resolved, total)) in counts {
+            self.predictor.record_prior(key, resolved, total);
+        }
+        tracing::info!("seeded predictor with {} keys", self.predictor.len());
+        Ok(())
+    }
+
     pub fn add_path(&mut self, path: impl AsRef<Path>) -> io::Result<usize> {
+        self.add_path_with_access(path, TableAccess::default())
+    }
+
+    pub fn add_path_with_access(
+        &mut self,
+        path: impl AsRef<Path>,
+        access: TableAccess,
+    ) -> io::Result<usize> {
         let mut num = 0;
         for directory in path.as_ref().read_dir()? {
             let directory = directory?.path();
@@ -73,8 +263,14 @@ impl Tablebase {
                                 kk_index,
                                 table_type,
                             },
-                            (file, OnceCell::new()),
+                            TableEntry {
+                                path: file,
+                                id: NEXT_TABLE_ID.fetch_add(1, Ordering::Relaxed),
+                                access,
+                                table: OnceCell::new(),
+                            },
                         );
+                        self.materials.insert(file_material);
                         num += 1;
                     }
                 }
@@ -87,26 +283,90 @@ impl Tablebase {
     fn open_table(&self, key: &TableKey) -> io::Result<Option<&Table>> {
         self.tables
             .get(key)
-            .map(|(path, table)| table.get_or_try_init(|| Table::open(path, key.table_type)))
+            .map(|entry| {
+                entry.table.get_or_try_init(|| {
+                    Table::open(&entry.path, key.table_type, entry.id, entry.access)
+                })
+            })
             .transpose()
     }
 
-    fn select_table(
+    fn has_table_variant(
         &self,
-        pos: &Chess,
-        mb_info: &MbInfo,
+        material: Material,
+        pawn_file_type: PawnFileType,
+        bishop_parity: ByColor<BishopParity>,
+        side: Color,
+        kk_index: KkIndex,
+    ) -> bool {
+        [TableType::Mb, TableType::HighDtc]
+            .into_iter()
+            .any(|table_type| {
+                self.tables.contains_key(&TableKey {
+                    material,
+                    pawn_file_type,
+                    bishop_parity,
+                    side,
+                    kk_index,
+                    table_type,
+                })
+            })
+    }
+
+    /// # Safety
+    ///
+    /// `mb_info` must have been filled in by a successful call to mbeval.
+    unsafe fn select_table(
+        &self,
+        material: Material,
+        side: Color,
+        mb_info: &MaybeUninit<MbInfo>,
         table_type: TableType,
     ) -> io::Result<Option<(&Table, ZIndex)>> {
+        // mbeval leaves fields that do not apply to the position
+        // uninitialized, so read only those that do.
+        let mb_info = mb_info.as_ptr();
+        let (kk_index, pawn_file_type, parity_index) = unsafe {
+            (
+                (*mb_info).kk_index,
+                (*mb_info).pawn_file_type,
+                slice::from_raw_parts(
+                    (&raw const (*mb_info).parity_index).cast::<ParityIndex>(),
+                    (*mb_info).num_parities as usize,
+                ),
+            )
+        };
+        let pawn_file_index = |pawn_file_type| unsafe {
+            match pawn_file_type {
+                PawnFileType::Free => ALL_ONES,
+                PawnFileType::Bp11 => (*mb_info).index_bp_11,
+                PawnFileType::Op11 => (*mb_info).index_op_11,
+                PawnFileType::Op21 => (*mb_info).index_op_21,
+                PawnFileType::Op12 => (*mb_info).index_op_12,
+                PawnFileType::Op22 => (*mb_info).index_op_22,
+                PawnFileType::Dp22 => (*mb_info).index_dp_22,
+                PawnFileType::Op31 => (*mb_info).index_op_31,
+                PawnFileType::Op13 => (*mb_info).index_op_13,
+                PawnFileType::Op41 => (*mb_info).index_op_41,
+                PawnFileType::Op14 => (*mb_info).index_op_14,
+                PawnFileType::Op32 => (*mb_info).index_op_32,
+                PawnFileType::Op23 => (*mb_info).index_op_23,
+                PawnFileType::Op33 => (*mb_info).index_op_33,
+                PawnFileType::Op42 => (*mb_info).index_op_42,
+                PawnFileType::Op24 => (*mb_info).index_op_24,
+            }
+        };
+
         let table_key = TableKey {
-            material: pos.board().material(),
+            material,
             pawn_file_type: PawnFileType::Free,
             bishop_parity: ByColor::new_with(|_| BishopParity::None),
-            side: pos.turn(),
-            kk_index: KkIndex(mb_info.kk_index as u32),
+            side,
+            kk_index: KkIndex(kk_index as u32),
             table_type,
         };
 
-        for bishop_parity in &mb_info.parity_index[..mb_info.num_parities as usize] {
+        for bishop_parity in parity_index {
             if let Some(table) = self.open_table(&TableKey {
                 bishop_parity: ByColor {
                     white: bishop_parity.bishop_parity[Side::White as usize],
@@ -118,171 +378,568 @@ impl Tablebase {
             }
         }
 
-        let index = match mb_info.pawn_file_type {
-            PawnFileType::Free => ALL_ONES,
-            PawnFileType::Bp11 => {
-                if mb_info.index_op_11 != ALL_ONES
-                    && let Some(table) = self.open_table(&TableKey {
-                        pawn_file_type: PawnFileType::Op11,
-                        ..table_key
-                    })?
-                {
-                    return Ok(Some((table, mb_info.index_op_11)));
-                }
-                mb_info.index_bp_11
-            }
-            PawnFileType::Op11 => mb_info.index_op_11,
-            PawnFileType::Op21 => mb_info.index_op_21,
-            PawnFileType::Op12 => mb_info.index_op_12,
-            PawnFileType::Op22 => mb_info.index_op_22,
-            PawnFileType::Dp22 => {
-                if mb_info.index_op_22 != ALL_ONES
-                    && let Some(table) = self.open_table(&TableKey {
-                        pawn_file_type: PawnFileType::Op22,
-                        ..table_key
-                    })?
-                {
-                    return Ok(Some((table, mb_info.index_op_22)));
-                }
-                mb_info.index_dp_22
-            }
-            PawnFileType::Op31 => mb_info.index_op_31,
-            PawnFileType::Op13 => mb_info.index_op_13,
-            PawnFileType::Op41 => mb_info.index_op_41,
-            PawnFileType::Op14 => mb_info.index_op_14,
-            PawnFileType::Op32 => mb_info.index_op_32,
-            PawnFileType::Op23 => mb_info.index_op_23,
-            PawnFileType::Op33 => mb_info.index_op_33,
-            PawnFileType::Op42 => mb_info.index_op_42,
-            PawnFileType::Op24 => mb_info.index_op_24,
+        // Prefer opposing pawn tables over blocked and doubled pawn tables.
+        let opposing = match pawn_file_type {
+            PawnFileType::Bp11 => Some(PawnFileType::Op11),
+            PawnFileType::Dp22 => Some(PawnFileType::Op22),
+            _ => None,
         };
+        if let Some(opposing) = opposing {
+            let index = pawn_file_index(opposing);
+            if index != ALL_ONES
+                && let Some(table) = self.open_table(&TableKey {
+                    pawn_file_type: opposing,
+                    ..table_key
+                })?
+            {
+                return Ok(Some((table, index)));
+            }
+        }
 
+        let index = pawn_file_index(pawn_file_type);
         if index == ALL_ONES {
             return Ok(None);
         }
 
         Ok(self
             .open_table(&TableKey {
-                pawn_file_type: mb_info.pawn_file_type,
+                pawn_file_type,
                 ..table_key
             })?
             .map(|table| (table, index)))
     }
 
-    fn probe_side(
-        &self,
-        pos: &Chess,
-        ctx: &mut ProbeContext,
-    ) -> Result<Option<SideValue>, io::Error> {
-        // If one side has no pieces, only the other side can potentially win.
-        if !pos.board().white().more_than_one() {
-            return Ok(Some(SideValue::Unresolved));
-        }
-
-        // Retrieve MB_INFO struct.
-        let mut squares = [mbeval_sys::Piece::NO_PIECE; 64];
-        for (sq, piece) in pos.board() {
-            let role = match piece.role {
-                Role::Pawn => mbeval_sys::Piece::PAWN,
-                Role::Knight => mbeval_sys::Piece::KNIGHT,
-                Role::Bishop => mbeval_sys::Piece::BISHOP,
-                Role::Rook => mbeval_sys::Piece::ROOK,
-                Role::Queen => mbeval_sys::Piece::QUEEN,
-                Role::King => mbeval_sys::Piece::KING,
-            };
-            squares[usize::from(sq)] = piece.color.fold_wb(role, -role);
+    /// Starts probing the position, unless its value is known without looking
+    /// at any table.
+    fn start_probe(&self, pos: &Chess) -> ControlFlow<Option<Value>, PendingProbe> {
+        if let Some(value) = outside_domain(pos) {
+            return ControlFlow::Break(value);
         }
-        let mut mb_info: MaybeUninit<MbInfo> = MaybeUninit::zeroed();
-        let result = unsafe {
-            mbeval_get_mb_info(
-                squares.as_ptr(),
+
+        // Retrieve MB_INFO structs for white and black winning, with indices
+        // only for tables that exist. mbeval tables assume that white is the
+        // winning side, so the latter is computed from the colour-mirrored
+        // position, without building it.
+        let bitboards = Color::ALL
+            .map(|color| Role::ALL.map(|role| u64::from(pos.board().by_piece(role.of(color)))));
+        let filter_data = Color::ALL.map(|winner| {
+            let (material, side) = oriented(pos, winner);
+            VariantFilter {
+                tablebase: self,
+                material,
+                side,
+            }
+        });
+        let mut mb_infos: [MaybeUninit<MbInfo>; 2] = [MaybeUninit::uninit(); 2];
+        let mut results: [c_int; 2] = [0; 2];
+        unsafe {
+            mbeval_get_mb_info_mirrored(
+                bitboards.as_ptr(),
                 pos.turn().fold_wb(Side::White, Side::Black),
                 pos.ep_square(EnPassantMode::Legal).map_or(0, c_int::from),
-                mb_info.as_mut_ptr(),
-            )
-        };
-        if result != 0 {
-            return Ok(None);
+                Some(filter_variant),
+                (&raw const filter_data[0]).cast_mut().cast(),
+                (&raw const filter_data[1]).cast_mut().cast(),
+                mb_infos.as_mut_ptr().cast(),
+                results.as_mut_ptr(),
+            );
         }
-        let mb_info = unsafe { mb_info.assume_init() };
 
-        let Some((table, index)) = self.select_table(pos, &mb_info, TableType::Mb)? else {
-            return Ok(None);
+        // Try the likely winner first to reduce the chance of having to probe
+        // the other side. Prefer what was learned from earlier probes.
+        let predictor_keys = predictor_keys(pos, &mb_infos, &results);
+        let learned = self.predictor.predict(&predictor_keys);
+        ControlFlow::Continue(PendingProbe {
+            mb_infos,
+            results,
+            winner: learned.unwrap_or_else(|| guess_winner(pos)),
+            guessed: true,
+            learned: learned.is_some(),
+            derived: false,
+            predictor_keys,
+            cache_key: None,
+        })
+    }
+
+    /// Starts probing the position after the move, deriving its MbInfos from
+    /// those of the parent probe where possible. If `winner` is given, it is
+    /// tried first instead of the guessed winner.
+    fn start_child_probe(
+        &self,
+        parent: &PendingProbe,
+        m: &Move,
+        child: &Chess,
+        winner: Option<Color>,
+    ) -> ControlFlow<Option<Value>, PendingProbe> {
+        if let Some(value) = outside_domain(child) {
+            return ControlFlow::Break(value);
+        }
+
+        // Captures and promotions may leave the materials covered by the
+        // tables altogether.
+        if (m.is_capture() || m.is_promotion())
+            && !Color::ALL
+                .into_iter()
+                .any(|winner| self.materials.contains(&oriented(child, winner).0))
+        {
+            return ControlFlow::Break(None);
+        }
+
+        let (from, to, promotion) = match *m {
+            Move::Normal {
+                from,
+                to,
+                promotion,
+                ..
+            } => (from, to, promotion),
+            Move::EnPassant { from, to } => (from, to, None),
+            Move::Castle { .. } | Move::Put { .. } => return self.start_probe(child),
         };
+        let parent_usable = (0..2).all(|i| {
+            parent.results[i] == 0 && unsafe { (*parent.mb_infos[i].as_ptr()).num_parities } > 0
+        });
+        if !parent_usable {
+            return self.start_probe(child);
+        }
+
+        let promotion = promotion.map_or(Piece::NO_PIECE, |role| match role {
+            Role::Pawn => Piece::PAWN,
+            Role::Knight => Piece::KNIGHT,
+            Role::Bishop => Piece::BISHOP,
+            Role::Rook => Piece::ROOK,
+            Role::Queen => Piece::QUEEN,
+            Role::King => Piece::KING,
+        });
+        let ep_square = child.ep_square(EnPassantMode::Legal);
+        let mut mb_infos: [MaybeUninit<MbInfo>; 2] = [MaybeUninit::uninit(); 2];
+        let mut results: [c_int; 2] = [0; 2];
+        for (i, mirrored) in [false, true].into_iter().enumerate() {
+            let square = |square: Square| {
+                c_int::from(if mirrored {
+                    square.flip_vertical()
+                } else {
+                    square
+                })
+            };
+            results[i] = unsafe {
+                mbeval_get_child_mb_info(
+                    parent.mb_infos[i].as_ptr(),
+                    square(from),
+                    square(to),
+                    promotion,
+                    (child.turn() ^ mirrored).fold_wb(Side::White, Side::Black),
+                    ep_square.map_or(0, square),
+                    mb_infos[i].as_mut_ptr(),
+                )
+            };
+        }
 
-        Ok(match table.read_mb(index, ctx)? {
-            MbValue::Dtc(dtc) => Some(SideValue::Dtc(u32::from(dtc))),
-            MbValue::Unresolved => Some(SideValue::Unresolved),
-            MbValue::MaybeHighDtc => self
-                .select_table(pos, &mb_info, TableType::HighDtc)?
-                .map(|(table, index)| table.read_high_dtc(index, ctx))
-                .transpose()?,
+        let predictor_keys = predictor_keys(child, &mb_infos, &results);
+        let learned = winner
+            .is_none()
+            .then(|| self.predictor.predict(&predictor_keys))
+            .flatten();
+        ControlFlow::Continue(PendingProbe {
+            mb_infos,
+            results,
+            winner: winner.or(learned).unwrap_or_else(|| guess_winner(child)),
+            guessed: true,
+            learned: learned.is_some(),
+            derived: winner.is_some(),
+            predictor_keys,
+            cache_key: None,
         })
     }
 
-    pub fn probe(&self, pos: &Chess) -> Result<Option<Value>, io::Error> {
-        if pos.is_insufficient_material() {
-            return Ok(Some(Value::Draw));
+    /// First lookup for the side that the probe is trying.
+    fn lookup_side(&self, pos: &Chess, probe: &mut PendingProbe) -> io::Result<Lookup<'_>> {
+        // If one side has no pieces, only the other side can potentially win.
+        if !pos.board().by_color(probe.winner).more_than_one() {
+            return Ok(Lookup::Resolved(Some(SideValue::Unresolved)));
         }
 
-        if pos.board().occupied().count() > 9 || pos.castles().any() {
-            return Ok(None);
+        let (mb_info, result) = probe.mb_info();
+        if result != 0 {
+            return Ok(Lookup::Resolved(None));
         }
 
-        // Make the stronger side white to reduce the chance of having to probe the
-        // flipped position.
-        let pos = if guess_winner(pos).is_white() {
-            pos
-        } else {
-            &flip_position(pos)
+        let (material, side) = oriented(pos, probe.winner);
+        let Some((table, index)) =
+            (unsafe { self.select_table(material, side, mb_info, TableType::Mb)? })
+        else {
+            return Ok(Lookup::Resolved(None));
         };
 
-        let mut ctx = ProbeContext::new()?;
-
-        match self.probe_side(pos, &mut ctx)? {
-            None => {
-                tracing::warn!(
-                    "no table for {} ({} pieces)",
-                    Fen::from_position(pos, EnPassantMode::Legal),
-                    pos.board().occupied().count()
-                );
-                return Ok(None);
+        if let Some(position_cache) = &self.position_cache {
+            let key = PositionKey {
+                table_id: table.id(),
+                index,
+            };
+            if let Some(side_value) = position_cache.get(&key) {
+                return Ok(Lookup::Resolved(Some(side_value)));
             }
-            Some(SideValue::Dtc(n)) => {
-                self.stats.true_predictions.fetch_add(1, Ordering::Relaxed);
-                return Ok(Some(
-                    pos.turn()
-                        .fold_wb(Value::WinningDtc(n), Value::LosingDtc(n)),
-                ));
+            probe.cache_key = Some(key);
+        }
+        Ok(Lookup::Mb(table, index))
+    }
+
+    /// Lookup that follows reading `value` from the Mb table.
+    fn lookup_after_mb(
+        &self,
+        pos: &Chess,
+        probe: &PendingProbe,
+        value: MbValue,
+    ) -> io::Result<Lookup<'_>> {
+        Ok(match value {
+            MbValue::Dtc(dtc) => Lookup::Resolved(Some(SideValue::Dtc(u32::from(dtc)))),
+            MbValue::Unresolved => Lookup::Resolved(Some(SideValue::Unresolved)),
+            MbValue::MaybeHighDtc => {
+                let (mb_info, _) = probe.mb_info();
+                let (material, side) = oriented(pos, probe.winner);
+                match unsafe { self.select_table(material, side, mb_info, TableType::HighDtc)? } {
+                    Some((table, index)) => Lookup::HighDtc(table, index),
+                    None => Lookup::Resolved(None),
+                }
             }
-            Some(SideValue::Unresolved) => (),
+        })
+    }
+
+    /// Concludes the probe given the value for the side it is trying, or
+    /// moves on to the other side.
+    fn finish_side(
+        &self,
+        pos: &Chess,
+        probe: &mut PendingProbe,
+        side_value: Option<SideValue>,
+    ) -> ControlFlow<Option<Value>> {
+        if let Some(key) = probe.cache_key.take()
+            && let Some(side_value) = side_value
+            && let Some(position_cache) = &self.position_cache
+        {
+            position_cache.insert(key, side_value);
         }
 
-        let pos = flip_position(pos);
+        if let Some(side_value) = side_value
+            && let Some(key) = probe.predictor_keys[probe.winner.fold_wb(0, 1)]
+        {
+            let resolved = matches!(side_value, SideValue::Dtc(_));
+            self.predictor.record(key, u64::from(resolved), 1);
+        }
 
-        Ok(match self.probe_side(&pos, &mut ctx)? {
+        match side_value {
             None => {
                 tracing::warn!(
-                    "no table for {} ({} pieces, flipped)",
-                    Fen::from_position(&pos, EnPassantMode::Legal),
-                    pos.board().occupied().count()
+                    "no table for {} ({} pieces{})",
+                    Fen::from_position(pos, EnPassantMode::Legal),
+                    pos.board().occupied().count(),
+                    if probe.guessed { "" } else { ", flipped" }
                 );
-                None
+                ControlFlow::Break(None)
             }
             Some(SideValue::Dtc(n)) => {
-                self.stats.false_predictions.fetch_add(1, Ordering::Relaxed);
-                Some(
-                    pos.turn()
-                        .fold_wb(Value::WinningDtc(n), Value::LosingDtc(n)),
-                )
+                if !probe.derived {
+                    if probe.guessed {
+                        self.stats.true_predictions.fetch_add(1, Ordering::Relaxed);
+                    } else {
+                        self.stats.false_predictions.fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+                if probe.learned {
+                    if probe.guessed {
+                        self.stats
+                            .learned_true_predictions
+                            .fetch_add(1, Ordering::Relaxed);
+                    } else {
+                        self.stats
+                            .learned_false_predictions
+                            .fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+                ControlFlow::Break(Some(value(pos, probe.winner, n)))
+            }
+            Some(SideValue::Unresolved) if probe.guessed => {
+                probe.winner = !probe.winner;
+                probe.guessed = false;
+                ControlFlow::Continue(())
             }
             Some(SideValue::Unresolved) => {
                 self.stats.draws.fetch_add(1, Ordering::Relaxed);
-                Some(Value::Draw)
+                ControlFlow::Break(Some(Value::Draw))
+            }
+        }
+    }
+
+    /// Probes the position with a context that is reused by all probes on the
+    /// current thread.
+    pub fn probe(&self, pos: &Chess) -> Result<Option<Value>, io::Error> {
+        PROBE_CONTEXT.with_borrow_mut(|ctx| self.probe_with_context(pos, ctx))
+    }
+
+    /// Probes the position with scratch space provided by the caller. Once
+    /// the context has grown to fit the blocks involved, probing does not
+    /// allocate.
+    pub fn probe_with_context(
+        &self,
+        pos: &Chess,
+        ctx: &mut ProbeContext,
+    ) -> Result<Option<Value>, io::Error> {
+        match self.start_probe(pos) {
+            ControlFlow::Break(value) => Ok(value),
+            ControlFlow::Continue(mut probe) => self.resolve(pos, &mut probe, ctx),
+        }
+    }
+
+    /// Looks up the value of a started probe, one table at a time.
+    fn resolve(
+        &self,
+        pos: &Chess,
+        probe: &mut PendingProbe,
+        ctx: &mut ProbeContext,
+    ) -> io::Result<Option<Value>> {
+        let cache = self.block_cache.as_ref();
+
+        let mut lookup = self.lookup_side(pos, probe)?;
+        loop {
+            lookup = match lookup {
+                Lookup::Mb(table, index) => {
+                    let value = table.read_mb(index, ctx, cache)?;
+                    self.lookup_after_mb(pos, probe, value)?
+                }
+                Lookup::HighDtc(table, index) => {
+                    Lookup::Resolved(Some(table.read_high_dtc(index, ctx, cache)?))
+                }
+                Lookup::Resolved(side_value) => match self.finish_side(pos, probe, side_value) {
+                    ControlFlow::Break(value) => return Ok(value),
+                    ControlFlow::Continue(()) => self.lookup_side(pos, probe)?,
+                },
+            };
+        }
+    }
+
+    /// Probes the position and the positions after each of its legal moves,
+    /// with a context that is reused by all probes on the current thread.
+    pub fn probe_with_children(&self, pos: &Chess) -> Result<ProbedChildren, io::Error> {
+        PROBE_CONTEXT.with_borrow_mut(|ctx| self.probe_with_children_with_context(pos, ctx))
+    }
+
+    /// Probes the position and the positions after each of its legal moves.
+    ///
+    /// The MbInfos of the children are derived from those of the root rather
+    /// than computed from scratch, and the winner of the root is tried first
+    /// for all children. Children that leave the materials covered by the
+    /// tables are settled without any lookup, and the lookups of the others
+    /// are batched as in [`Tablebase::probe_many_with_context`].
+    pub fn probe_with_children_with_context(
+        &self,
+        pos: &Chess,
+        ctx: &mut ProbeContext,
+    ) -> Result<ProbedChildren, io::Error> {
+        let moves = pos.legal_moves();
+        let (root, values) = match self.start_probe(pos) {
+            ControlFlow::Break(root) => (root, self.resolve_children(pos, None, &moves, ctx)),
+            ControlFlow::Continue(mut probe) => {
+                // Resolving changes only the side tried, not the MbInfos.
+                let root = self.resolve(pos, &mut probe, ctx)?;
+                let parent = (&probe, root);
+                (root, self.resolve_children(pos, Some(parent), &moves, ctx))
             }
+        };
+
+        Ok(ProbedChildren {
+            root,
+            children: moves
+                .into_iter()
+                .zip(values)
+                .map(|(m, value)| Ok((m, value?)))
+                .collect::<io::Result<_>>()?,
         })
     }
 
+    /// Probes the positions after some legal moves of the position, given
+    /// the value found for the position itself, with a context that is
+    /// reused by all probes on the current thread.
+    pub fn probe_children(
+        &self,
+        pos: &Chess,
+        root: Option<Value>,
+        moves: &[Move],
+    ) -> Vec<Result<Option<Value>, io::Error>> {
+        PROBE_CONTEXT.with_borrow_mut(|ctx| self.probe_children_with_context(pos, root, moves, ctx))
+    }
+
+    /// Like [`Tablebase::probe_with_children_with_context`] for only some of
+    /// the children, once the value of the position is known. This allows
+    /// probing the children of a position in parts, on several threads.
+    pub fn probe_children_with_context(
+        &self,
+        pos: &Chess,
+        root: Option<Value>,
+        moves: &[Move],
+        ctx: &mut ProbeContext,
+    ) -> Vec<Result<Option<Value>, io::Error>> {
+        match self.start_probe(pos) {
+            ControlFlow::Break(_) => self.resolve_children(pos, None, moves, ctx),
+            ControlFlow::Continue(probe) => {
+                self.resolve_children(pos, Some((&probe, root)), moves, ctx)
+            }
+        }
+    }
+
+    /// Probes the positions after the moves, starting from the probe of the
+    /// position and its value, if it needed table lookups.
+    fn resolve_children(
+        &self,
+        pos: &Chess,
+        parent: Option<(&PendingProbe, Option<Value>)>,
+        moves: &[Move],
+        ctx: &mut ProbeContext,
+    ) -> Vec<io::Result<Option<Value>>> {
+        let positions: Vec<Chess> = moves
+            .iter()
+            .map(|m| {
+                let mut after = pos.clone();
+                after.play_unchecked(*m);
+                after
+            })
+            .collect();
+
+        let Some((probe, root)) = parent else {
+            return self.probe_many_with_context(&positions, ctx);
+        };
+        let winner = match root {
+            Some(Value::WinningDtc(_)) => Some(pos.turn()),
+            Some(Value::LosingDtc(_)) => Some(!pos.turn()),
+            Some(Value::Draw) | None => None,
+        };
+        let probes = moves
+            .iter()
+            .zip(&positions)
+            .map(|(m, child)| self.start_child_probe(probe, m, child, winner));
+        self.resolve_many(&positions, probes, ctx)
+    }
+
+    /// Probes many positions at once, with a context that is reused by all
+    /// probes on the current thread.
+    ///
+    /// The table lookups of all positions are sorted by table and index, so
+    /// that each block is read and decompressed once, up to the largest offset
+    /// needed from it. Lookups that depend on the outcome of another, for high
+    /// DTC values or for the other side, are batched the same way in later
+    /// waves.
+    pub fn probe_many(&self, positions: &[Chess]) -> Vec<Result<Option<Value>, io::Error>> {
+        PROBE_CONTEXT.with_borrow_mut(|ctx| self.probe_many_with_context(positions, ctx))
+    }
+
+    /// Like [`Tablebase::probe_many`], with scratch space provided by the
+    /// caller.
+    pub fn probe_many_with_context(
+        &self,
+        positions: &[Chess],
+        ctx: &mut ProbeContext,
+    ) -> Vec<Result<Option<Value>, io::Error>> {
+        self.resolve_many(
+            positions,
+            positions.iter().map(|pos| self.start_probe(pos)),
+            ctx,
+        )
+    }
+
+    /// Looks up the values of many started probes, batching the lookups of
+    /// each wave by table and index.
+    fn resolve_many(
+        &self,
+        positions: &[Chess],
+        probes: impl Iterator<Item = ControlFlow<Option<Value>, PendingProbe>>,
+        ctx: &mut ProbeContext,
+    ) -> Vec<io::Result<Option<Value>>> {
+        let cache = self.block_cache.as_ref();
+
+        let mut values: Vec<Option<io::Result<Option<Value>>>> =
+            positions.iter().map(|_| None).collect();
+        let mut pending = Vec::new();
+        for ((i, pos), probe) in positions.iter().enumerate().zip(probes) {
+            match probe {
+                ControlFlow::Break(value) => values[i] = Some(Ok(value)),
+                ControlFlow::Continue(mut probe) => match self.lookup_side(pos, &mut probe) {
+                    Ok(lookup) => pending.push((i, probe, lookup)),
+                    Err(err) => values[i] = Some(Err(err)),
+                },
+            }
+        }
+
+        let mut order = Vec::new();
+        let mut indices = Vec::new();
+        let mut mb_values = Vec::new();
+        let mut high_dtc_values = Vec::new();
+
+        while !pending.is_empty() {
+            // Settle lookups that need no table, moving on to the other side
+            // where necessary.
+            pending.retain_mut(|(i, probe, lookup)| {
+                while let Lookup::Resolved(side_value) = *lookup {
+                    let pos = &positions[*i];
+                    if let ControlFlow::Break(value) = self.finish_side(pos, probe, side_value) {
+                        values[*i] = Some(Ok(value));
+                        return false;
+                    }
+                    match self.lookup_side(pos, probe) {
+                        Ok(next) => *lookup = next,
+                        Err(err) => {
+                            values[*i] = Some(Err(err));
+                            return false;
+                        }
+                    }
+                }
+                true
+            });
+
+            // Read all values needed from each table in index order.
+            order.clear();
+            order.extend(pending.iter().enumerate().map(|(j, (_, _, lookup))| {
+                let (table_id, index) = lookup.table_and_index();
+                (table_id, index, j)
+            }));
+            order.sort_unstable();
+            for group in order.chunk_by(|a, b| a.0 == b.0) {
+                indices.clear();
+                indices.extend(group.iter().map(|&(_, index, _)| index));
+
+                match pending[group[0].2].2 {
+                    Lookup::Mb(table, _) => {
+                        table.read_mb_sorted(&indices, ctx, cache, &mut mb_values);
+                        for (&(_, _, j), value) in group.iter().zip(mb_values.drain(..)) {
+                            let (i, probe, lookup) = &mut pending[j];
+                            match value.and_then(|value| {
+                                self.lookup_after_mb(&positions[*i], probe, value)
+                            }) {
+                                Ok(next) => *lookup = next,
+                                Err(err) => values[*i] = Some(Err(err)),
+                            }
+                        }
+                    }
+                    Lookup::HighDtc(table, _) => {
+                        table.read_high_dtc_sorted(&indices, ctx, cache, &mut high_dtc_values);
+                        for (&(_, _, j), value) in group.iter().zip(high_dtc_values.drain(..)) {
+                            let (i, _, lookup) = &mut pending[j];
+                            match value {
+                                Ok(value) => *lookup = Lookup::Resolved(Some(value)),
+                                Err(err) => values[*i] = Some(Err(err)),
+                            }
+                        }
+                    }
+                    Lookup::Resolved(_) => unreachable!("settled lookup"),
+                }
+            }
+
+            pending.retain(|(i, _, _)| values[*i].is_none());
+        }
+
+        values
+            .into_iter()
+            .map(|value| value.expect("probe finished"))
+            .collect()
+    }
+
     pub fn stats(&self) -> &Stats {
         &self.stats
     }
@@ -305,6 +962,40 @@ impl Value {
     }
 }
 
+/// Values of a position and of the positions after each of its legal moves.
+#[derive(Debug)]
+pub struct ProbedChildren {
+    pub root: Option<Value>,
+    pub children: Vec<(Move, Option<Value>)>,
+}
+
+struct VariantFilter<'a> {
+    tablebase: &'a Tablebase,
+    material: Material,
+    side: Color,
+}
+
+/// Lets mbeval skip computing indices into tables that do not exist.
+unsafe extern "C" fn filter_variant(
+    data: *mut c_void,
+    pawn_file_type: PawnFileType,
+    bishop_parity: *const BishopParity,
+    kk_index: c_int,
+) -> c_int {
+    let filter = unsafe { &*data.cast_const().cast::<VariantFilter<'_>>() };
+    let bishop_parity = unsafe { *bishop_parity.cast::<[BishopParity; 2]>() };
+    c_int::from(filter.tablebase.has_table_variant(
+        filter.material,
+        pawn_file_type,
+        ByColor {
+            white: bishop_parity[Side::White as usize],
+            black: bishop_parity[Side::Black as usize],
+        },
+        filter.side,
+        KkIndex(kk_index as u32),
+    ))
+}
+
 #[derive(Debug, Eq, Hash, PartialEq)]
 pub struct TableKey {
     material: Material,
@@ -315,7 +1006,7 @@ pub struct TableKey {
     table_type: TableType,
 }
 
-type Material = ByColor<ByRole<u8>>;
+pub(crate) type Material = ByColor<ByRole<u8>>;
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 struct KkIndex(u32);
@@ -397,7 +1088,7 @@ fn parse_filename(path: &Path) -> Option<(Material, Color, KkIndex, TableType)>
     ))
 }
 
-fn parse_material(name: &str) -> Option<Material> {
+pub(crate) fn parse_material(name: &str) -> Option<Material> {
     if name.len() > 9 {
         return None;
     }
@@ -419,7 +1110,7 @@ fn parse_material(name: &str) -> Option<Material> {
     Some(material)
 }
 
-fn parse_pawn_file_type(s: &str) -> Option<PawnFileType> {
+pub(crate) fn parse_pawn_file_type(s: &str) -> Option<PawnFileType> {
     Some(match s {
         "bp1" => PawnFileType::Bp11,
         "op1" => PawnFileType::Op11,
@@ -440,12 +1131,148 @@ fn parse_pawn_file_type(s: &str) -> Option<PawnFileType> {
     })
 }
 
-#[must_use]
-fn flip_position(pos: &Chess) -> Chess {
-    pos.to_setup(EnPassantMode::Legal)
-        .into_mirrored()
-        .position(CastlingMode::Chess960)
-        .expect("equivalent position")
+/// Inverse of [`parse_material`].
+pub(crate) fn material_name(material: &Material) -> String {
+    let mut name = String::new();
+    for color in Color::ALL {
+        name.push(Role::King.char());
+        for role in [
+            Role::Queen,
+            Role::Rook,
+            Role::Bishop,
+            Role::Knight,
+            Role::Pawn,
+        ] {
+            for _ in 0..material[color][role] {
+                name.push(role.char());
+            }
+        }
+    }
+    name
+}
+
+/// Inverse of [`parse_pawn_file_type`], or `None` for
+/// [`PawnFileType::Free`].
+pub(crate) fn pawn_file_type_name(pawn_file_type: PawnFileType) -> Option<&'static str> {
+    Some(match pawn_file_type {
+        PawnFileType::Free => return None,
+        PawnFileType::Bp11 => "bp1",
+        PawnFileType::Op11 => "op1",
+        PawnFileType::Op21 => "op21",
+        PawnFileType::Op12 => "op12",
+        PawnFileType::Dp22 => "dp2",
+        PawnFileType::Op22 => "op22",
+        PawnFileType::Op31 => "op31",
+        PawnFileType::Op13 => "op13",
+        PawnFileType::Op41 => "op41",
+        PawnFileType::Op14 => "op14",
+        PawnFileType::Op32 => "op32",
+        PawnFileType::Op23 => "op23",
+        PawnFileType::Op33 => "op33",
+        PawnFileType::Op42 => "op42",
+        PawnFileType::Op24 => "op24",
+    })
+}
+
+/// Keys of the tables that the predictor learns about, for white and black
+/// winning, or `None` for a side that cannot win or has no MbInfo.
+fn predictor_keys(
+    pos: &Chess,
+    mb_infos: &[MaybeUninit<MbInfo>; 2],
+    results: &[c_int; 2],
+) -> [Option<PredictorKey>; 2] {
+    Color::ALL.map(|winner| {
+        let i = winner.fold_wb(0, 1);
+        if results[i] != 0 || !pos.board().by_color(winner).more_than_one() {
+            return None;
+        }
+        let (material, side) = oriented(pos, winner);
+        Some(PredictorKey {
+            material,
+            side,
+            pawn_file_type: unsafe { (*mb_infos[i].as_ptr()).pawn_file_type },
+        })
+    })
+}
+
+/// A probe that needs table lookups: the MbInfo for white and black winning
+/// (that is, of the position and of its colour-mirrored counterpart), and the
+/// side currently tried.
+struct PendingProbe {
+    mb_infos: [MaybeUninit<MbInfo>; 2],
+    results: [c_int; 2],
+    winner: Color,
+    guessed: bool,
+    /// Whether the side tried first was predicted from learned outcomes.
+    learned: bool,
+    /// Whether the side tried first is the winner of the parent position,
+    /// rather than a prediction. Such probes are left out of the prediction
+    /// stats.
+    derived: bool,
+    /// Predictor keys for white and black winning, for sides that can win.
+    predictor_keys: [Option<PredictorKey>; 2],
+    /// Position cache entry to fill with the value read for the side tried.
+    cache_key: Option<PositionKey>,
+}
+
+impl PendingProbe {
+    fn mb_info(&self) -> (&MaybeUninit<MbInfo>, c_int) {
+        let i = self.winner.fold_wb(0, 1);
+        (&self.mb_infos[i], self.results[i])
+    }
+}
+
+/// Next step in finding the value for the side a probe is trying.
+#[derive(Clone, Copy)]
+enum Lookup<'a> {
+    Resolved(Option<SideValue>),
+    Mb(&'a Table, ZIndex),
+    HighDtc(&'a Table, ZIndex),
+}
+
+impl Lookup<'_> {
+    fn table_and_index(&self) -> (u32, ZIndex) {
+        match *self {
+            Lookup::Mb(table, index) | Lookup::HighDtc(table, index) => (table.id(), index),
+            Lookup::Resolved(_) => unreachable!("settled lookup"),
+        }
+    }
+}
+
+/// Value of positions that no table covers, or `None` if the position may be
+/// covered.
+fn outside_domain(pos: &Chess) -> Option<Option<Value>> {
+    if pos.is_insufficient_material() {
+        Some(Some(Value::Draw))
+    } else if pos.board().occupied().count() > 9 || pos.castles().any() {
+        Some(None)
+    } else {
+        None
+    }
+}
+
+/// Material and side to move of the position as seen by mbeval when probing
+/// whether `winner` wins, that is, of the colour-mirrored position for black.
+fn oriented(pos: &Chess, winner: Color) -> (Material, Color) {
+    let material = pos.board().material();
+    match winner {
+        Color::White => (material, pos.turn()),
+        Color::Black => (
+            ByColor {
+                white: material.black,
+                black: material.white,
+            },
+            !pos.turn(),
+        ),
+    }
+}
+
+fn value(pos: &Chess, winner: Color, dtc: u32) -> Value {
+    if pos.turn() == winner {
+        Value::WinningDtc(dtc)
+    } else {
+        Value::LosingDtc(dtc)
+    }
 }
 
 #[derive(Default)]
@@ -453,6 +1280,8 @@ pub struct Stats {
     draws: AtomicU64,
     true_predictions: AtomicU64,
     false_predictions: AtomicU64,
+    learned_true_predictions: AtomicU64,
+    learned_false_predictions: AtomicU64,
 }
 
 impl Stats {
@@ -471,4 +1300,45 @@ impl Stats {
     pub fn false_predictions(&self) -> u64 {
         self.false_predictions.load(Ordering::Relaxed)
     }
+
+    /// True predictions that came from the learned predictor rather than the
+    /// material heuristic.
+    pub fn learned_true_predictions(&self) -> u64 {
+        self.learned_true_predictions.load(Ordering::Relaxed)
+    }
+
+    /// False predictions that came from the learned predictor rather than
+    /// the material heuristic.
+    pub fn learned_false_predictions(&self) -> u64 {
+        self.learned_false_predictions.load(Ordering::Relaxed)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::fs;
+
+    use super::*;
+
+    #[test]
+    fn test_table_ids_unique_across_tablebases() {
+        // Tables are opened lazily, so empty files suffice.
+        let path = std::env::temp_dir().join(format!("op1-table-ids-{}", std::process::id()));
+        let directory = path.join("kbpkpppp_op1_out");
+        fs::create_dir_all(&directory).unwrap();
+        for name in ["kbpkpppp_w_0.mb", "kbpkpppp_b_0.mb", "kbpkpppp_w_0.hi"] {
+            fs::write(directory.join(name), []).unwrap();
+        }
+
+        let ids = |tb: &Tablebase| -> FxHashSet<u32> {
+            tb.tables.values().map(|entry| entry.id).collect()
+        };
+        let mut a = Tablebase::new();
+        let mut b = Tablebase::new();
+        assert_eq!(a.add_path(&path).unwrap(), 3);
+        assert_eq!(b.add_path(&path).unwrap(), 3);
+        fs::remove_dir_all(&path).unwrap();
+
+        assert!(ids(&a).is_disjoint(&ids(&b)));
+    }
 }
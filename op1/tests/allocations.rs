@@ -0,0 +1,104 @@
+//! Probing with a warmed-up context must not touch the heap.
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+};
+
+use op1::{ProbeContext, TableAccess, Tablebase};
+use shakmaty::{CastlingMode, Chess, fen::Fen};
+
+struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+}
+
+fn count_allocation() {
+    let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        unsafe { System.alloc_zeroed(layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        count_allocation();
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+/// Allocations made by the current thread while running f.
+fn allocations(f: impl FnOnce()) -> usize {
+    let before = ALLOCATIONS.get();
+    f();
+    ALLOCATIONS.get() - before
+}
+
+fn positions() -> Vec<Chess> {
+    [
+        "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+        "8/7p/k7/8/8/5P2/P5PP/K2b4 w - - 0 1",
+        "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+        "8/p1b5/8/2PP4/PP6/8/8/1k2K3 b - - 0 1",
+        "8/1kbp4/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+    ]
+    .into_iter()
+    .map(|fen| {
+        fen.parse::<Fen>()
+            .unwrap()
+            .into_position(CastlingMode::Chess960)
+            .unwrap()
+    })
+    .collect()
+}
+
+#[test]
+fn test_steady_state_probes_do_not_allocate() {
+    let positions = positions();
+
+    for (access, block_cache_mib) in [
+        (TableAccess::Pread, 0),
+        (TableAccess::Mmap, 0),
+        (TableAccess::Pread, 64),
+    ] {
+        let mut tb = Tablebase::new();
+        tb.set_block_cache_capacity(block_cache_mib * 1024 * 1024);
+        assert!(tb.add_path_with_access("../tables", access).unwrap() > 0);
+
+        // The first round opens tables, grows buffers and fills the cache
+        let mut ctx = ProbeContext::new();
+        for pos in &positions {
+            tb.probe_with_context(pos, &mut ctx).unwrap().unwrap();
+            tb.probe(pos).unwrap().unwrap();
+        }
+
+        let with_context = allocations(|| {
+            for pos in &positions {
+                tb.probe_with_context(pos, &mut ctx).unwrap();
+            }
+        });
+        assert_eq!(with_context, 0, "{access:?}, {block_cache_mib} MiB cache");
+
+        let thread_local = allocations(|| {
+            for pos in &positions {
+                tb.probe(pos).unwrap();
+            }
+        });
+        assert_eq!(thread_local, 0, "{access:?}, {block_cache_mib} MiB cache");
+    }
+}
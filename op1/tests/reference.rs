@@ -1,21 +1,72 @@
-use op1::{Tablebase, Value};
-use shakmaty::{CastlingMode, Chess, fen::Fen};
+use std::path::{Path, PathBuf};
+
+use op1::{ProbeContext, RepackOptions, TableAccess, Tablebase, Value, repack_seekable};
+use shakmaty::{CastlingMode, Chess, EnPassantMode, Position as _, fen::Fen};
 use test_log::test;
 
+/// Temporary directory that is removed when dropped, so that it outlives
+/// the lazily opened tables of a tablebase created before it.
+struct TempDir(PathBuf);
+
+impl TempDir {
+    fn new(name: &str) -> TempDir {
+        let path = std::env::temp_dir().join(format!("op1-{name}-{}", std::process::id()));
+        std::fs::create_dir_all(&path).unwrap();
+        TempDir(path)
+    }
+
+    fn path(&self) -> &Path {
+        &self.0
+    }
+}
+
+impl Drop for TempDir {
+    fn drop(&mut self) {
+        let _ = std::fs::remove_dir_all(&self.0);
+    }
+}
+
 fn open_tablebase() -> Tablebase {
     let mut tb = Tablebase::new(); // Implies mveval_init
     assert!(tb.add_path("../tables").unwrap() > 0);
     tb
 }
 
-fn assert_score(tb: &Tablebase, fen: &str, expected: Option<Value>) {
-    let pos: Chess = fen
-        .parse::<Fen>()
+/// Links the table files of every directory of the material from the test
+/// tables into a directory of the same name in dir.
+fn link_material_tables(dir: &Path, material: &str) {
+    for directory in std::fs::read_dir("../tables").unwrap() {
+        let directory = directory.unwrap();
+        if !directory
+            .file_name()
+            .to_str()
+            .unwrap()
+            .starts_with(material)
+        {
+            continue;
+        }
+        let linked = dir.join(directory.file_name());
+        std::fs::create_dir(&linked).unwrap();
+        for file in std::fs::read_dir(directory.path()).unwrap() {
+            let file = file.unwrap();
+            std::os::unix::fs::symlink(
+                std::fs::canonicalize(file.path()).unwrap(),
+                linked.join(file.file_name()),
+            )
+            .unwrap();
+        }
+    }
+}
+
+fn parse_position(fen: &str) -> Chess {
+    fen.parse::<Fen>()
         .unwrap()
         .into_position(CastlingMode::Chess960)
-        .unwrap();
+        .unwrap()
+}
 
-    assert_eq!(tb.probe(&pos).unwrap(), expected, "{fen}");
+fn assert_score(tb: &Tablebase, fen: &str, expected: Option<Value>) {
+    assert_eq!(tb.probe(&parse_position(fen)).unwrap(), expected, "{fen}");
 }
 
 #[test]
@@ -147,3 +198,221 @@ fn test_krppknnpp_dp2() {
         Some(Value::WinningDtc(78)),
     );
 }
+
+#[test]
+fn test_probe_many() {
+    let tb = open_tablebase();
+
+    // Positions from several tables, some sharing blocks, some needing high
+    // DTC values or the other side, and duplicates.
+    let positions: Vec<Chess> = [
+        "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+        "r7/5r1N/8/8/8/6R1/6R1/3K1k2 w - - 0 1",
+        "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+        "R7/8/8/8/7q/2K1B2p/7P/2Bk4 w - - 0 1",
+        "r7/5r1N/8/8/6R1/8/6R1/3K1k2 w - - 0 1",
+        "8/1kbp4/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+        "8/1kb1p3/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+        "1k2N3/1p1r4/3p4/3P4/8/8/KP6/N7 w - - 0 1",
+        "8/p1b5/8/2PP4/PP6/8/8/1k2K3 b - - 0 1",
+        "8/8/6B1/1K3p2/N3k1N1/8/5P2/2q5 w - - 0 1",
+        "8/4p3/8/6P1/4PP2/5b2/7P/5k1K w - - 1 3",
+        "8/8/8/8/8/8/8/K1k5 w - - 0 1",
+        "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+    ]
+    .into_iter()
+    .map(parse_position)
+    .collect();
+
+    let values = tb.probe_many(&positions);
+    assert_eq!(values.len(), positions.len());
+    for (pos, value) in positions.iter().zip(values) {
+        assert_eq!(value.unwrap(), tb.probe(pos).unwrap());
+    }
+}
+
+#[test]
+fn test_probe_with_children() {
+    let tb = open_tablebase();
+
+    for fen in [
+        "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+        "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+        "8/p1b5/8/2PP4/PP6/8/8/1k2K3 b - - 0 1",
+        "R7/8/8/8/7q/2K1B2p/7P/2Bk4 w - - 0 1",
+        "r7/5r1N/8/8/6k1/8/7R/3KR3 w - - 0 1",
+        "1k2N3/1p1r4/3p4/3P4/8/8/KP6/N7 w - - 0 1",
+        "8/1kb1p3/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+    ] {
+        let pos = parse_position(fen);
+
+        let probed = tb.probe_with_children(&pos).unwrap();
+        assert_eq!(probed.root, tb.probe(&pos).unwrap(), "{fen}");
+        assert_eq!(probed.children.len(), pos.legal_moves().len());
+
+        // The same children probed in parts, as the server does.
+        let parts: Vec<_> = pos
+            .legal_moves()
+            .chunks(4)
+            .flat_map(|moves| tb.probe_children(&pos, probed.root, moves))
+            .map(Result::unwrap)
+            .collect();
+        assert!(
+            probed.children.iter().map(|&(_, value)| value).eq(parts),
+            "{fen}"
+        );
+        for (m, value) in probed.children {
+            let mut after = pos.clone();
+            after.play_unchecked(m);
+            assert_eq!(value, tb.probe(&after).unwrap(), "{fen} {m}");
+        }
+    }
+}
+
+#[test]
+fn test_position_cache() {
+    let mut tb = open_tablebase();
+    tb.set_position_cache_capacity(1 << 16);
+
+    // The same positions with colours swapped share cache entries.
+    for _ in 0..2 {
+        assert_score(
+            &tb,
+            "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+            Some(Value::LosingDtc(3)),
+        );
+        assert_score(
+            &tb,
+            "2K1k3/p7/Ppp5/3p4/8/8/2B5/8 b - - 0 1",
+            Some(Value::LosingDtc(3)),
+        );
+        assert_score(
+            &tb,
+            "8/1kbp4/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+            Some(Value::Draw),
+        );
+    }
+
+    let position_cache = tb.position_cache().unwrap();
+    assert!(position_cache.hits() > 0);
+    assert!(!position_cache.is_empty());
+}
+
+#[test]
+fn test_shared_context() {
+    // A second tablebase with only some of the tables, so that its table
+    // ids would line up with different tables of the first if they were
+    // not unique across tablebases.
+    let dir = TempDir::new("shared-context");
+    link_material_tables(dir.path(), "kbpkpppp");
+    let mut partial = Tablebase::new();
+    assert!(partial.add_path(dir.path()).unwrap() > 0);
+    let full = open_tablebase();
+
+    let mut ctx = ProbeContext::new();
+    for _ in 0..2 {
+        for (fen, expected) in [
+            (
+                "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+                Some(Value::WinningDtc(53)),
+            ),
+            (
+                "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+                Some(Value::LosingDtc(3)),
+            ),
+            (
+                "8/p1b5/8/2PP4/PP6/8/8/1k2K3 w - - 0 1",
+                Some(Value::WinningDtc(6)),
+            ),
+            ("8/1kbp4/8/2PP4/PP6/8/8/4K3 w - - 0 1", Some(Value::Draw)),
+        ] {
+            let pos = parse_position(fen);
+            for tb in [&full, &partial] {
+                assert_eq!(
+                    tb.probe_with_context(&pos, &mut ctx).unwrap(),
+                    expected,
+                    "{fen}"
+                );
+            }
+        }
+    }
+}
+
+#[test]
+fn test_repacked_tables() {
+    // Repack the Mb tables of one material into the seekable format,
+    // replacing their links, and keep the links to its high dtc tables.
+    let dir = TempDir::new("repacked");
+    link_material_tables(dir.path(), "kbpkpppp");
+    for directory in std::fs::read_dir(dir.path()).unwrap() {
+        for file in std::fs::read_dir(directory.unwrap().path()).unwrap() {
+            let path = file.unwrap().path();
+            if path.extension().is_some_and(|extension| extension == "mb") {
+                let report = repack_seekable(
+                    &path,
+                    Some(path.as_path()),
+                    &RepackOptions {
+                        frame_size: 32 * 1024,
+                        level: 3,
+                        samples_per_block: 4,
+                    },
+                )
+                .unwrap();
+                assert!(report.frames >= u64::from(report.blocks));
+            }
+        }
+    }
+
+    // The positions and their children without captures or promotions, which
+    // stay within the repacked material.
+    let mut positions = Vec::new();
+    for fen in [
+        "8/1pp5/p1p5/8/B7/8/P6k/2K5 w - - 0 1",
+        "8/7p/k7/8/8/5P2/P5PP/K2b4 w - - 0 1",
+        "8/2b5/8/8/3P4/pPP5/P7/2k1K3 w - - 0 1",
+        "8/p1b5/8/2PP4/PP6/8/8/1k2K3 b - - 0 1",
+        "8/2bp4/8/2PP4/PP6/8/8/1k2K3 w - - 0 1",
+        "8/1kbp4/8/2PP4/PP6/8/8/4K3 w - - 0 1",
+        "8/4p3/8/6P1/4PP2/5b2/7P/5k1K w - - 1 3",
+    ] {
+        let pos = parse_position(fen);
+        for m in pos.legal_moves() {
+            if !m.is_capture() && !m.is_promotion() {
+                let mut after = pos.clone();
+                after.play_unchecked(m);
+                positions.push(after);
+            }
+        }
+        positions.push(pos);
+    }
+
+    let original = open_tablebase();
+    let expected: Vec<_> = positions
+        .iter()
+        .map(|pos| original.probe(pos).unwrap())
+        .collect();
+    assert!(expected.iter().any(Option::is_some));
+
+    // Without a block cache, probes decompress only up to the entry within
+    // its frame, resuming where consecutive probes share a frame. With the
+    // cache, whole blocks are decompressed frame by frame.
+    for (access, block_cache_mib) in [
+        (TableAccess::Pread, 0),
+        (TableAccess::Mmap, 0),
+        (TableAccess::Pread, 64),
+    ] {
+        let mut tb = Tablebase::new();
+        tb.set_block_cache_capacity(block_cache_mib * 1024 * 1024);
+        assert!(tb.add_path_with_access(dir.path(), access).unwrap() > 0);
+
+        let mut ctx = ProbeContext::new();
+        for (pos, expected) in positions.iter().zip(&expected) {
+            assert_eq!(
+                tb.probe_with_context(pos, &mut ctx).unwrap(),
+                *expected,
+                "{access:?} {block_cache_mib} MiB: {}",
+                Fen::from_position(pos, EnPassantMode::Legal)
+            );
+        }
+    }
+}